@@ -69,21 +69,26 @@
 
         MOUNTING=0 # be able to mount multiple file systems
           GETCWD=0 # getcwd(3) syscall-like functionality
-        UPREEMPT=0 # userland preemption
+        UPREEMPT=1 # userland preemption
              MTP=0 # multiple kernel threads per process
          SHADOWD=0 # shadow page cleanup
+             PAE=0 # three-level page tables, lets weenix use memory above 4gb
 
 # Boolean options specified in this specified in this file that should be
 # included as definitions at compile time
-        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD UPREEMPT"
+        COMPILE_CONFIG_BOOLS=" DRIVERS VFS S5FS VM FI DYNAMIC MOUNTING MTP SHADOWD GETCWD PAE UPREEMPT "
 # As above, but not booleans
-        COMPILE_CONFIG_DEFS=" NTERMS NDISKS DBG DISK_SIZE BOCHS_INSTALL_DIR"
+        COMPILE_CONFIG_DEFS=" NTERMS NDISKS DBG DISK_SIZE DISK_BLOCKS SWAP_BLOCKS BOCHS_INSTALL_DIR"
 
 # Parameters for the hard disk we build (must be compatible!)
 # If the FS is too big for the disk, BAD things happen!
         DISK_BLOCKS=1024 # For fsmaker
         DISK_INODES=240 # for fsmaker
 
+# Blocks of swap space on the hard disk, after the file system's blocks.
+# 0 disables swap, anonymous memory then always stays in memory.
+        SWAP_BLOCKS=4096
+
 # Debug message behavior. Note that this can be changed at runtime by
 # modifying the dbg_modes global variable.
 # All debug statements
@@ -11,21 +11,40 @@
 
 #include "proc/proc.h"
 
+#include "main/extable.h"
+
 #include "vm/vmmap.h"
 
 #include "api/access.h"
 #include "api/syscall.h"
 
+/* Copies nbytes from src to dst, where one of them is a user address
+ * in the current address space. Pages which are not mapped yet are
+ * faulted in as the copy touches them. If a fault cannot be resolved
+ * the copy stops there and the number of bytes which were not copied
+ * is returned, so 0 means success. */
+static size_t _user_copy(void *dst, const void *src, size_t nbytes)
+{
+        __asm__ volatile("1:     rep movsb\n\t"
+                         "2:\n\t"
+                         EXTABLE_ENTRY("1b", "2b")
+                         : "+D"(dst), "+S"(src), "+c"(nbytes)
+                         :
+                         : "memory");
+        return nbytes;
+}
+
 /* copy_to_user and copy_from_user are used to copy to and from the
  * user space of the current process.  They first check that the range
- * of addresses has valid mappings, then call vmmap_read/write.
+ * of addresses lies in areas with the right permissions, then copy
+ * directly through the current page table.
  */
 int copy_from_user(void *kaddr, const void *uaddr, size_t nbytes)
 {
         if (!range_perm(curproc, uaddr, nbytes, PROT_READ)) {
                 return -EFAULT;
         }
-        return vmmap_read(curproc->p_vmmap, uaddr, kaddr, nbytes);
+        return (0 == _user_copy(kaddr, uaddr, nbytes)) ? 0 : -EFAULT;
 }
 
 int copy_to_user(void *uaddr, const void *kaddr, size_t nbytes)
@@ -33,13 +52,13 @@ int copy_to_user(void *uaddr, const void *kaddr, size_t nbytes)
         if (!range_perm(curproc, uaddr, nbytes, PROT_WRITE)) {
                 return -EFAULT;
         }
-        return vmmap_write(curproc->p_vmmap, uaddr, kaddr, nbytes);
+        return (0 == _user_copy(uaddr, kaddr, nbytes)) ? 0 : -EFAULT;
 }
 
 /* Like strndup(), but gets the string from user space, ensuring
  * that the entire string (up to its length) has valid mappings.
  * The resulting string can be freed with kfree().
- * This function may block (as vmmap_read may block)
+ * This function may block (as faulting in user pages may block)
  */
 char *user_strdup(argstr_t *ustr)
 {
@@ -122,19 +141,7 @@ fail:
  */
 int addr_perm(struct proc *p, const void *vaddr, int perm)
 {
-   vmarea_t *vmarea = NULL;
-   if(NULL != p->p_vmmap)
-   {
-      vmarea = vmmap_lookup(p->p_vmmap, *((uint32_t*)vaddr));
-      if(vmarea)
-      {
-        if(vmarea->vma_prot & perm)
-        {
-           return 1;
-        }
-      }
-   }
-   return 0;
+        return range_perm(p, vaddr, 1, perm);
 }
 
 /*
@@ -148,26 +155,21 @@ int addr_perm(struct proc *p, const void *vaddr, int perm)
  */
 int range_perm(struct proc *p, const void *avaddr, size_t len, int perm)
 {
-	int ret = addr_perm(p,avaddr,perm);
-        if(0 != ret)
-	{
-          uint32_t newaddr = *((uint32_t*)avaddr);
-          vmarea_t *vma = NULL;
-	  do {
-                vma = vmmap_lookup(p->p_vmmap, newaddr);
-                while(vma->vma_end >= newaddr && 
-		      newaddr < *((uint32_t*)avaddr)+len){
-                        newaddr += 1;
-                        }
-                
-                ret = addr_perm(p,&newaddr, perm);
-	  } while(ret && 
-		  newaddr< (*((uint32_t*)avaddr)+len-1));
+        uintptr_t start = (uintptr_t)avaddr;
+        if (NULL == p->p_vmmap || USER_MEM_LOW > start || USER_MEM_HIGH <= start
+            || USER_MEM_HIGH - start < len) {
+                return 0;
         }
 
-        if(ret)
-        return ret;
-	else
-	return -1;	
-
+        /* One lookup per area the range passes through */
+        uint32_t vfn = ADDR_TO_PN(start);
+        uint32_t endvfn = ADDR_TO_PN(start + len + PAGE_SIZE - 1);
+        while (vfn < endvfn) {
+                vmarea_t *vma = vmmap_lookup(p->p_vmmap, vfn);
+                if (NULL == vma || perm != (vma->vma_prot & perm)) {
+                        return 0;
+                }
+                vfn = vma->vma_end;
+        }
+        return 1;
 }
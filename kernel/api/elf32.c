@@ -665,16 +665,22 @@ static int _elf32_load(const char *filename, int fd, char *const argv[],
     vmmap_mapping_info(map,bufff,500);
     dbg_print("%s\n",bufff);
 
-        /* Give the process the new mappings. */
+        /* Give the process the new mappings. A vfork child gives back
+         * the ones it borrowed instead of cleaning them up. */
+        vfork_release();
         vmmap_t *tempmap = curproc->p_vmmap;
         curproc->p_vmmap = map;
         map = tempmap; /* So the old maps are cleaned up */
         curproc->p_vmmap->vmm_proc = curproc;
-        map->vmm_proc = NULL;
+        if (NULL != map) {
+                map->vmm_proc = NULL;
+        }
 
         /* Flush the process pagetables and TLB */
         pt_unmap_range(curproc->p_pagedir, USER_MEM_LOW, USER_MEM_HIGH);
-        tlb_flush_all();
+        curproc->p_nresident = 0;
+        curproc->p_nswapped = 0;
+        curproc->p_rsshand = 0;
 
         /* Set the process break and starting break (immediately after the mapped-in
          * text/data/bss from the executable) */
@@ -2,6 +2,7 @@
 #include "globals.h"
 #include "errno.h"
 #include "types.h"
+#include "limits.h"
 
 #include "main/interrupt.h"
 
@@ -12,6 +13,7 @@
 #include "util/string.h"
 #include "util/debug.h"
 #include "util/list.h"
+#include "util/time.h"
 
 #include "mm/mman.h"
 #include "mm/mm.h"
@@ -27,9 +29,11 @@
 #include "vm/brk.h"
 #include "vm/mmap.h"
 #include "vm/vmmap.h"
+#include "vm/shm.h"
 
 #include "api/syscall.h"
 #include "api/utsname.h"
+#include "api/time.h"
 #include "api/access.h"
 #include "api/exec.h"
 
@@ -479,6 +483,193 @@ static int sys_munmap(munmap_args_t *args)
         return 0;
 }
 
+static int sys_madvise(madvise_args_t *args)
+{
+        madvise_args_t          kargs;
+        int                     err;
+
+        if (copy_from_user(&kargs, args, sizeof(madvise_args_t))) {
+                curthr->kt_errno = EFAULT;
+                return -1;
+        }
+
+        err = do_madvise(kargs.addr, kargs.len, kargs.advice);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static void *sys_mremap(mremap_args_t *arg)
+{
+        mremap_args_t           kargs;
+        void                    *ret;
+        int                     err;
+
+        if (copy_from_user(&kargs, arg, sizeof(mremap_args_t)) < 0) {
+                curthr->kt_errno = EFAULT;
+                return MAP_FAILED;
+        }
+
+        err = do_mremap(kargs.old_addr, kargs.old_len, kargs.new_len,
+                        kargs.flags, &ret);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return MAP_FAILED;
+        }
+        return ret;
+}
+
+/*
+ * Sets the number of pages the process keeps mapped, its resident set,
+ * before its own pages are reclaimed ahead of anyone else's. 0 means no
+ * limit. The limit is inherited by fork(2) and kept across exec(2).
+ */
+static int sys_rsslimit(size_t npages)
+{
+        curproc->p_rsslimit = npages;
+        return 0;
+}
+
+/*
+ * Adds incr to the nice value of the current process, clamped to
+ * NICE_MIN..NICE_MAX, and returns the new value.
+ */
+static int sys_nice(int incr)
+{
+        int nice = curproc->p_nice + incr;
+
+        nice = MAX(NICE_MIN, MIN(NICE_MAX, nice));
+        curproc->p_nice = nice;
+        return nice;
+}
+
+/*
+ * Clock ticks to sleep for to be sure at least sec seconds and nsec
+ * nanoseconds pass, capped at the most ticks a uint32_t holds.
+ */
+static uint32_t sleep_ticks(uint32_t sec, uint32_t nsec)
+{
+        /* the nanoseconds add at most TIME_HZ + 1 ticks, and there is one
+         * more for the tick under way, which may be nearly over */
+        sec = MIN(sec, (UINT_MAX - TIME_HZ - 2) / TIME_HZ);
+        return sec * TIME_HZ + TIME_MSECS_TO_TICKS((nsec + 999999) / 1000000) + 1;
+}
+
+/*
+ * Sleeps for the given number of ticks unless cancelled, in which case
+ * it returns -EINTR. The ticks still to go are put in left.
+ */
+static int do_sleep(uint32_t ticks, uint32_t *left)
+{
+        ktqueue_t q;
+        uint32_t start = time_ticks(), elapsed;
+        int ret;
+
+        sched_queue_init(&q);
+        elapsed = 0;
+        do {
+                /* long sleeps take more than one timer */
+                ret = sched_cancellable_sleep_on_timeout(&q, ticks - elapsed);
+                elapsed = time_ticks() - start;
+        } while (-ETIMEDOUT == ret && elapsed < ticks);
+        *left = (elapsed < ticks) ? ticks - elapsed : 0;
+        return (-ETIMEDOUT == ret) ? 0 : ret;
+}
+
+/* Returns the seconds left to sleep if cancelled, 0 otherwise */
+static int sys_sleep(unsigned int sec)
+{
+        uint32_t left;
+
+        if (do_sleep(sleep_ticks(sec, 0), &left) < 0) {
+                return (left + TIME_HZ - 1) / TIME_HZ;
+        }
+        return 0;
+}
+
+static int sys_nanosleep(nanosleep_args_t *arg)
+{
+        nanosleep_args_t        kern_args;
+        struct timespec         req, rem;
+        uint32_t                left;
+        int                     err;
+
+        if ((err = copy_from_user(&kern_args, arg, sizeof(nanosleep_args_t))) < 0
+            || (err = copy_from_user(&req, kern_args.req, sizeof(struct timespec))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        if (req.tv_sec < 0 || req.tv_nsec < 0 || req.tv_nsec >= 1000000000) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        if ((err = do_sleep(sleep_ticks(req.tv_sec, req.tv_nsec), &left)) < 0) {
+                if (NULL != kern_args.rem) {
+                        rem.tv_sec = left / TIME_HZ;
+                        rem.tv_nsec = (left % TIME_HZ) * TICK_MSECS * 1000000;
+                        if (copy_to_user(kern_args.rem, &rem, sizeof(struct timespec)) < 0) {
+                                err = -EFAULT;
+                        }
+                }
+                curthr->kt_errno = -err;
+                return -1;
+        }
+        return 0;
+}
+
+static int sys_shm_open(shm_open_args_t *arg)
+{
+        shm_open_args_t         kern_args;
+        char                    *name;
+        int                     err;
+
+        if ((err = copy_from_user(&kern_args, arg, sizeof(shm_open_args_t))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+
+        name = user_strdup(&kern_args.name);
+        if (!name) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        err = do_shm_open(name, kern_args.len, kern_args.oflag);
+        kfree(name);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
+}
+
+static int sys_shm_unlink(argstr_t *arg)
+{
+        argstr_t                kern_args;
+        char                    *name;
+        int                     err;
+
+        if ((err = copy_from_user(&kern_args, arg, sizeof(argstr_t))) < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        }
+
+        name = user_strdup(&kern_args);
+        if (!name) {
+                curthr->kt_errno = EINVAL;
+                return -1;
+        }
+
+        err = do_shm_unlink(name);
+        kfree(name);
+        if (err < 0) {
+                curthr->kt_errno = -err;
+                return -1;
+        } else return err;
+}
+
 static void *sys_mmap(mmap_args_t *arg)
 {
         mmap_args_t             kargs;
@@ -625,6 +816,16 @@ static int sys_fork(regs_t *regs)
         return ret;
 }
 
+static int sys_vfork(regs_t *regs)
+{
+        int ret = do_vfork(regs);
+        if (ret < 0) {
+                curthr->kt_errno = -ret;
+                return -1;
+        }
+        return ret;
+}
+
 static void free_vector(char **vect)
 {
         char **temp;
@@ -776,6 +977,9 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_fork:
                         return sys_fork(regs);
 
+                case SYS_vfork:
+                        return sys_vfork(regs);
+
                 case SYS_getpid:
                         return curproc->p_pid;
 
@@ -797,6 +1001,30 @@ static int syscall_dispatch(uint32_t sysnum, uint32_t args, regs_t *regs)
                 case SYS_munmap:
                         return sys_munmap((munmap_args_t *) args);
 
+                case SYS_madvise:
+                        return sys_madvise((madvise_args_t *) args);
+
+                case SYS_mremap:
+                        return (int) sys_mremap((mremap_args_t *) args);
+
+                case SYS_rsslimit:
+                        return sys_rsslimit((size_t) args);
+
+                case SYS_shm_open:
+                        return sys_shm_open((shm_open_args_t *) args);
+
+                case SYS_shm_unlink:
+                        return sys_shm_unlink((argstr_t *) args);
+
+                case SYS_nice:
+                        return sys_nice((int) args);
+
+                case SYS_sleep:
+                        return sys_sleep((unsigned int) args);
+
+                case SYS_nanosleep:
+                        return sys_nanosleep((nanosleep_args_t *) args);
+
                 case SYS_open:
                         return sys_open((open_args_t *) args);
 
@@ -2,11 +2,13 @@
 
 /* Kernel and user header (via symlink) */
 
+#ifndef __ASSEMBLY__
 #ifdef __KERNEL__
 #include "types.h"
 #else
 #include "sys/types.h"
 #endif
+#endif
 
 /* Trap number for syscalls */
 #define INTR_SYSCALL 0x2e
@@ -25,7 +27,7 @@
 #define SYS_unlink              9
 #define SYS_execve              10
 #define SYS_chdir               11
-#define SYS_sleep               12 /* NYI */
+#define SYS_sleep               12
 #define SYS_lseek               14
 #define SYS_sync                15
 #define SYS_nuke                16 /* NYI */
@@ -56,6 +58,14 @@
 #define SYS_mount               45
 #define SYS_umount              46
 #define SYS_stat                47
+#define SYS_madvise             48
+#define SYS_vfork               49
+#define SYS_mremap              50
+#define SYS_rsslimit            51
+#define SYS_shm_open            52
+#define SYS_shm_unlink          53
+#define SYS_nice                54
+#define SYS_nanosleep           55
 
 /*
  * ... what does the scouter say about his syscall?
@@ -65,6 +75,8 @@
 #define SYS_debug               9001
 #define SYS_kshell              9002
 
+#ifndef __ASSEMBLY__
+
 struct regs;
 struct stat;
 
@@ -98,6 +110,32 @@ typedef struct munmap_args {
         size_t  len;
 } munmap_args_t;
 
+typedef struct madvise_args {
+        void   *addr;
+        size_t  len;
+        int     advice;
+} madvise_args_t;
+
+typedef struct mremap_args {
+        void   *old_addr;
+        size_t  old_len;
+        size_t  new_len;
+        int     flags;
+} mremap_args_t;
+
+typedef struct shm_open_args {
+        argstr_t name;
+        size_t   len;
+        int      oflag;
+} shm_open_args_t;
+
+struct timespec;
+
+typedef struct nanosleep_args {
+        const struct timespec *req;
+        struct timespec       *rem;
+} nanosleep_args_t;
+
 typedef struct open_args {
         argstr_t filename;
         int      flags;
@@ -168,3 +206,5 @@ typedef struct stat_args {
 } stat_args_t;
 
 struct utsname;
+
+#endif /* __ASSEMBLY__ */
@@ -0,0 +1,8 @@
+#pragma once
+
+struct timespec {
+        long tv_sec;            /* seconds */
+        long tv_nsec;           /* nanoseconds, less than 1000000000 */
+};
+
+int nanosleep(const struct timespec *req, struct timespec *rem);
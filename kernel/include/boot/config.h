@@ -2,3 +2,4 @@
 
 #define KERNEL_PHYS_BASE 0x100000
 #define MEMORY_MAP_BASE 0x9000
+#define KERNEL_VIRT_BASE 0xc0000000
@@ -23,12 +23,42 @@
  *     the rest are given to the vm system
  */
 #define KMEM_FRAC(x)               (((x)>>2)+((x)>>3)) /* 37.5%-ish */
+#define PT_PAGEDIR_CACHE           8 /* destroyed page directories kept for reuse */
 
 /*     pframe/mmobj-system-related: */
 #define PF_HASH_SIZE                  17 /* Number of buckets in pn/mmobj->pframe hash */
 /*         Pageout-related: */
 #define PAGEOUTD_FREE_TARGET_SHIFT     5 /* 3.125% */
 #define PAGEOUTD_FREE_MIN_SHIFT        4 /* 6.25% */
+#define PFRAME_RECLAIM_TRIES           4 /* direct reclaim passes before the OOM killer runs */
+#define PFRAME_RECLAIM_PAGES           8 /* pages freed per direct reclaim pass */
+/*         TLB-related: */
+#define TLB_FLUSH_ALL_THRESHOLD       32 /* pages; above this reload cr3 instead of invlpg */
+/*         Pagefault-related: */
+#define FAULT_AROUND_PAGES            16 /* window of resident pages mapped on a fault, 0 disables */
+#define READAHEAD_PAGES               32 /* pages read in after a fault in MADV_SEQUENTIAL areas */
+/*         Shadow-object-related: */
+#define SHADOW_COLLAPSE_BATCH          8 /* collapses done per release before leaving the rest to shadowd */
+/*         Swap-related: */
+#define SWAP_HASH_SIZE                61 /* Number of buckets in pn/mmobj->swap slot hash */
+#define SWAP_ZPOOL_PERCENT            10 /* share of memory which may hold compressed pages, 0 disables */
+#define SWAP_ZPOOL_MAX_LEN          2048 /* pages which do not compress to this go to disk */
+/*         Shared-memory-related: */
+#define SHM_MAX_SEGMENTS              32 /* named segments which may exist at once */
+/*         KSM-related: */
+#define KSM_HASH_SIZE                 61 /* Number of buckets in each of ksmd's page hashes */
+#define KSM_SCAN_PAGES                64 /* pages looked at by ksmd between yields */
+
+/*
+ * Scheduler-related:
+ */
+#define SCHED_SLICE_KCYCLES         2000 /* CPU time at the top level before a thread
+                                          * drops a level, doubled at each level down */
+#define SCHED_BOOST_KCYCLES       200000 /* how often every runnable thread is put back
+                                          * on the top level */
+#define SCHED_WAKE_BOOST               2 /* levels a thread rises when woken from a sleep */
+#define SCHED_QUANTUM_TICKS            2 /* clock ticks a thread runs before giving way to
+                                          * another at its priority */
 
 
 /*
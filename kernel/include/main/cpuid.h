@@ -87,5 +87,13 @@ enum cpuid_requests {
 
 static inline void cpuid(int request, uint32_t *a, uint32_t *d)
 {
-        __asm__ volatile("cpuid":"=a"(*a), "=d"(*d):"0"(request));
+        __asm__ volatile("cpuid":"=a"(*a), "=d"(*d):"0"(request):"ebx", "ecx");
+}
+
+/* Reads the processor's time stamp counter */
+static inline uint64_t rdtsc(void)
+{
+        uint32_t lo, hi;
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return ((uint64_t)hi << 32) | lo;
 }
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "types.h"
+
+/* The exception table lists kernel instructions which are allowed to
+ * fault on user memory, each with the address to resume at if the
+ * fault cannot be resolved. EXTABLE_ENTRY(insn, fixup) is meant to be
+ * pasted into inline assembly after the instruction, with insn and
+ * fixup being local labels such as "1b" and "2f". The linker script
+ * gathers all entries between kernel_start_extable and
+ * kernel_end_extable. */
+#define EXTABLE_ENTRY(insn, fixup)                      \
+        ".pushsection .extable, \"a\"\n\t"              \
+        ".balign 4\n\t"                                 \
+        ".long " insn ", " fixup "\n\t"                 \
+        ".popsection\n\t"
+
+/* Returns the fixup address for a fault at eip, or 0 if faults at
+ * eip are not expected. */
+uintptr_t extable_fixup(uintptr_t eip);
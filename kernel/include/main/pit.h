@@ -2,7 +2,22 @@
 
 #include "types.h"
 
+/* The rate the PIT counts down at */
+#define PIT_CLOCK_HZ 1193182
+
 /* Starts the Programmable Interval Timer (PIT)
- * delivering periodic interrupts at 1000 Hz
- * (i.e., one every millisecond) to the given interrupt. */
-void pit_starttimer(uint8_t intr);
+ * delivering periodic interrupts at the given rate
+ * (between 19 and 1193182 Hz) to the given interrupt. */
+void pit_starttimer(uint8_t intr, unsigned int hz);
+
+/* Goes back to periodic interrupts at the given rate after
+ * pit_oneshot(). */
+void pit_periodic(unsigned int hz);
+
+/* Stops the periodic interrupts and delivers a single interrupt
+ * once the PIT has counted down count times (at most 1/18 s). */
+void pit_oneshot(uint16_t count);
+
+/* Returns how many counts are left before the interrupt asked for
+ * with pit_oneshot(), or 0 if it has already been raised. */
+uint16_t pit_remaining(void);
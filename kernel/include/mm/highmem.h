@@ -0,0 +1,22 @@
+#pragma once
+
+#include "mm/pagetable.h"
+
+/* High memory is usable physical memory which is not in the kernel's
+ * direct map, either because it lies above 4gb (only reachable with
+ * PAE) or because there is more of it than kernel virtual address
+ * space. It is never accessed directly, only through temporary
+ * mappings (pt_phys_tmp_map_slot), and is used for pages which never
+ * go to or come from a device (see pframe_kmap). */
+
+/* Adds the physical pages in [start, end) to high memory. Only used
+ * while booting, by phys_detect_highmem_ranges. */
+void highmem_add_range(paddr_t start, paddr_t end);
+
+/* Allocates and frees one page of high memory. highmem_alloc returns
+ * its physical address, or 0 if no high memory is left. */
+paddr_t highmem_alloc(void);
+void    highmem_free(paddr_t paddr);
+
+/* Returns the number of free pages of high memory. */
+uint32_t highmem_free_count(void);
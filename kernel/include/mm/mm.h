@@ -24,11 +24,11 @@ void page_init();
  * memory starting with the kernel text at 0xc0000000. */
 void pt_init();
 
-/* Called from the bootstrap context in order to set up the template
- * page directory used by all future threads. This cannot be set up
- * prior to this because the stack is mapped in to the first 4mb
- * of memory. Page faults are not handled until this function is
- * called. */
+/* Called from the bootstrap context in order to finish the kernel's
+ * page directory entries shared by all future threads, by removing
+ * the identity mapping of the first 4mb. This cannot be done prior to
+ * this because the stack is mapped in to the first 4mb of memory.
+ * Page faults are not handled until this function is called. */
 void pt_template_init();
 
 /* Initializes the slab allocator subsystem. This should be done
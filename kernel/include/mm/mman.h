@@ -23,3 +23,20 @@
 */
 #define MAP_FIXED       4
 #define MAP_ANON        8
+#define MAP_ANONYMOUS   MAP_ANON
+#define MAP_LARGEPAGE   0x10  /* back with large pages where possible, MAP_ANON only */
+#define MAP_POPULATE    0x20  /* prefault the whole mapping */
+#define MAP_SHM         0x40  /* fd is a segment from shm_open() */
+
+/* Flags for mremap().
+*/
+#define MREMAP_MAYMOVE  1     /* the mapping may be moved to grow */
+
+/* Advice for madvise().
+*/
+#define MADV_NORMAL     0     /* no special treatment */
+#define MADV_RANDOM     1     /* expect random page references */
+#define MADV_SEQUENTIAL 2     /* expect sequential page references */
+#define MADV_WILLNEED   3     /* will need these pages */
+#define MADV_DONTNEED   4     /* don't need these pages */
+#define MADV_FREE       8     /* contents of private pages may be discarded */
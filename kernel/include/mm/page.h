@@ -20,7 +20,7 @@
 
 #define PAGE_ALIGNED(x) (0 == ((uintptr_t)(x)) % PAGE_SIZE)
 
-#define PAGE_NSIZES  8
+#define PAGE_NSIZES  11
 
 #define PAGE_SAME(addr1, addr2) (PAGE_ALIGN_DOWN(addr1) == PAGE_ALIGN_DOWN(addr2))
 
@@ -44,7 +44,9 @@ void  page_free(void *addr);
  * A call to page_alloc_n will allocate a block, to free
  * that block a call should be made to page_free_n with
  * npages set to the same as it was when the block was
- * allocated */
+ * allocated. Alternatively the block may be released
+ * one page at a time with page_free, which lets callers
+ * hand the pages of a block to different owners. */
 void *page_alloc_n(uint32_t npages);
 void  page_free_n(void *start, uint32_t npages);
 
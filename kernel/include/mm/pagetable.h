@@ -6,6 +6,7 @@
 #define PD_WRITE_THROUGH  0x008
 #define PD_CACHE_DISABLED 0x010
 #define PD_ACCESSED       0x020
+#define PD_SIZE           0x080 /* large page, only valid with PSE or PAE */
 
 #define PT_PRESENT        0x001
 #define PT_WRITE          0x002
@@ -16,17 +17,49 @@
 #define PT_DIRTY          0x040
 #define PT_SIZE           0x080
 #define PT_GLOBAL         0x100
+#define PT_PAGEDOUT       0x200 /* in an entry which is not present: the page
+                                 * was unmapped to be paged out */
 
+/* With PAE (three-level paging) entries are 64 bits wide, so a page
+ * table holds 512 of them and covers 2mb instead of 4mb, and physical
+ * addresses may lie above 4gb. paddr_t holds any physical address. */
+#ifdef __PAE__
+typedef uint64_t pte_t;
+typedef uint64_t pde_t;
+typedef uint64_t paddr_t;
+#define PT_ADDR_MASK      0x000ffffffffff000ULL
+#define PT_LARGE_SIZE     0x00200000
+#else
 typedef uint32_t pte_t;
 typedef uint32_t pde_t;
+typedef uint32_t paddr_t;
+#define PT_ADDR_MASK      PAGE_MASK
+#define PT_LARGE_SIZE     0x00400000
+#endif
+
+/* A large page covers the address range of one whole page table */
+#define PT_LARGE_NPAGES   (PT_LARGE_SIZE / PAGE_SIZE)
+
+/* Slots for pt_phys_tmp_map_slot. Slot 0 is the one pt_phys_tmp_map
+ * uses, and so is clobbered by pt_virt_to_phys, the others are for
+ * code which keeps high memory mapped while calling into the paging
+ * code (see pframe_kmap) */
+#define PT_TMP_SLOT_KMAP0 1
+#define PT_TMP_SLOT_KMAP1 2
+#define PT_TMP_NSLOTS     3
 
 typedef struct pagedir pagedir_t;
+struct tlb_gather;
 
 /* Temporarily maps one page at the given physical address in at a
  * virtual address and returns that virtual address. Note that repeated
  * calls to this function will return the same virtual address, thereby
  * invalidating the previous mapping. */
-uintptr_t pt_phys_tmp_map(uintptr_t paddr);
+uintptr_t pt_phys_tmp_map(paddr_t paddr);
+
+/* As pt_phys_tmp_map, but using one of PT_TMP_NSLOTS separate virtual
+ * addresses, so that a mapping in one slot survives mapping another. */
+uintptr_t pt_phys_tmp_map_slot(paddr_t paddr, uint32_t slot);
 
 /* Permenantly maps the given number of physical pages, starting at the
  * given physical address to a virtual address and returns that virtual
@@ -47,24 +80,70 @@ uintptr_t pt_virt_to_phys(uintptr_t vaddr);
  * places an entry in it in the page directory. vaddr must be in the
  * user address space. Both vaddr and paddr must be page aligned.
  * Note that the TLB is not flushed by this function. */
-int pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, uint32_t ptflags);
+int pt_map(pagedir_t *pd, uintptr_t vaddr, paddr_t paddr, uint32_t pdflags, uint32_t ptflags);
+
+/* Returns 1 if the page at the given page aligned user address is
+ * mapped in pd, whether by a small or a large page, 0 otherwise. */
+int pt_is_mapped(pagedir_t *pd, uintptr_t vaddr);
+
+/* If the page at the given page aligned user address is mapped in pd,
+ * stores the physical address it maps and the flags of the mapping, as
+ * they would be passed to pt_map, and returns 1. Returns 0 otherwise. */
+int pt_lookup(pagedir_t *pd, uintptr_t vaddr, paddr_t *paddr, uint32_t *ptflags);
+
+/* Returns 1 if a large page could be mapped at the PT_LARGE_SIZE
+ * aligned user address vaddr in pd, that is the processor supports
+ * large pages and nothing is mapped in that region yet, 0 otherwise. */
+int pt_can_map_large(pagedir_t *pd, uintptr_t vaddr);
+
+/* Maps the PT_LARGE_SIZE bytes of physically contiguous memory at
+ * paddr in at vaddr with a single large page directory entry. Both
+ * addresses must be PT_LARGE_SIZE aligned and pt_can_map_large must be
+ * true for vaddr. pdflags should not include PD_SIZE, it is added by
+ * this function. As with pt_map the TLB is not flushed. Any later
+ * pt_map, pt_unmap or pt_unmap_range which touches only part of the
+ * region splits it back into a page table of small pages first. */
+void pt_map_large(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags);
 
 /* Unmaps the page for the given virtual page from the given page
  * directory. vaddr must be in the user address space. vaddr must
- * be page aligned. Note that the TLB is not flushed by this function. */
-void pt_unmap(pagedir_t *pd, uintptr_t vaddr);
+ * be page aligned. Note that the TLB is not flushed by this function.
+ * If pagedout is set the entry is left marked PT_PAGEDOUT. Returns the
+ * number of pages which were unmapped, which is more than one if a
+ * large page had to be dropped as a whole. */
+int pt_unmap(pagedir_t *pd, uintptr_t vaddr, int pagedout);
+
+/* Returns 1 if the page at the given page aligned user address is not
+ * mapped in pd because pt_unmap paged it out, 0 otherwise. */
+int pt_is_pagedout(pagedir_t *pd, uintptr_t vaddr);
+
+/* Counts the pages of the range [vlow, vhigh) of user addresses which
+ * are mapped in pd, and those which are marked PT_PAGEDOUT. */
+void pt_count_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh,
+                    uint32_t *nmapped, uint32_t *npagedout);
 
 /* Unmaps the given range of addresses [low, high). As with pt_unmap,
- * the addresses must be page aligned in the user address space */
+ * the addresses must be page aligned in the user address space. Page
+ * tables which are entirely covered by the range are freed. Entries
+ * marked PT_PAGEDOUT are cleared as well. Unlike
+ * pt_unmap, the TLB is flushed for the range if pd is the current
+ * page directory. */
 void pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh);
 
+/* As pt_unmap_range, but on the page directory of the given gather
+ * (see mm/tlb.h). The flush, and freeing of any page tables, is
+ * deferred until tlb_gather_finish() so that several ranges can be
+ * unmapped with a single flush. */
+void pt_unmap_range_gather(struct tlb_gather *tg, uintptr_t vlow, uintptr_t vhigh);
+
 /* Creates a new page directory which is initialized to contain
  * mappings for all kernel memory. If there is not enough memory
  * to allocate the directory NULL is returned. Note that destroying
  * a page diretory does not affect the TLB, it is assumed that the
  * page directory being destroyed is not currently in use. Destroying
  * a page directory frees all page tables for user memory referenced
- * by that page directory. */
+ * by that page directory, and keeps up to PT_PAGEDIR_CACHE destroyed
+ * directories around to be handed out by the next creations. */
 pagedir_t *pt_create_pagedir();
 void pt_destroy_pagedir(pagedir_t *pdir);
 
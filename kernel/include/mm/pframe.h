@@ -3,6 +3,7 @@
 #include "proc/sched.h"
 
 #include "mm/mmobj.h"
+#include "mm/pagetable.h"
 
 #include "util/list.h"
 #include "util/init.h"
@@ -44,8 +45,23 @@ typedef struct pframe {
         list_link_t         pf_link;     /* link on {free,allocated,pinned}_list */
         list_link_t         pf_hlink;    /* link on hash chain of resident page hash */
         list_link_t         pf_olink;    /* link on object's list of resident pages */
+
+        /* Public read: the physical address of the page frame. Pages of
+         * anonymous and shadow objects may be in high memory, in which
+         * case pf_addr is NULL and the data can only be reached through
+         * pframe_kmap. (This comes last so that the layout of the fields
+         * above, which the prebuilt libraries use, does not change.) */
+        paddr_t             pf_paddr;
 } pframe_t;
 
+/* Returns a kernel virtual address for the data of pf: pf_addr if the
+ * page is directly mapped, otherwise a temporary mapping in the given
+ * slot (PT_TMP_SLOT_KMAP0 or PT_TMP_SLOT_KMAP1) which is only valid
+ * until the next pframe_kmap into the same slot. */
+#define pframe_kmap(pf, slot) \
+        ((NULL != (pf)->pf_addr) ? (pf)->pf_addr \
+         : (void *)pt_phys_tmp_map_slot((pf)->pf_paddr, (slot)))
+
 void pframe_init(void);
 void pframe_add_range(uint32_t startpfn, uint32_t endpfn);
 void pframe_pageoutd_init(void);
@@ -55,6 +71,7 @@ void pframe_shutdown(void);
 pframe_t *pframe_get_resident(struct mmobj *o, uint32_t pagenum);
 
 int pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result);
+int pframe_get_contig(struct mmobj *o, uint32_t pagenum, uint32_t npages, uintptr_t *paddr);
 int pframe_lookup(struct mmobj *o, uint32_t pagenum, int forwrite, pframe_t **result);
 void pframe_migrate(pframe_t *pf, mmobj_t *dest);
 
@@ -64,6 +81,9 @@ void pframe_unpin(pframe_t *pf);
 int  pframe_dirty(pframe_t *pf);
 int  pframe_clean(pframe_t *pf);
 void pframe_free(pframe_t *pf);
+void pframe_discard_range(struct mmobj *o, uint32_t lopage, uint32_t npages);
+void pframe_release_all(struct mmobj *o);
+void pframe_deactivate(pframe_t *pf);
 
 void pframe_clean_all(void);
 
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "mm/pagetable.h"
+
 /* Returns the highest physical address of the range of usable
  * that start at kernel_start. The intention is that this will
  * be the largest available continuous range of physical
@@ -7,3 +9,9 @@
  * while the first megabyte of memory is identity mapped,
  * otherwise its behavior is undefined. */
 uintptr_t phys_detect_highmem();
+
+/* Hands every part of the usable physical memory above direct_end,
+ * the end of the kernel's direct map, to the high memory allocator
+ * (see mm/highmem.h). As above this should only be used during
+ * booting while the first megabyte of memory is identity mapped. */
+void phys_detect_highmem_ranges(paddr_t direct_end);
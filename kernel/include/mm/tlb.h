@@ -4,6 +4,7 @@
 #include "types.h"
 
 #include "mm/page.h"
+#include "mm/pagetable.h"
 
 /* Invalidates any entries from the TLB which contain
  * mappings for the given virtual address. */
@@ -31,3 +32,42 @@ static inline void tlb_flush_all()
         __asm__ volatile("movl %%cr3, %0" : "=r"(pdir));
         __asm__ volatile("movl %0, %%cr3" :: "r"(pdir) : "memory");
 }
+
+/* Number of distinct virtual ranges and page table pages a gather can
+ * remember before it has to flush early. */
+#define TLB_GATHER_NRANGES   8
+#define TLB_GATHER_NTABLES   16
+
+/* A tlb_gather_t batches TLB invalidation for a sequence of unmaps from
+ * one page directory. Callers clear page table entries, record the
+ * affected ranges with tlb_gather_range() and hand any page table pages
+ * they detached to tlb_gather_table(). tlb_gather_finish() then issues
+ * either one invlpg per recorded page or, if more than
+ * TLB_FLUSH_ALL_THRESHOLD pages were recorded, a single tlb_flush_all().
+ * Page table pages are only returned to the page allocator after the
+ * flush, so no stale translation can reference a reused page. If the
+ * page directory is not the one currently loaded in cr3 no flush is
+ * necessary at all, since loading it will flush the TLB. */
+typedef struct tlb_gather {
+        pagedir_t *tg_pd;
+        uint32_t   tg_npages;
+        uint32_t   tg_nranges;
+        uintptr_t  tg_start[TLB_GATHER_NRANGES];
+        uintptr_t  tg_end[TLB_GATHER_NRANGES];
+        uint32_t   tg_ntables;
+        void      *tg_tables[TLB_GATHER_NTABLES];
+} tlb_gather_t;
+
+/* Prepares tg to batch unmaps from the given page directory. */
+void tlb_gather_init(tlb_gather_t *tg, pagedir_t *pd);
+
+/* Records that the page aligned user range [vlow, vhigh) was unmapped. */
+void tlb_gather_range(tlb_gather_t *tg, uintptr_t vlow, uintptr_t vhigh);
+
+/* Takes ownership of a page table page which has already been removed
+ * from the page directory; it is freed once the TLB has been flushed. */
+void tlb_gather_table(tlb_gather_t *tg, void *pt);
+
+/* Flushes everything recorded in tg and frees the gathered page
+ * tables. tg may be reused afterwards for the same page directory. */
+void tlb_gather_finish(tlb_gather_t *tg);
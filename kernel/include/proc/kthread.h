@@ -25,6 +25,10 @@ typedef struct kthread {
         int             kt_state;       /* this thread's state */
         list_link_t     kt_qlink;       /* link on ktqueue */
         list_link_t     kt_plink;       /* link on proc thread list */
+        uint32_t        kt_faultev;     /* FAULT_EV_* of the page fault
+                                         * being handled */
+        int             kt_level;       /* feedback level, 0 is the top */
+        uint64_t        kt_ran;         /* cycles run at kt_level */
 #ifdef __MTP__
         int             kt_detached;    /* if the thread has been detached */
         ktqueue_t       kt_joinq;       /* thread waiting to join with this thread */
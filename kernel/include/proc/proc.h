@@ -7,6 +7,7 @@
 #include "mm/pagetable.h"
 
 #include "vm/vmmap.h"
+#include "vm/pagefault.h"
 
 #include "config.h"
 
@@ -26,6 +27,8 @@ typedef struct proc {
         int             p_status;        /* exit status */
         int             p_state;         /* running/sleeping/etc. */
         ktqueue_t       p_wait;          /* queue for wait(2) */
+        int             p_nice;          /* NICE_MIN to NICE_MAX, higher
+                                          * runs later; see nice(2) */
 
         pagedir_t      *p_pagedir;
 
@@ -42,6 +45,19 @@ typedef struct proc {
         struct vmmap   *p_vmmap;         /* list of areas mapped into
                                           * process' user address
                                           * space */
+        pagedir_t      *p_vfork_pagedir; /* our own pagedir while we run in
+                                          * our parent's address space after
+                                          * vfork(2), NULL otherwise */
+        uint32_t        p_nfaults;       /* page faults taken */
+        uint32_t        p_nfaultaround;  /* pages mapped ahead of a fault */
+        fault_stats_t   p_faultstats;    /* how faults were resolved */
+        uint32_t        p_nresident;     /* pages mapped in p_pagedir */
+        uint32_t        p_nswapped;      /* pages unmapped to be paged out
+                                          * and not faulted back in since */
+        uint32_t        p_rsslimit;      /* most pages to keep mapped, 0 if
+                                          * unlimited; see rsslimit(2) */
+        uint32_t        p_rsshand;       /* vfn the next trim down to the
+                                          * limit starts at */
 } proc_t;
 
 /* Process states. */
@@ -128,6 +144,23 @@ pid_t do_waitpid(pid_t pid, int options, int *status);
  */
 int do_fork(struct regs *regs);
 
+/**
+ * This function implements the vfork(2) system call. The child runs
+ * in the parent's address space, and the parent does not return
+ * until the child has called vfork_release().
+ *
+ * @param regs the register state at the time of the system call
+ */
+int do_vfork(struct regs *regs);
+
+/**
+ * Gives the current process's parent back its address space if the
+ * current process was created by vfork(2) and has not yet exec'd or
+ * exited, and wakes the parent up. Afterwards the current process
+ * has its own, empty, address space.
+ */
+void vfork_release(void);
+
 /**
  * Provides detailed debug information about a given process.
  *
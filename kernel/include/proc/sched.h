@@ -8,6 +8,18 @@ typedef struct ktqueue {
         int             tq_size;
 } ktqueue_t;
 
+/*
+ * The run queue is SCHED_NPRIO queues, 0 runs first. A thread is queued
+ * at the priority its process's nice value starts at plus its feedback
+ * level, which goes down (the number goes up) as the thread uses the
+ * CPU and back up when it is woken from a sleep. See sched.c.
+ */
+#define SCHED_NPRIO     32
+#define SCHED_NLEVELS   8
+
+#define NICE_MIN        -20
+#define NICE_MAX        19
+
 /**
  * Switches execution between kernel threads.
  */
@@ -20,6 +32,20 @@ void sched_switch(void);
  */
 void sched_make_runnable(struct kthread *kt);
 
+/**
+ * Called on every clock tick: charges the current thread for the CPU
+ * and, once its quantum is up and another thread should run, asks for
+ * it to be preempted at the next preemption point.
+ */
+void sched_tick(void);
+
+/**
+ * A preemption point: if the current thread has been asked to give way
+ * (see sched_tick()), puts it back on the run queue and switches to
+ * another thread. Only call this where the thread may sleep.
+ */
+void sched_preempt_point(void);
+
 /**
  * Initializes a queue.
  *
@@ -52,6 +78,27 @@ void sched_sleep_on(ktqueue_t *q);
  */
 int sched_cancellable_sleep_on(ktqueue_t *q);
 
+/**
+ * Like sched_sleep_on(), but gives up waiting after the given number
+ * of clock ticks (see ktimer_add()).
+ *
+ * @param q the queue to sleep on
+ * @param ticks clock ticks to wait for at most
+ * @return -ETIMEDOUT if the time ran out and 0 otherwise
+ */
+int sched_sleep_on_timeout(ktqueue_t *q, uint32_t ticks);
+
+/**
+ * Like sched_cancellable_sleep_on(), but gives up waiting after the
+ * given number of clock ticks (see ktimer_add()).
+ *
+ * @param q the queue to sleep on
+ * @param ticks clock ticks to wait for at most
+ * @return -EINTR if the thread was cancelled, -ETIMEDOUT if the time
+ * ran out and 0 otherwise
+ */
+int sched_cancellable_sleep_on_timeout(ktqueue_t *q, uint32_t ticks);
+
 /**
  * Wakes a single thread from sleep if there are any waiting on the
  * queue.
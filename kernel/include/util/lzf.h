@@ -0,0 +1,12 @@
+#pragma once
+
+#include "types.h"
+
+/* Compresses inlen bytes from in into at most outlen bytes at out.
+ * Returns the compressed size, or 0 if it would not fit. */
+size_t lzf_compress(const void *in, size_t inlen, void *out, size_t outlen);
+
+/* Decompresses inlen bytes from in, produced by lzf_compress, into at
+ * most outlen bytes at out. Returns the decompressed size, or 0 if the
+ * input is corrupt or does not fit. */
+size_t lzf_decompress(const void *in, size_t inlen, void *out, size_t outlen);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "types.h"
+#include "config.h"
+
+/*
+ * The clock interrupt, every TICK_MSECS milliseconds, drives
+ * preemption (see sched_tick()) and the timers (see util/timer.h).
+ * While no thread is runnable the clock stops ticking until the next
+ * timer is due.
+ */
+
+#define TIME_HZ                 (1000 / TICK_MSECS)
+
+/* Clock ticks needed for at least the given time to pass */
+#define TIME_MSECS_TO_TICKS(ms) (((ms) + TICK_MSECS - 1) / TICK_MSECS)
+
+/* Returns the number of clock ticks since the clock was started */
+uint32_t time_ticks(void);
+
+/**
+ * Called with interrupts masked before the CPU waits for an interrupt
+ * because no thread is runnable. Stops the periodic tick and asks for
+ * a single interrupt when the next timer is due instead.
+ */
+void time_tickless_enter(void);
+
+/**
+ * Called with interrupts masked once the wait is over. Accounts for
+ * the ticks which were skipped and starts the periodic tick again.
+ */
+void time_tickless_exit(void);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "types.h"
+
+#include "util/list.h"
+
+/*
+ * Kernel timers. A timer calls its function, in interrupt context, once
+ * the clock has ticked the number of times it was added for. The
+ * function must not sleep; it may make threads runnable or add timers.
+ */
+typedef struct ktimer {
+        list_link_t     tm_link;        /* link on a wheel slot */
+        uint32_t        tm_expires;     /* tick the timer goes off at */
+        void          (*tm_func)(void *arg);
+        void           *tm_arg;
+} ktimer_t;
+
+/* The furthest a timer can be set, 2^24 - 1 ticks */
+#define KTIMER_MAX      ((1U << 24) - 1)
+
+/* What ktimer_next() returns when no timer is pending */
+#define KTIMER_NONE     ((uint32_t)-1)
+
+/**
+ * Initializes a timer which is not pending.
+ *
+ * @param t the timer
+ * @param func the function to call when it goes off
+ * @param arg the argument to func
+ */
+void ktimer_init(ktimer_t *t, void (*func)(void *arg), void *arg);
+
+/**
+ * Makes the timer go off after the given number of clock ticks. The
+ * tick under way counts as one, so it goes off between ticks - 1 and
+ * ticks tick lengths from now. Timers are at most KTIMER_MAX ticks
+ * away, longer ones go off then. The timer must not be pending.
+ *
+ * @param t the timer
+ * @param ticks clock ticks from now
+ */
+void ktimer_add(ktimer_t *t, uint32_t ticks);
+
+/**
+ * Stops a timer if it is pending.
+ *
+ * @param t the timer
+ * @return 1 if the timer was pending and 0 if it had gone off or was
+ * never added
+ */
+int ktimer_del(ktimer_t *t);
+
+/**
+ * Runs the timers which go off up to and including the given tick.
+ * Called by the clock.
+ *
+ * @param now the current tick
+ */
+void ktimer_run(uint32_t now);
+
+/**
+ * Returns how many ticks after the next one the timers can be left
+ * alone for, 0 if ktimer_run() has work to do on the next tick, or
+ * KTIMER_NONE if no timer is pending.
+ */
+uint32_t ktimer_next(void);
@@ -1,9 +1,21 @@
 #pragma once
 
+#include "mm/pagetable.h"
+
 struct mmobj;
+struct list;
 
 void anon_init();
 struct mmobj *anon_create(void);
 
+/* Returns 1 if o is an anonymous object, 0 otherwise */
+int mmobj_is_anon(struct mmobj *o);
+
+/* Returns the list of o's pages which have a copy in swap */
+struct list *anon_swapped(struct mmobj *o);
+
+/* Returns the physical address of the shared, read-only page of zeroes */
+paddr_t anon_zero_page(void);
+
 extern int anon_count;
 
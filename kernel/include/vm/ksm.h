@@ -0,0 +1,32 @@
+#pragma once
+
+#include "types.h"
+#include "util/list.h"
+
+struct pframe;
+
+/*
+ * A page which the private pages of several objects with the same
+ * contents have been merged into. Each of those pages is replaced by a
+ * swap entry referring to it (see vm/swap.c), so it is seen by reads
+ * until the first write makes a private copy again. The frame belongs
+ * to an anonymous object of its own and stays pinned while merged.
+ */
+typedef struct ksm_page {
+        struct pframe  *kp_pf;
+        uint32_t        kp_hash;        /* of the contents */
+        int             kp_refcount;    /* swap entries referring to it */
+        list_link_t     kp_link;        /* on the ksm_stable chain */
+} ksm_page_t;
+
+/* Drops a swap entry's reference, freeing the page with the last one */
+void ksm_page_put(ksm_page_t *kp);
+
+/* Asks ksmd to look for pages to merge */
+void ksmd_wakeup(void);
+
+/* Wakes ksmd and waits until it has made a whole pass started after
+ * the call and gone back to sleep */
+void ksmd_sync(void);
+
+size_t ksm_info(const void *arg, char *buf, size_t osize);
@@ -8,4 +8,35 @@
 #define FAULT_RESERVED 0x08
 #define FAULT_EXEC     0x10
 
-void handle_pagefault(uintptr_t vaddr, uint32_t cause);
+/* What it took to resolve the fault a thread is handling, noted in
+ * kt_faultev by the paths which do the work */
+#define FAULT_EV_ACTIVE 0x01 /* a fault is being handled */
+#define FAULT_EV_MAJOR  0x02 /* a page was read from disk */
+#define FAULT_EV_COW    0x04 /* a page was copied for a private writer */
+#define FAULT_EV_ZERO   0x08 /* a page was zero-filled */
+
+#define FAULT_HIST_BUCKETS 32
+
+typedef struct fault_stats {
+        uint32_t        fs_minor;       /* faults on resident pages */
+        uint32_t        fs_major;       /* faults which waited on disk */
+        uint32_t        fs_cow;         /* faults which copied a page */
+        uint32_t        fs_zero;        /* faults which zero-filled a page */
+        uint32_t        fs_hist[FAULT_HIST_BUCKETS]; /* faults taking
+                                                      * [2^i, 2^(i+1))
+                                                      * cycles */
+} fault_stats_t;
+
+struct vmarea;
+
+int handle_pagefault(uintptr_t vaddr, uint32_t cause);
+int pagefault_populate(struct vmarea *vma);
+
+/*
+ * Notes that the fault the current thread is handling, if any, had to
+ * do ev (one of FAULT_EV_*).
+ */
+void pagefault_note(uint32_t ev);
+
+void pagefault_stats_print(const fault_stats_t *fs, char **buf, size_t *size);
+size_t pagefault_info(const void *arg, char *buf, size_t osize);
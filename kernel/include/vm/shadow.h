@@ -1,9 +1,21 @@
 #pragma once
 
 struct mmobj;
+struct list;
 
 void shadow_init();
 struct mmobj *shadow_create(void);
+struct mmobj *shadow_create_over(struct mmobj *below);
+
+/* Collapses up to max shadow objects which were left with a single
+ * child, returns the number still waiting */
+int shadow_collapse_queued(int max);
+
+/* Returns 1 if o is a shadow object, 0 otherwise */
+int mmobj_is_shadow(struct mmobj *o);
+
+/* Returns the list of o's pages which have a copy in swap */
+struct list *shadow_swapped(struct mmobj *o);
 
 extern int shadow_count;
 
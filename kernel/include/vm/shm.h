@@ -0,0 +1,23 @@
+#pragma once
+
+#include "types.h"
+
+struct mmobj;
+
+/* Returns the id of the shared memory segment called name, creating it
+ * with a size of len bytes if it does not exist and O_CREAT is in
+ * oflag. The id is passed as the fd of mmap(2) with MAP_SHM, and stays
+ * valid until the segment is unlinked. Returns -ENOENT if there is no
+ * such segment, -ENFILE if there are too many and -errno otherwise. */
+int do_shm_open(const char *name, size_t len, int oflag);
+
+/* Removes the name of a segment. Its memory lives on until the last
+ * mapping of it goes away. */
+int do_shm_unlink(const char *name);
+
+/* Returns, with a reference, the object of segment id if len bytes at
+ * off are in it. Returns -EBADF for an unknown id and -EINVAL if the
+ * range runs past the end of the segment. */
+int shm_get(int id, off_t off, size_t len, struct mmobj **ret);
+
+size_t shm_info(const void *arg, char *buf, size_t osize);
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "types.h"
+
+struct mmobj;
+struct pframe;
+struct ksm_page;
+
+void swap_init(void);
+
+/* Returns 1 if there is a swap device or compressed pool to page
+ * anonymous memory out to, 0 otherwise. Without either anonymous and
+ * shadow pages are pinned as soon as they are filled. */
+int swap_enabled(void);
+
+/* Returns 1 if page pagenum of o has a copy in swap, on disk or in
+ * the pool, 0 otherwise */
+int swap_has(struct mmobj *o, uint32_t pagenum);
+
+/* Returns the page ksmd merged page pagenum of o into, if it was, and
+ * NULL otherwise. The page may be mapped read-only in its place. */
+struct pframe *swap_merged_page(struct mmobj *o, uint32_t pagenum);
+
+/* Replaces the copy in swap of page pagenum of o, if any, with the
+ * reference to kp taken by the caller. Returns 0 on success and
+ * -ENOMEM if there is no memory for the entry. */
+int swap_merge(struct mmobj *o, uint32_t pagenum, struct ksm_page *kp);
+
+/* Compresses pf into the pool if it has room and the page compresses
+ * well, and otherwise writes it out to its object's slot for it on
+ * disk, allocating one if it has none. Returns 0 on success, -ENOSPC
+ * if both are full or missing and -errno on I/O errors. */
+int swap_out(struct pframe *pf);
+
+/* Reads the copy in swap of pf's page into pf. Returns 1 if there
+ * is one, 0 if there is none and -errno on I/O errors. A merged page
+ * is copied and pf's mappings, which may be of the merged page, are
+ * removed. A copy on disk
+ * is kept, so that the page can be dropped again without writing it
+ * unless it is dirtied. A copy in the pool is freed to make room and
+ * pf is left dirty. */
+int swap_in(struct pframe *pf);
+
+/* Frees the copies in swap of the pages [lopage, lopage + npages) of
+ * o, which must be an anonymous or shadow object */
+void swap_discard(struct mmobj *o, uint32_t lopage, uint32_t npages);
+
+/* Hands the copies in swap of src's pages over to dest, for folding
+ * a shadow object into the one above it. Copies of pages dest has a
+ * version of, resident or in swap, are freed instead. */
+void swap_migrate(struct mmobj *src, struct mmobj *dest);
+
+/* Number of slots, and of slots in use, on the swap device */
+extern uint32_t swap_nslots;
+extern uint32_t swap_nused;
+
+/* Prints usage of the swap device and pool, the pool's compression
+ * ratio and how long page-ins from each take */
+size_t swap_info(const void *arg, char *buf, size_t osize);
@@ -11,9 +11,17 @@ struct mmobj;
 struct proc;
 struct vnode;
 
+/* The areas of a vmmap are kept both on vmm_list, sorted by address,
+ * and in an AVL tree keyed on vma_start. Each node of the tree also
+ * records the largest gap of unmapped pages found just below any area
+ * in its subtree, so that free ranges can be found without scanning. */
 typedef struct vmmap {
-        list_t       vmm_list;
-        struct proc *vmm_proc;
+        list_t         vmm_list;     /* areas sorted by address */
+        struct vmarea *vmm_root;     /* root of the tree of areas */
+        struct vmarea *vmm_cache;    /* area found by the last vmmap_lookup */
+        struct proc   *vmm_proc;
+        list_link_t    vmm_reaplink; /* on vmreapd's list once its
+                                      * process has exited */
 } vmmap_t;
 
 /* make sure you understand why mapping boundaries are in terms of frame
@@ -25,6 +33,11 @@ typedef struct vmarea {
 
         int            vma_prot;     /* permissions on mapping */
         int            vma_flags;    /* either MAP_SHARED or MAP_PRIVATE */
+        int            vma_advice;   /* MADV_NORMAL, MADV_RANDOM or MADV_SEQUENTIAL */
+
+        uint32_t       vma_nresident; /* pages mapped in the process' page table */
+        uint32_t       vma_nswapped;  /* pages unmapped to be paged out and not
+                                       * faulted back in since */
 
         struct vmmap  *vma_vmmap;    /* address space that this area belongs to */
         struct mmobj  *vma_obj;      /* the vm object to read pages from */
@@ -32,18 +45,31 @@ typedef struct vmarea {
         list_link_t    vma_olink;    /* link on the list of all vm_areas
                                       * having the same vm_object at the
                                       * bottom of their chain */
+
+        struct vmarea *vma_left;     /* tree links, see vmmap_t */
+        struct vmarea *vma_right;
+        struct vmarea *vma_parent;
+        int            vma_height;
+        uint32_t       vma_maxgap;   /* largest gap below any area in this subtree */
 } vmarea_t;
 
 void vmmap_init(void);
 
+void vmarea_account(vmarea_t *vma, int nresident, int nswapped);
+void vmarea_recount(vmarea_t *vma);
+
 vmmap_t *vmmap_create(void);
 void vmmap_destroy(vmmap_t *map);
 
 vmarea_t *vmmap_lookup(vmmap_t *map, uint32_t vfn);
 int vmmap_map(vmmap_t *map, struct vnode *file, uint32_t lopage, uint32_t npages, int prot, int flags, off_t off, int dir, vmarea_t **new);
+int vmmap_map_obj(vmmap_t *map, struct mmobj *obj, uint32_t lopage, uint32_t npages, int prot, int flags, off_t off, int dir, vmarea_t **new);
 int vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages);
+int vmmap_remap(vmmap_t *map, uint32_t lopage, uint32_t oldnpages, uint32_t newnpages,
+                int maymove, uint32_t *newlopage);
 int vmmap_is_range_empty(vmmap_t *map, uint32_t startvfn, uint32_t npages);
 int vmmap_find_range(vmmap_t *map, uint32_t npages, int dir);
+int vmmap_set_advice(vmmap_t *map, uint32_t lopage, uint32_t npages, int advice);
 
 int vmmap_read(vmmap_t *map, const void *vaddr, void *buf, size_t count);
 int vmmap_write(vmmap_t *map, void *vaddr, const void *buf, size_t count);
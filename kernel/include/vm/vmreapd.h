@@ -0,0 +1,18 @@
+#pragma once
+
+#include "types.h"
+
+struct vmmap;
+
+/*
+ * Hands the address space of an exited process to vmreapd, which
+ * destroys it in the background. The map must not belong to a process
+ * any more.
+ */
+void vmreapd_defer(struct vmmap *map);
+
+/* Returns the number of address spaces which are not destroyed yet */
+uint32_t vmreapd_pending(void);
+
+/* Waits until every address space handed over so far is destroyed */
+void vmreapd_drain(void);
@@ -0,0 +1,23 @@
+#include "types.h"
+
+#include "main/extable.h"
+
+struct extable_entry {
+        uintptr_t ex_insn;
+        uintptr_t ex_fixup;
+};
+
+extern struct extable_entry kernel_start_extable[];
+extern struct extable_entry kernel_end_extable[];
+
+uintptr_t
+extable_fixup(uintptr_t eip)
+{
+        struct extable_entry *ex;
+        for (ex = kernel_start_extable; ex < kernel_end_extable; ++ex) {
+                if (ex->ex_insn == eip) {
+                        return ex->ex_fixup;
+                }
+        }
+        return 0;
+}
@@ -8,6 +8,8 @@
 #include "main/interrupt.h"
 #include "main/gdt.h"
 
+#include "proc/sched.h"
+
 #define MAX_INTERRUPTS          256
 
 #define INTR_SPURIOUS      0xef
@@ -384,6 +386,13 @@ static __attribute__((used)) void __intr_handler(regs_t regs)
         }
 
         _intr_regs = NULL;
+
+#ifdef __UPREEMPT__
+        /* A user thread gives way here on its way back to userland */
+        if (GDT_USER_TEXT == (regs.r_cs & ~0x3)) {
+                sched_preempt_point();
+        }
+#endif
 }
 
 static void __intr_divide_by_zero_handler(regs_t *regs)
@@ -396,11 +405,6 @@ static void __intr_gpf_handler(regs_t *regs)
         panic("\nGeneral Protection Fault:\nError: 0x%.8x\n", regs->r_err);
 }
 
-static void __intr_timer_handler(regs_t *regs)
-{
-        panic("\nTimer Interrupt:\nError: 0x%.8x\n", regs->r_err);
-}
-
 static void __intr_inval_opcode_handler(regs_t *regs)
 {
         panic("\nInvalid opcode error at eip=0x%08x\n", regs->r_eip);
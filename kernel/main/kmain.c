@@ -16,6 +16,11 @@
 #include "vm/vmmap.h"
 #include "vm/shadow.h"
 #include "vm/anon.h"
+#include "vm/swap.h"
+#include "vm/pagefault.h"
+#include "vm/vmreapd.h"
+#include "vm/ksm.h"
+#include "vm/shm.h"
 
 #include "main/acpi.h"
 #include "main/apic.h"
@@ -41,6 +46,7 @@
 #include "fs/stat.h"
 
 #include "test/kshell/kshell.h"
+#include "test/kshell/io.h"
 
 GDB_DEFINE_HOOK(boot)
 GDB_DEFINE_HOOK(initialized)
@@ -227,6 +233,11 @@ idleproc_run(int arg1, void *arg2)
         child = do_waitpid(-1, 0, &status);
         KASSERT(PID_INIT == child);
 
+#ifdef __VM__
+        /* Exited processes may still hold vnodes through their areas */
+        vmreapd_drain();
+#endif
+
 #ifdef __MTP__
         kthread_reapd_shutdown();
 #endif
@@ -350,6 +361,60 @@ int init_shell(kshell_t *kshell, int argc, char **argv)
 	return 0;
 }
 
+#ifdef __VM__
+int swapinfo(kshell_t *kshell, int argc, char **argv)
+{
+	char buf[512];
+
+	swap_info(NULL, buf, sizeof(buf));
+	kprintf(kshell, "%s", buf);
+	return 0;
+}
+
+/*
+ * faultinfo shows how page faults were resolved since boot, then the
+ * counts of each process so the one causing a fault storm stands out.
+ */
+int faultinfo(kshell_t *kshell, int argc, char **argv)
+{
+	char buf[1024];
+	proc_t *p;
+
+	pagefault_info(NULL, buf, sizeof(buf));
+	kprintf(kshell, "%s", buf);
+	kprintf(kshell, "\n%5s %-16s %8s %8s %8s %8s\n",
+	        "PID", "NAME", "MINOR", "MAJOR", "COW", "ZERO");
+	list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
+		kprintf(kshell, "%5d %-16s %8u %8u %8u %8u\n", p->p_pid, p->p_comm,
+		        p->p_faultstats.fs_minor, p->p_faultstats.fs_major,
+		        p->p_faultstats.fs_cow, p->p_faultstats.fs_zero);
+	} list_iterate_end();
+	return 0;
+}
+
+int shminfo(kshell_t *kshell, int argc, char **argv)
+{
+	char buf[1024];
+
+	shm_info(NULL, buf, sizeof(buf));
+	kprintf(kshell, "%s", buf);
+	return 0;
+}
+
+/*
+ * ksminfo has ksmd go through memory and shows what it has merged.
+ */
+int ksminfo(kshell_t *kshell, int argc, char **argv)
+{
+	char buf[512];
+
+	ksmd_sync();
+	ksm_info(NULL, buf, sizeof(buf));
+	kprintf(kshell, "%s", buf);
+	return 0;
+}
+#endif
+
 int extra_vfs_test(kshell_t* kshell, int arg1, char **argv)
 {
     char *before="file1";
@@ -404,6 +469,10 @@ initproc_run(int arg1, void *arg2)
 	kshell_add_command("user_shell", init_shell, "get the user space shell");
 	kshell_add_command("uname", u_name, "Executes uname test");
 	kshell_add_command("segfault", segment_fault, "Test segment fault");
+	kshell_add_command("swapinfo", swapinfo, "Show swap and compressed pool statistics");
+	kshell_add_command("faultinfo", faultinfo, "Show page fault counts and latencies");
+	kshell_add_command("ksminfo", ksminfo, "Merge identical pages and show the savings");
+	kshell_add_command("shminfo", shminfo, "Show shared memory segments");
 #endif
 	kshell_t *kshell = kshell_create(0);
 	if (NULL == kshell) panic("init: Couldn't create kernel shell\n");
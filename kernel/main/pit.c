@@ -1,6 +1,8 @@
 #include "main/io.h"
 #include "main/interrupt.h"
+#include "main/pit.h"
 #include "util/delay.h"
+#include "util/debug.h"
 
 /* IRQ */
 #define PIT_IRQ 0
@@ -11,20 +13,53 @@
 #define PIT_DATA2 0x42
 #define PIT_CMD   0x43
 
-#define CLOCK_TICK_RATE 1193182
-#undef HZ
-#define HZ 1000
+/* Commands for channel 0 */
+#define PIT_CMD_PERIODIC  0x34 /* lobyte/hibyte, mode 2 (rate generator) */
+#define PIT_CMD_ONESHOT   0x30 /* lobyte/hibyte, mode 0 (interrupt on terminal count) */
+#define PIT_CMD_READBACK  0xc2 /* latch count and status */
 
-#define LATCH (CLOCK_TICK_RATE / HZ)
+#define PIT_STATUS_OUT    0x80 /* output pin, goes high at terminal count in mode 0 */
 
-void pit_starttimer(uint8_t intr)
-{
-        intr_map(PIT_IRQ, intr);
+#define LATCH(hz) (PIT_CLOCK_HZ / (hz))
 
+static void pit_load(uint8_t cmd, uint16_t count)
+{
         /* Shamelessly cribbed from "Understanding the Linux Kernel", pp 230 */
-        outb(0x34, PIT_CMD);
+        outb(cmd, PIT_CMD);
         udelay(10);
-        outb(LATCH & 0xff, PIT_DATA0);
+        outb(count & 0xff, PIT_DATA0);
         udelay(10);
-        outb(LATCH >> 8, PIT_DATA0);
+        outb(count >> 8, PIT_DATA0);
+}
+
+void pit_starttimer(uint8_t intr, unsigned int hz)
+{
+        intr_map(PIT_IRQ, intr);
+        pit_periodic(hz);
+}
+
+void pit_periodic(unsigned int hz)
+{
+        KASSERT(LATCH(hz) > 0 && LATCH(hz) <= 0xffff);
+        pit_load(PIT_CMD_PERIODIC, LATCH(hz));
+}
+
+void pit_oneshot(uint16_t count)
+{
+        KASSERT(0 < count);
+        pit_load(PIT_CMD_ONESHOT, count);
+}
+
+uint16_t pit_remaining(void)
+{
+        uint8_t status, lo, hi;
+
+        outb(PIT_CMD_READBACK, PIT_CMD);
+        status = inb(PIT_DATA0);
+        lo = inb(PIT_DATA0);
+        hi = inb(PIT_DATA0);
+        if (status & PIT_STATUS_OUT) {
+                return 0;
+        }
+        return ((uint16_t)hi << 8) | lo;
 }
@@ -0,0 +1,95 @@
+#include "types.h"
+#include "kernel.h"
+
+#include "mm/mm.h"
+#include "mm/page.h"
+#include "mm/pagetable.h"
+#include "mm/highmem.h"
+
+#include "util/debug.h"
+
+/*
+ * High memory is handed out from the few ranges found at boot, each
+ * one front to back, so booting does not have to touch every page.
+ * Pages which are given back go on a free list threaded through the
+ * pages themselves: the first bytes of each free page hold the
+ * physical address of the next one. Neither needs any kernel memory
+ * beyond the range table.
+ */
+
+#define HIGHMEM_NRANGES 8
+
+static struct {
+        paddr_t hr_next;
+        paddr_t hr_end;
+} highmem_ranges[HIGHMEM_NRANGES];
+static uint32_t highmem_nranges = 0;
+
+static paddr_t highmem_freelist = 0;
+static uint32_t highmem_nfree = 0;
+
+void
+highmem_add_range(paddr_t start, paddr_t end)
+{
+        start = (start + PAGE_SIZE - 1) & ~(paddr_t)(PAGE_SIZE - 1);
+        end &= ~(paddr_t)(PAGE_SIZE - 1);
+        if (start >= end) {
+                return;
+        }
+
+        uint32_t npages = (uint32_t)((end - start) >> PAGE_SHIFT);
+        if (HIGHMEM_NRANGES == highmem_nranges) {
+                dbgq(DBG_MM, "Too many high memory ranges, dropping %u pages\n", npages);
+                return;
+        }
+
+        highmem_ranges[highmem_nranges].hr_next = start;
+        highmem_ranges[highmem_nranges].hr_end = end;
+        ++highmem_nranges;
+        highmem_nfree += npages;
+        dbgq(DBG_MM, "High memory: page frames 0x%08x-0x%08x\n",
+             (uint32_t)(start >> PAGE_SHIFT), (uint32_t)(end >> PAGE_SHIFT));
+}
+
+paddr_t
+highmem_alloc(void)
+{
+        paddr_t paddr;
+
+        if (0 != highmem_freelist) {
+                paddr = highmem_freelist;
+                highmem_freelist = *(paddr_t *)pt_phys_tmp_map(paddr);
+        } else {
+                uint32_t i;
+                for (i = 0; i < highmem_nranges; ++i) {
+                        if (highmem_ranges[i].hr_next < highmem_ranges[i].hr_end) {
+                                break;
+                        }
+                }
+                if (i == highmem_nranges) {
+                        return 0;
+                }
+                paddr = highmem_ranges[i].hr_next;
+                highmem_ranges[i].hr_next += PAGE_SIZE;
+        }
+
+        KASSERT(0 < highmem_nfree);
+        --highmem_nfree;
+        return paddr;
+}
+
+void
+highmem_free(paddr_t paddr)
+{
+        KASSERT(0 != paddr && PAGE_ALIGNED(paddr));
+
+        *(paddr_t *)pt_phys_tmp_map(paddr) = highmem_freelist;
+        highmem_freelist = paddr;
+        ++highmem_nfree;
+}
+
+uint32_t
+highmem_free_count(void)
+{
+        return highmem_nfree;
+}
@@ -54,9 +54,9 @@ _pagegroup_create(uintptr_t start, uintptr_t end)
          * are being used as bitmaps */
         int order;
         for (order = 1; order < PAGE_NSIZES; ++order) {
-                uintptr_t count = npages >> order;
-                count = ((count - 1) & ~((uintptr_t)0x7)) + 8;
-                count = count >> 3;
+                /* always at least one byte, even if the group has
+                 * no complete block of this order */
+                uintptr_t count = ((npages >> order) >> 3) + 1;
                 end -= count;
                 group->pg_map[order] = (void *)end;
                 memset(group->pg_map[order], 0, count);
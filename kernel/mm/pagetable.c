@@ -6,6 +6,8 @@
 #include "globals.h"
 
 #include "main/interrupt.h"
+#include "main/cpuid.h"
+#include "main/extable.h"
 
 #include "mm/mm.h"
 #include "mm/page.h"
@@ -22,14 +24,49 @@
 
 #include "boot/config.h"
 
-#define PT_ENTRY_COUNT    (PAGE_SIZE / sizeof (uint32_t))
+#define PT_ENTRY_COUNT    (PAGE_SIZE / sizeof (pte_t))
 #define PT_VADDR_SIZE     (PAGE_SIZE * PT_ENTRY_COUNT)
 
+/* With PAE the top level of the page table is a 4 entry page directory
+ * pointer table, each entry pointing at one page of page directory
+ * entries. Those 4 pages are kept contiguous in pd_physical so that the
+ * rest of this file can treat them as a single flat page directory. */
+#ifdef __PAE__
+#define PDPT_ENTRY_COUNT  4
+#define PD_ENTRY_COUNT    (PDPT_ENTRY_COUNT * PT_ENTRY_COUNT)
+#define CR4_PAE           0x020
+#else
+#define PD_ENTRY_COUNT    PT_ENTRY_COUNT
+#endif
+
+/* Entries below the kernel, which are the only ones which differ between
+ * page directories. The kernel's entries are set up once by pt_init and
+ * kept in pt_kernel_pdes and pt_kernel_virtual. Without PAE the processor
+ * needs them in every page directory, so they are copied in when one is
+ * created. With PAE they are exactly the last page of entries, which every
+ * page directory pointer table simply points at, so a pagedir_t holds only
+ * the entries for user memory. */
+#define PD_USER_COUNT     (USER_MEM_HIGH / PT_VADDR_SIZE)
+#define PD_KERNEL_COUNT   (PD_ENTRY_COUNT - PD_USER_COUNT)
+
 struct pagedir {
-        pde_t      pd_physical[PT_ENTRY_COUNT];
-        uintptr_t *pd_virtual[PT_ENTRY_COUNT];
+#ifdef __PAE__
+        pde_t      pd_physical[PD_USER_COUNT];
+#else
+        pde_t      pd_physical[PD_ENTRY_COUNT];
+#endif
+        pte_t     *pd_virtual[PD_USER_COUNT];
+#ifdef __PAE__
+        uint64_t   pd_pdpt[PDPT_ENTRY_COUNT];
+#endif
+        /* bit i is set if entry i is present, so that destroying the
+         * page directory only looks at the entries in use */
+        uint32_t   pd_populated[PD_USER_COUNT / 32];
+        pagedir_t *pd_cachenext;        /* on pt_pagedir_cache */
 };
 
+#define PAGEDIR_NPAGES    ((sizeof(pagedir_t) + PAGE_SIZE - 1) / PAGE_SIZE)
+
 /* for a given virtual memory address these macros will
  * calculate the index into the page directory and page
  * tables for that memory location as well as the offset
@@ -43,22 +80,75 @@ struct pagedir {
 
 /* the virtual address of the page directory in cr3 */
 static pagedir_t *current_pagedir = NULL;
-static pagedir_t *template_pagedir = NULL;
 
-static uint32_t phys_map_count = 1;
+static pde_t *pt_kernel_pdes;
+static pte_t *pt_kernel_virtual[PD_KERNEL_COUNT];
+
+/* Destroyed page directories, whose user entries are all clear and which
+ * only need to be handed out again */
+static pagedir_t *pt_pagedir_cache = NULL;
+static uint32_t pt_pagedir_ncached = 0;
+
+static uint32_t phys_map_count = PT_TMP_NSLOTS;
 static pte_t *final_page;
 
+/* set once the processor has been switched into PSE (or PAE) mode,
+ * which allows large pages to be mapped directly from the page
+ * directory */
+static int pt_pse_enabled = 0;
+
+#define CR4_PSE           0x010
+#define CR0_WP            0x00010000
+
+/* Sets entry index of pd, which may be one of the kernel's, along with
+ * the virtual address of the page table it points at, if any */
+static void
+_pt_set_pde(pagedir_t *pd, uint32_t index, pde_t pde, pte_t *pt)
+{
+        if (PD_USER_COUNT <= index) {
+                pt_kernel_pdes[index - PD_USER_COUNT] = pde;
+                pt_kernel_virtual[index - PD_USER_COUNT] = pt;
+                return;
+        }
+        pd->pd_physical[index] = pde;
+        pd->pd_virtual[index] = pt;
+        if (PT_PRESENT & pde) {
+                pd->pd_populated[index / 32] |= 1U << (index % 32);
+        } else {
+                pd->pd_populated[index / 32] &= ~(1U << (index % 32));
+        }
+}
+
+static pde_t
+_pt_get_pde(const pagedir_t *pd, uint32_t index)
+{
+        return (PD_USER_COUNT <= index) ? pt_kernel_pdes[index - PD_USER_COUNT] : pd->pd_physical[index];
+}
+
+static pte_t *
+_pt_get_pt(const pagedir_t *pd, uint32_t index)
+{
+        return (PD_USER_COUNT <= index) ? pt_kernel_virtual[index - PD_USER_COUNT] : pd->pd_virtual[index];
+}
+
 uintptr_t
-pt_phys_tmp_map(uintptr_t paddr)
+pt_phys_tmp_map_slot(paddr_t paddr, uint32_t slot)
 {
         KASSERT(PAGE_ALIGNED(paddr));
-        final_page[PT_ENTRY_COUNT - 1] = paddr | PT_PRESENT | PT_WRITE;
+        KASSERT(PT_TMP_NSLOTS > slot);
+        final_page[PT_ENTRY_COUNT - 1 - slot] = paddr | PT_PRESENT | PT_WRITE;
 
-        uintptr_t vaddr = UPTR_MAX - PAGE_SIZE + 1;
+        uintptr_t vaddr = UPTR_MAX - PAGE_SIZE * (slot + 1) + 1;
         tlb_flush(vaddr);
         return vaddr;
 }
 
+uintptr_t
+pt_phys_tmp_map(paddr_t paddr)
+{
+        return pt_phys_tmp_map_slot(paddr, 0);
+}
+
 uintptr_t
 pt_phys_perm_map(uintptr_t paddr, uint32_t count)
 {
@@ -85,15 +175,24 @@ pt_virt_to_phys(uintptr_t vaddr)
         uint32_t entry = vaddr_to_ptindex(vaddr);
         uint32_t offset = vaddr_to_offset(vaddr);
 
-        pte_t *pagetable = (pte_t *)pt_phys_tmp_map(current_pagedir->pd_physical[table] & PAGE_MASK);
-        uintptr_t page = pagetable[entry] & PAGE_MASK;
+        pde_t pde = _pt_get_pde(current_pagedir, table);
+        if (PD_SIZE & pde) {
+                return (pde & PT_ADDR_MASK & ~(pde_t)(PT_VADDR_SIZE - 1)) + (vaddr & (PT_VADDR_SIZE - 1));
+        }
+
+        pte_t *pagetable = (pte_t *)pt_phys_tmp_map(pde & PT_ADDR_MASK);
+        uintptr_t page = pagetable[entry] & PT_ADDR_MASK;
         return page + offset;
 }
 
 void
 pt_set(pagedir_t *pd)
 {
+#ifdef __PAE__
+        uintptr_t pdir = pt_virt_to_phys((uintptr_t)pd->pd_pdpt);
+#else
         uintptr_t pdir = pt_virt_to_phys((uintptr_t)pd->pd_physical);
+#endif
         current_pagedir = pd;
         __asm__ volatile("movl %0, %%cr3" :: "r"(pdir) : "memory");
 }
@@ -104,13 +203,110 @@ pt_get(void)
         return current_pagedir;
 }
 
+/* Replaces the large page directory entry at the given index with a
+ * page table mapping the same memory with small pages. Returns 0 on
+ * success or -ENOMEM if a page table could not be allocated. Since
+ * every small page maps exactly what the large page did, no TLB flush
+ * is required. */
+static int
+_pt_split_large(pagedir_t *pd, uint32_t index)
+{
+        pde_t pde = pd->pd_physical[index];
+        KASSERT((PT_PRESENT & pde) && (PD_SIZE & pde));
+
+        pte_t *pt;
+        if (NULL == (pt = page_alloc())) {
+                return -ENOMEM;
+        }
+
+        paddr_t paddr = pde & PT_ADDR_MASK & ~(pde_t)(PT_VADDR_SIZE - 1);
+        uint32_t flags = pde & (PT_PRESENT | PT_WRITE | PT_USER);
+        uint32_t i;
+        for (i = 0; i < PT_ENTRY_COUNT; ++i) {
+                pt[i] = (paddr + i * PAGE_SIZE) | flags;
+        }
+
+        _pt_set_pde(pd, index, pt_virt_to_phys((uintptr_t)pt) | (pde & ~PAGE_MASK & ~PD_SIZE), pt);
+
+        dbg(DBG_PGTBL, "split large page at 0x%08x\n", index * PT_VADDR_SIZE);
+        return 0;
+}
+
+int
+pt_is_mapped(pagedir_t *pd, uintptr_t vaddr)
+{
+        KASSERT(PAGE_ALIGNED(vaddr));
+        KASSERT(USER_MEM_LOW <= vaddr && USER_MEM_HIGH > vaddr);
+
+        pde_t pde = pd->pd_physical[vaddr_to_pdindex(vaddr)];
+        if (!(PT_PRESENT & pde)) {
+                return 0;
+        } else if (PD_SIZE & pde) {
+                return 1;
+        } else {
+                pte_t *pt = (pte_t *)pd->pd_virtual[vaddr_to_pdindex(vaddr)];
+                return !!(PT_PRESENT & pt[vaddr_to_ptindex(vaddr)]);
+        }
+}
+
 int
-pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, uint32_t ptflags)
+pt_lookup(pagedir_t *pd, uintptr_t vaddr, paddr_t *paddr, uint32_t *ptflags)
+{
+        KASSERT(PAGE_ALIGNED(vaddr));
+        KASSERT(USER_MEM_LOW <= vaddr && USER_MEM_HIGH > vaddr);
+
+        pde_t pde = pd->pd_physical[vaddr_to_pdindex(vaddr)];
+        pte_t pte;
+        if (!(PT_PRESENT & pde)) {
+                return 0;
+        } else if (PD_SIZE & pde) {
+                /* The flags of a large page are in the same place as
+                 * a page table entry's, except for the size bit */
+                *paddr = (pde & PT_ADDR_MASK & ~(paddr_t)(PT_LARGE_SIZE - 1)) + vaddr % PT_LARGE_SIZE;
+                *ptflags = (uint32_t) pde & ~PAGE_MASK & ~PD_SIZE;
+                return 1;
+        }
+        pte = ((pte_t *)pd->pd_virtual[vaddr_to_pdindex(vaddr)])[vaddr_to_ptindex(vaddr)];
+        if (!(PT_PRESENT & pte)) {
+                return 0;
+        }
+        *paddr = pte & PT_ADDR_MASK;
+        *ptflags = (uint32_t) pte & ~PAGE_MASK;
+        return 1;
+}
+
+int
+pt_can_map_large(pagedir_t *pd, uintptr_t vaddr)
+{
+        KASSERT(0 == vaddr % PT_VADDR_SIZE);
+        KASSERT(USER_MEM_LOW <= vaddr && USER_MEM_HIGH > vaddr);
+
+        return pt_pse_enabled && !(PT_PRESENT & pd->pd_physical[vaddr_to_pdindex(vaddr)]);
+}
+
+void
+pt_map_large(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags)
+{
+        KASSERT(pt_can_map_large(pd, vaddr));
+        KASSERT(0 == paddr % PT_VADDR_SIZE);
+        KASSERT((pdflags & ~PAGE_MASK) == pdflags);
+
+        uint32_t index = vaddr_to_pdindex(vaddr);
+        _pt_set_pde(pd, index, paddr | pdflags | PD_SIZE, NULL);
+}
+
+int
+pt_map(pagedir_t *pd, uintptr_t vaddr, paddr_t paddr, uint32_t pdflags, uint32_t ptflags)
 {
         KASSERT(PAGE_ALIGNED(vaddr) && PAGE_ALIGNED(paddr));
         KASSERT(USER_MEM_LOW <= vaddr && USER_MEM_HIGH > vaddr);
 
         int index = vaddr_to_pdindex(vaddr);
+        int err;
+
+        if ((PD_SIZE & pd->pd_physical[index]) && 0 > (err = _pt_split_large(pd, index))) {
+                return err;
+        }
 
         pte_t *pt;
         if (!(PT_PRESENT & pd->pd_physical[index])) {
@@ -119,8 +315,7 @@ pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, uint32
                 } else {
                         KASSERT((pdflags & ~PAGE_MASK) == pdflags);
                         memset(pt, 0, PAGE_SIZE);
-                        pd->pd_physical[index] = pt_virt_to_phys((uintptr_t)pt) | pdflags;
-                        pd->pd_virtual[index] = pt;
+                        _pt_set_pde(pd, index, pt_virt_to_phys((uintptr_t)pt) | pdflags, pt);
                 }
         } else {
                 /* Be sure to add additional pagedir flags if necessary */
@@ -136,54 +331,130 @@ pt_map(pagedir_t *pd, uintptr_t vaddr, uintptr_t paddr, uint32_t pdflags, uint32
         return 0;
 }
 
-void
-pt_unmap(pagedir_t *pd, uintptr_t vaddr)
+int
+pt_unmap(pagedir_t *pd, uintptr_t vaddr, int pagedout)
 {
         KASSERT(PAGE_ALIGNED(vaddr));
         KASSERT(USER_MEM_LOW <= vaddr && USER_MEM_HIGH > vaddr);
 
         int index = vaddr_to_pdindex(vaddr);
 
+        if ((PD_SIZE & pd->pd_physical[index]) && 0 > _pt_split_large(pd, index)) {
+                /* Out of memory for a page table, drop the whole large
+                 * page instead. Invalidating any address in it flushes
+                 * the large TLB entry and the rest of the region will
+                 * simply be faulted back in. */
+                _pt_set_pde(pd, index, 0, NULL);
+                return PT_LARGE_NPAGES;
+        }
+
         if (PT_PRESENT & pd->pd_physical[index]) {
                 pte_t *pt = (pte_t *)pd->pd_virtual[index];
 
                 index = vaddr_to_ptindex(vaddr);
-                pt[index] = 0;
+                if (PT_PRESENT & pt[index]) {
+                        pt[index] = pagedout ? PT_PAGEDOUT : 0;
+                        return 1;
+                }
         }
+        return 0;
 }
 
-void
-pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh)
+int
+pt_is_pagedout(pagedir_t *pd, uintptr_t vaddr)
 {
-        uint32_t index;
+        KASSERT(PAGE_ALIGNED(vaddr));
+        KASSERT(USER_MEM_LOW <= vaddr && USER_MEM_HIGH > vaddr);
 
-        KASSERT(vlow < vhigh);
+        pde_t pde = pd->pd_physical[vaddr_to_pdindex(vaddr)];
+        if (!(PT_PRESENT & pde) || (PD_SIZE & pde)) {
+                return 0;
+        } else {
+                pte_t *pt = (pte_t *)pd->pd_virtual[vaddr_to_pdindex(vaddr)];
+                return !!(PT_PAGEDOUT & pt[vaddr_to_ptindex(vaddr)]);
+        }
+}
+
+void
+pt_count_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh,
+               uint32_t *nmapped, uint32_t *npagedout)
+{
+        KASSERT(vlow <= vhigh);
         KASSERT(PAGE_ALIGNED(vlow) && PAGE_ALIGNED(vhigh));
         KASSERT(USER_MEM_LOW <= vlow && USER_MEM_HIGH >= vhigh);
 
-        index = vaddr_to_ptindex(vlow);
-        if (PT_PRESENT & pd->pd_physical[vaddr_to_pdindex(vlow)] && index != 0) {
-                pte_t *pt = (pte_t *)pd->pd_virtual[vaddr_to_pdindex(vlow)];
-                size_t size = (PT_ENTRY_COUNT - index) * sizeof(*pt);
-                memset(&pt[index], 0, size);
+        *nmapped = *npagedout = 0;
+        while (vlow < vhigh) {
+                uint32_t index = vaddr_to_pdindex(vlow);
+                uintptr_t end = MIN((uintptr_t)(index + 1) * PT_VADDR_SIZE, vhigh);
+
+                if ((PT_PRESENT & pd->pd_physical[index]) && (PD_SIZE & pd->pd_physical[index])) {
+                        *nmapped += (end - vlow) >> PAGE_SHIFT;
+                } else if (PT_PRESENT & pd->pd_physical[index]) {
+                        pte_t *pt = (pte_t *)pd->pd_virtual[index];
+                        uint32_t i;
+
+                        for (i = vaddr_to_ptindex(vlow); vlow < end; ++i, vlow += PAGE_SIZE) {
+                                if (PT_PRESENT & pt[i]) {
+                                        ++*nmapped;
+                                } else if (PT_PAGEDOUT & pt[i]) {
+                                        ++*npagedout;
+                                }
+                        }
+                }
+                vlow = end;
         }
-        vlow += PAGE_SIZE * ((PT_ENTRY_COUNT - index) % PT_ENTRY_COUNT);
+}
 
-        index = vaddr_to_ptindex(vhigh);
-        if (PT_PRESENT & pd->pd_physical[vaddr_to_pdindex(vhigh)] && index != 0) {
-                pte_t *pt = (pte_t *)pd->pd_virtual[vaddr_to_pdindex(vhigh)];
-                size_t size = index * sizeof(*pt);
-                memset(&pt[0], 0, size);
-        }
-        vhigh -= PAGE_SIZE * index;
+void
+pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh)
+{
+        tlb_gather_t tg;
 
-        uint32_t i;
-        for (i = vaddr_to_pdindex(vlow); i < vaddr_to_pdindex(vhigh); ++i) {
-                if (PT_PRESENT & pd->pd_physical[i]) {
-                        page_free(pd->pd_virtual[i]);
-                        pd->pd_virtual[i] = NULL;
-                        pd->pd_physical[i] = 0;
+        tlb_gather_init(&tg, pd);
+        pt_unmap_range_gather(&tg, vlow, vhigh);
+        tlb_gather_finish(&tg);
+}
+
+void
+pt_unmap_range_gather(tlb_gather_t *tg, uintptr_t vlow, uintptr_t vhigh)
+{
+        pagedir_t *pd = tg->tg_pd;
+
+        KASSERT(vlow < vhigh);
+        KASSERT(PAGE_ALIGNED(vlow) && PAGE_ALIGNED(vhigh));
+        KASSERT(USER_MEM_LOW <= vlow && USER_MEM_HIGH >= vhigh);
+
+        while (vlow < vhigh) {
+                uint32_t index = vaddr_to_pdindex(vlow);
+                uintptr_t end = MIN((uintptr_t)(index + 1) * PT_VADDR_SIZE, vhigh);
+
+                if (PT_PRESENT & pd->pd_physical[index]) {
+                        tlb_gather_range(tg, vlow, end);
+                        if ((PD_SIZE & pd->pd_physical[index])
+                            && (0 != vaddr_to_ptindex(vlow) || 0 != vaddr_to_ptindex(end))
+                            && 0 > _pt_split_large(pd, index)) {
+                                /* See pt_unmap, invalidating any address in
+                                 * the large page flushes all of it */
+                                _pt_set_pde(pd, index, 0, NULL);
+                        } else if (PD_SIZE & pd->pd_physical[index]) {
+                                /* A large page wholly inside the range has
+                                 * no page table to free */
+                                _pt_set_pde(pd, index, 0, NULL);
+                        } else if (0 == vaddr_to_ptindex(vlow) && 0 == vaddr_to_ptindex(end)) {
+                                /* The whole table is covered, detach it
+                                 * first so that nothing can reach it by
+                                 * the time the gather frees it */
+                                pte_t *pt = (pte_t *)pd->pd_virtual[index];
+                                _pt_set_pde(pd, index, 0, NULL);
+                                tlb_gather_table(tg, pt);
+                        } else {
+                                pte_t *pt = (pte_t *)pd->pd_virtual[index];
+                                memset(&pt[vaddr_to_ptindex(vlow)], 0,
+                                       ((end - vlow) >> PAGE_SHIFT) * sizeof(*pt));
+                        }
                 }
+                vlow = end;
         }
 }
 
@@ -191,14 +462,28 @@ pt_unmap_range(pagedir_t *pd, uintptr_t vlow, uintptr_t vhigh)
 pagedir_t *
 pt_create_pagedir()
 {
-        KASSERT(sizeof(pagedir_t) == PAGE_SIZE * 2);
-
         pagedir_t *pdir;
-        if (NULL == (pdir = page_alloc_n(2))) {
+
+        if (NULL != (pdir = pt_pagedir_cache)) {
+                pt_pagedir_cache = pdir->pd_cachenext;
+                pt_pagedir_ncached--;
+                return pdir;
+        }
+        if (NULL == (pdir = page_alloc_n(PAGEDIR_NPAGES))) {
                 return NULL;
         }
 
-        memcpy(pdir, template_pagedir, sizeof(*pdir));
+        memset(pdir, 0, sizeof(*pdir));
+#ifdef __PAE__
+        uint32_t i;
+        for (i = 0; i < PDPT_ENTRY_COUNT - 1; ++i) {
+                pdir->pd_pdpt[i] = pt_virt_to_phys((uintptr_t)&pdir->pd_physical[i * PT_ENTRY_COUNT])
+                                   | PD_PRESENT;
+        }
+        pdir->pd_pdpt[PDPT_ENTRY_COUNT - 1] = pt_virt_to_phys((uintptr_t)pt_kernel_pdes) | PD_PRESENT;
+#else
+        memcpy(&pdir->pd_physical[PD_USER_COUNT], pt_kernel_pdes, PD_KERNEL_COUNT * sizeof(pde_t));
+#endif
         return pdir;
 }
 
@@ -207,17 +492,29 @@ pt_destroy_pagedir(pagedir_t *pdir)
 {
         KASSERT(PAGE_ALIGNED(pdir));
 
-        uint32_t begin = USER_MEM_LOW / PT_VADDR_SIZE;
-        uint32_t end = (USER_MEM_HIGH - 1) / PT_VADDR_SIZE;
-        KASSERT(begin < end && begin > 0);
+        uint32_t w;
+        for (w = 0; w < PD_USER_COUNT / 32; ++w) {
+                while (0 != pdir->pd_populated[w]) {
+                        uint32_t i = w * 32 + __builtin_ctz(pdir->pd_populated[w]);
 
-        uint32_t i;
-        for (i = begin; i <= end; ++i) {
-                if (PT_PRESENT & pdir->pd_physical[i]) {
-                        page_free(pdir->pd_virtual[i]);
+                        /* large pages have no page table, their memory belongs
+                         * to the pframes mapped there */
+                        if (!(PD_SIZE & pdir->pd_physical[i])) {
+                                page_free(pdir->pd_virtual[i]);
+                        }
+                        _pt_set_pde(pdir, i, 0, NULL);
                 }
         }
-        page_free_n(pdir, 2);
+
+        /* Every user entry is clear again, so the page directory can be
+         * handed out as it is */
+        if (PT_PAGEDIR_CACHE > pt_pagedir_ncached) {
+                pdir->pd_cachenext = pt_pagedir_cache;
+                pt_pagedir_cache = pdir;
+                pt_pagedir_ncached++;
+        } else {
+                page_free_n(pdir, PAGEDIR_NPAGES);
+        }
 }
 
 static void
@@ -228,14 +525,92 @@ _pt_fault_handler(regs_t *regs)
         __asm__ volatile("movl %%cr2, %0" : "=r"(vaddr));
         uint32_t cause = regs->r_err;
 
-        /* Check if pagefault was in user space (otherwise, BAD!) */
+        /* Check if pagefault was in user space (otherwise, BAD!),
+         * unless the kernel was accessing user memory somewhere that
+         * is prepared for it to fail */
+        uintptr_t fixup;
         if (cause & FAULT_USER) {
                 handle_pagefault(vaddr, cause);
+        } else if (USER_MEM_LOW <= vaddr && USER_MEM_HIGH > vaddr
+                   && 0 != (fixup = extable_fixup(regs->r_eip))) {
+                if (0 > handle_pagefault(vaddr, cause)) {
+                        regs->r_eip = fixup;
+                }
         } else {
                 panic("\nPage faulted while accessing 0x%08x\n", vaddr);
         }
 }
 
+/* Switches the processor into PSE mode if it supports it. Returns
+ * 1 if large pages may be used, 0 otherwise. PAE always has large
+ * pages. */
+static int
+_pt_pse_init(void)
+{
+        uint32_t a, d, cr4;
+
+#ifdef __PAE__
+        pt_pse_enabled = 1;
+        return 1;
+#endif
+
+        cpuid(CPUID_GETFEATURES, &a, &d);
+        if (!(CPUID_FEAT_EDX_PSE & d)) {
+                dbgq(DBG_MM, "Processor does not support 4mb pages\n");
+                return 0;
+        }
+
+        __asm__ volatile("movl %%cr4, %0" : "=r"(cr4));
+        cr4 |= CR4_PSE;
+        __asm__ volatile("movl %0, %%cr4" :: "r"(cr4));
+
+        pt_pse_enabled = 1;
+        return 1;
+}
+
+/* Everything pt_init builds lies just past the kernel image, in the
+ * memory the boot loader mapped linearly from KERNEL_PHYS_BASE */
+static uintptr_t
+_pt_boot_virt_to_phys(void *vaddr)
+{
+        return (uintptr_t)vaddr - (uintptr_t)&kernel_start + KERNEL_PHYS_BASE;
+}
+
+#ifdef __PAE__
+/* Switches the processor from the boot loader's two-level page table
+ * to PAE paging with the given page directory pointer table. Paging
+ * must be turned off to change CR4.PAE, so this jumps to the identity
+ * mapped alias of the code first, which the boot table and the new
+ * table both map. Interrupts are still disabled and nothing touches
+ * the stack while paging is off. */
+static void
+_pt_pae_switch(uintptr_t pdpt)
+{
+        uint32_t tmp;
+        __asm__ volatile(
+                "movl $1f - %c[off], %[tmp]\n\t"
+                "jmp *%[tmp]\n"
+                "1:\n\t"
+                "movl %%cr0, %[tmp]\n\t"
+                "andl $0x7fffffff, %[tmp]\n\t"
+                "movl %[tmp], %%cr0\n\t"
+                "movl %%cr4, %[tmp]\n\t"
+                "orl %[pae], %[tmp]\n\t"
+                "movl %[tmp], %%cr4\n\t"
+                "movl %[pdpt], %%cr3\n\t"
+                "movl %%cr0, %[tmp]\n\t"
+                "orl $0x80000000, %[tmp]\n\t"
+                "movl %[tmp], %%cr0\n\t"
+                "movl $2f, %[tmp]\n\t"
+                "jmp *%[tmp]\n"
+                "2:\n\t"
+                : [tmp] "=&r"(tmp)
+                : [pdpt] "r"(pdpt), [pae] "i"(CR4_PAE),
+                [off] "i"(KERNEL_VIRT_BASE - KERNEL_PHYS_BASE)
+                : "memory");
+}
+#endif
+
 static void
 _pt_fill_page(pagedir_t *pd, pte_t *pt, pde_t pdflags, pte_t ptflags,
               uintptr_t vstart, uintptr_t pstart)
@@ -249,76 +624,147 @@ _pt_fill_page(pagedir_t *pd, pte_t *pt, pde_t pdflags, pte_t ptflags,
                 pt[i] = (i * PAGE_SIZE + pstart) & PAGE_MASK;
                 pt[i] = pt[i] | (ptflags & ~(PAGE_MASK));
         }
-        uint32_t base = vaddr_to_pdindex(vstart);
-
-        uint32_t table = vaddr_to_pdindex((uintptr_t)pt);
-        uint32_t entry = vaddr_to_ptindex((uintptr_t)pt);
-
-        pde_t *temppdir;
-        __asm__ volatile("movl %%cr3, %0" : "=r"(temppdir));
-        pte_t *pagetable = (pte_t *)pt_phys_tmp_map(temppdir[table] & PAGE_MASK);
-        uintptr_t page = pagetable[entry] & PAGE_MASK;
-
-        pd->pd_physical[base] = page | (pdflags & ~(PAGE_MASK));
-        pd->pd_virtual[base] = pt;
+        _pt_set_pde(pd, vaddr_to_pdindex(vstart), _pt_boot_virt_to_phys(pt) | (pdflags & ~(PAGE_MASK)), pt);
 }
 
 void
 pt_init(void)
 {
-        /* save the "current" page table (the temporary page
-         * table created by the boot loader), note, the value is
-         * only valid because the bootloader placed the page table
-         * in the first 1mb of memory which is identity mapped,
-         * normally current_pagedir holds a virtual address while
-         * cr3 holds a physical address */
-        pde_t *temppdir;
-        __asm__ volatile("movl %%cr3, %0" : "=r"(temppdir));
-
         pagedir_t *pagedir = (pagedir_t *)&kernel_end;
         /* The kernel ending address should be page aligned by the linker script */
         KASSERT(PAGE_ALIGNED(pagedir));
         memset(pagedir, 0, sizeof(*pagedir));
 
+        /* the kernel's entries go into the page after the pagedir with
+         * PAE, and are the end of it otherwise */
+#ifdef __PAE__
+        pt_kernel_pdes = (pde_t *)((char *)pagedir + PAGEDIR_NPAGES * PAGE_SIZE);
+        memset(pt_kernel_pdes, 0, PAGE_SIZE);
+        final_page = (pte_t *)((char *)pt_kernel_pdes + PAGE_SIZE);
+#else
+        pt_kernel_pdes = &pagedir->pd_physical[PD_USER_COUNT];
+        final_page = (pte_t *)((char *)pagedir + PAGEDIR_NPAGES * PAGE_SIZE);
+#endif
+
         /* set up the necessary stuff for temporary mappings */
-        final_page = (pde_t *)((char *)pagedir + sizeof(*pagedir));
-        KASSERT(PAGE_ALIGNED(final_page));
         memset(final_page, 0, PAGE_SIZE);
-        temppdir[PT_ENTRY_COUNT - 1] = ((uintptr_t)final_page
-                                        - (uintptr_t)&kernel_start + KERNEL_PHYS_BASE) | PT_PRESENT | PT_WRITE;
-        pagedir->pd_physical[PT_ENTRY_COUNT - 1] = temppdir[PT_ENTRY_COUNT - 1];
-        pagedir->pd_virtual[PT_ENTRY_COUNT - 1] = final_page;
+        _pt_set_pde(pagedir, PD_ENTRY_COUNT - 1, _pt_boot_virt_to_phys(final_page) | PT_PRESENT | PT_WRITE,
+                    final_page);
 
-        /* identity map the first 4mb (one page table) of physical memory */
+        /* identity map the first page table's worth of physical memory */
         pte_t *pagetable = final_page + PT_ENTRY_COUNT;
         _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE, 0, 0);
 
-        /* map in 4mb (one page table) where the kernel is
-         * this will make our new page table identical to the temporary
-         * page table the boot loader created. */
+        /* map in one page table where the kernel is, this will make
+         * our new page table map the same memory the temporary page
+         * table the boot loader created does, as far as the kernel
+         * is concerned. */
         pagetable += PT_ENTRY_COUNT;
         _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE,
                       (uintptr_t)&kernel_start, KERNEL_PHYS_BASE);
 
         current_pagedir = pagedir;
+#ifdef __PAE__
+        /* A PAE page table maps only 2mb, all of the kernel and the
+         * tables above must fit in it, as must the code which switches
+         * over in the identity mapped 2mb */
+        KASSERT((uintptr_t)(pagetable + PT_ENTRY_COUNT) <= (uintptr_t)&kernel_start + PT_VADDR_SIZE);
+        KASSERT(_pt_boot_virt_to_phys((void *)_pt_pae_switch) < PT_VADDR_SIZE);
+
+        uint32_t i, a, d;
+        cpuid(CPUID_GETFEATURES, &a, &d);
+        if (!(CPUID_FEAT_EDX_PAE & d)) {
+                panic("Kernel built for PAE but the processor does not support it\n");
+        }
+        for (i = 0; i < PDPT_ENTRY_COUNT - 1; ++i) {
+                pagedir->pd_pdpt[i] = _pt_boot_virt_to_phys(&pagedir->pd_physical[i * PT_ENTRY_COUNT])
+                                      | PD_PRESENT;
+        }
+        pagedir->pd_pdpt[PDPT_ENTRY_COUNT - 1] = _pt_boot_virt_to_phys(pt_kernel_pdes) | PD_PRESENT;
+        _pt_pae_switch(_pt_boot_virt_to_phys(pagedir->pd_pdpt));
+        dbgq(DBG_MM, "Switched to PAE paging\n");
+#else
+        /* save the "current" page table (the temporary page
+         * table created by the boot loader), note, the value is
+         * only valid because the bootloader placed the page table
+         * in the first 1mb of memory which is identity mapped,
+         * normally current_pagedir holds a virtual address while
+         * cr3 holds a physical address. pt_set needs temporary
+         * mappings, so those go into the boot table first. */
+        pde_t *temppdir;
+        __asm__ volatile("movl %%cr3, %0" : "=r"(temppdir));
+        temppdir[PT_ENTRY_COUNT - 1] = _pt_get_pde(pagedir, PT_ENTRY_COUNT - 1);
+
         /* swap the temporary page table with our identical, but more
          * permanant page table */
         pt_set(pagedir);
+#endif
+
+        /* Make the kernel respect read-only user pages, so that writes
+         * to user memory from the kernel go through copy-on-write */
+        uint32_t cr0;
+        __asm__ volatile("movl %%cr0, %0" : "=r"(cr0));
+        __asm__ volatile("movl %0, %%cr0" :: "r"(cr0 | CR0_WP));
 
         uintptr_t physmax = phys_detect_highmem();
         dbgq(DBG_MM, "Highest usable physical memory: 0x%08x\n", physmax);
         dbgq(DBG_MM, "Available memory: 0x%08x\n", physmax - KERNEL_PHYS_BASE);
 
+        /* Physical memory is mapped into the kernel's address space up
+         * to directmax, which is physmax unless that would run into the
+         * temporary mappings at the top of the address space. Anything
+         * above directmax is high memory. */
+        uintptr_t directmax;
         uintptr_t vaddr = ((uintptr_t)&kernel_start);
         uintptr_t paddr = KERNEL_PHYS_BASE;
-        do {
-                pagetable += PT_ENTRY_COUNT;
+        if (_pt_pse_init()) {
+                /* A large page must be aligned to its size both
+                 * virtually and physically, but KERNEL_PHYS_BASE is not.
+                 * Map physical memory up to the next large page boundary
+                 * with one more page table, then map the rest with large
+                 * pages starting at the next page table's worth of
+                 * virtual memory. This leaves a small hole in the
+                 * kernel's virtual address space, so the page allocator
+                 * gets the two halves separately. */
                 vaddr += PT_VADDR_SIZE;
                 paddr += PT_VADDR_SIZE;
-                _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE, vaddr, paddr);
-        } while (paddr < physmax);
+                uintptr_t vsmall = vaddr;
+                uintptr_t psmall = paddr;
+                uintptr_t palign = ((paddr - 1) & ~(PT_VADDR_SIZE - 1)) + PT_VADDR_SIZE;
+                uintptr_t pfree = (uintptr_t)(pagetable + PT_ENTRY_COUNT);
+                if (palign > psmall) {
+                        uint32_t nsmall = (palign - psmall) >> PAGE_SHIFT;
+                        pagetable += PT_ENTRY_COUNT;
+                        _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE, vsmall, psmall);
+                        memset(pagetable + nsmall, 0, (PT_ENTRY_COUNT - nsmall) * sizeof(*pagetable));
+                        pfree = (uintptr_t)(pagetable + PT_ENTRY_COUNT);
+                        vaddr += PT_VADDR_SIZE;
+                }
+                page_add_range(pfree, vsmall + MAX(MIN(palign, physmax), psmall) - psmall);
+
+                uintptr_t vlarge = vaddr;
+                directmax = MIN(physmax, palign + (PD_ENTRY_COUNT - 1 - vaddr_to_pdindex(vlarge)) * PT_VADDR_SIZE);
+                for (paddr = palign; paddr < directmax; paddr += PT_VADDR_SIZE, vaddr += PT_VADDR_SIZE) {
+                        KASSERT(PD_ENTRY_COUNT - 1 > vaddr_to_pdindex(vaddr));
+                        _pt_set_pde(pagedir, vaddr_to_pdindex(vaddr), paddr | PD_PRESENT | PD_WRITE | PD_SIZE, NULL);
+                }
+                if (palign < directmax) {
+                        page_add_range(vlarge, vlarge + directmax - palign);
+                }
+                dbgq(DBG_MM, "Mapped 0x%08x-0x%08x with large pages\n", palign, directmax);
+        } else {
+                do {
+                        pagetable += PT_ENTRY_COUNT;
+                        vaddr += PT_VADDR_SIZE;
+                        paddr += PT_VADDR_SIZE;
+                        _pt_fill_page(pagedir, pagetable, PD_PRESENT | PD_WRITE, PT_PRESENT | PT_WRITE, vaddr, paddr);
+                } while (paddr < physmax && PD_ENTRY_COUNT - 2 > vaddr_to_pdindex(vaddr));
+
+                directmax = MIN(physmax, paddr + PT_VADDR_SIZE);
+                page_add_range((uintptr_t) pagetable + PT_ENTRY_COUNT, directmax + ((uintptr_t)&kernel_start) - KERNEL_PHYS_BASE);
+        }
 
-        page_add_range((uintptr_t) pagetable + PT_ENTRY_COUNT, physmax + ((uintptr_t)&kernel_start) - KERNEL_PHYS_BASE);
+        phys_detect_highmem_ranges(directmax);
 }
 
 void
@@ -326,15 +772,12 @@ pt_template_init()
 {
         /* the current page directory should be the same one set up by
          * the pt_init function above, it needs to be slighly modified
-         * to remove the mapping of the first 4mb and then saved in a
-         * seperate page as the template */
+         * to remove the mapping of the first 4mb. From now on the
+         * kernel's entries do not change, so new page directories can
+         * share or copy them. */
         memset(current_pagedir->pd_virtual[0], 0, PAGE_SIZE);
         tlb_flush_all();
 
-        template_pagedir = page_alloc_n(2);
-        KASSERT(NULL != template_pagedir);
-        memcpy(template_pagedir, current_pagedir, sizeof(*template_pagedir));
-
         intr_register(INTR_PAGE_FAULT, _pt_fault_handler);
 }
 
@@ -355,26 +798,29 @@ pt_mapping_info(const void *pt, char *buf, size_t osize)
         uint32_t pti = 0;
         int started = 0;
 
-        while (PT_ENTRY_COUNT > pdi) {
-                pte_t *entry = NULL;
-                if (PD_PRESENT & pagedir->pd_physical[pdi]) {
-                        if (PT_PRESENT & pagedir->pd_virtual[pdi][pti]) {
-                                entry = &pagedir->pd_virtual[pdi][pti];
-                        }
+        while (PD_ENTRY_COUNT > pdi) {
+                pte_t pte = 0;
+                pde_t pde = _pt_get_pde(pagedir, pdi);
+                if (PD_SIZE & pde) {
+                        /* describe large pages as the small pages they cover */
+                        pte = ((pde & PT_ADDR_MASK & ~(pde_t)(PT_VADDR_SIZE - 1))
+                               + pti * PAGE_SIZE) | PT_PRESENT;
+                } else if (PD_PRESENT & pde) {
+                        pte = _pt_get_pt(pagedir, pdi)[pti];
                 } else {
                         ++pdi;
                         pti = 0;
                 }
 
-                int present = (NULL != entry);
+                int present = !!(PT_PRESENT & pte);
                 pexpect += PAGE_SIZE;
                 if (present && !started) {
                         started = 1;
                         vstart = (pdi * PT_ENTRY_COUNT + pti) * PAGE_SIZE;
-                        pstart = *entry & PAGE_MASK;
+                        pstart = pte & PT_ADDR_MASK;
                         pexpect = pstart;
                 } else if ((started && !present)
-                           || (started && present && ((*entry & PAGE_MASK) != pexpect))) {
+                           || (started && present && ((pte & PT_ADDR_MASK) != pexpect))) {
                         uintptr_t vend = (pdi * PT_ENTRY_COUNT + pti) * PAGE_SIZE;
                         uintptr_t pend = pstart + (vend - vstart);
 
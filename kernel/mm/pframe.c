@@ -15,7 +15,15 @@
 #include "mm/tlb.h"
 #include "mm/pagetable.h"
 
+#include "mm/highmem.h"
+
 #include "vm/vmmap.h"
+#include "vm/anon.h"
+#include "vm/shadow.h"
+#include "vm/swap.h"
+#include "vm/pagefault.h"
+#include "vm/vmreapd.h"
+#include "vm/ksm.h"
 
 /*
  * In this file, physical pages (as represented by pframes) will be
@@ -104,6 +112,17 @@ static ktqueue_t pageoutd_waitq;
 /* threads waiting for pageoutd to run sleep on this queue */
 static ktqueue_t alloc_waitq;
 
+/* pages reclaimed by pageoutd so far, to tell whether it got anywhere */
+static uint32_t pageoutd_nfreed = 0;
+
+/* the process last killed for memory, waited on while it exits */
+static pid_t oom_victim = -1;
+
+static void _pframe_unmap(pframe_t *pf, int pageout);
+static uint32_t _pframe_reclaim(uint32_t npages);
+static int _pframe_oom(void);
+static void _pframe_release(pframe_t *pf);
+
 /* Pageout daemon functions */
 static void *pageoutd_run(int arg1, void *arg2);
 static void pageoutd_exit(void);
@@ -211,31 +230,32 @@ pframe_get_resident(struct mmobj *o, uint32_t pagenum)
 }
 
 /*
- * Allocate a pframe to hold the page identified by the object and page number.
- * The given page should not already be resident.
+ * Allocate a pframe to hold the page identified by the object and page number
+ * in the given, already allocated, page of memory. The given page should not
+ * already be resident.
  *
- * We allocate a page from the free list. We then initialize the newly allocated
- * page's object, pagenum, and flags, pin count, and links. We also update the
- * object's nrespages.
+ * We initialize the newly allocated page's object, pagenum, and flags, pin
+ * count, and links. We also update the object's nrespages.
  *
  * @param o the mmobj identifying this page
  * @param pagenum the page number of this page in the object
+ * @param addr the page of memory to hold the page's data, or NULL if it is
+ * in high memory
+ * @param paddr the physical address of that page
  *
- * @return a new pframe
+ * @return a new pframe, or NULL if no pframe could be allocated (in which
+ * case the caller still owns addr)
  */
 static pframe_t *
-pframe_alloc(mmobj_t *o, uint32_t pagenum)
+pframe_alloc_at(mmobj_t *o, uint32_t pagenum, void *addr, paddr_t paddr)
 {
         pframe_t *pf;
         if (NULL == (pf = slab_obj_alloc(pframe_allocator))) {
                 dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
                 return NULL;
         }
-        if (NULL == (pf->pf_addr = page_alloc())) {
-                dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
-                slab_obj_free(pframe_allocator, pf);
-                return NULL;
-        }
+        pf->pf_addr = addr;
+        pf->pf_paddr = paddr;
 
         nallocated++;
         list_insert_tail(&alloc_list, &pf->pf_link);
@@ -255,6 +275,42 @@ pframe_alloc(mmobj_t *o, uint32_t pagenum)
         return pf;
 }
 
+/*
+ * Allocate a pframe and a page from the free list to hold the page identified
+ * by the object and page number. The given page should not already be
+ * resident.
+ *
+ * @param o the mmobj identifying this page
+ * @param pagenum the page number of this page in the object
+ *
+ * @return a new pframe
+ */
+static pframe_t *
+pframe_alloc(mmobj_t *o, uint32_t pagenum)
+{
+        pframe_t *pf;
+        void *addr;
+        paddr_t high;
+
+        /* Anonymous memory never goes to a device, so it can live in high
+         * memory and leave directly mapped pages to the rest of the kernel */
+        if ((mmobj_is_anon(o) || mmobj_is_shadow(o)) && 0 != (high = highmem_alloc())) {
+                if (NULL == (pf = pframe_alloc_at(o, pagenum, NULL, high))) {
+                        highmem_free(high);
+                }
+                return pf;
+        }
+
+        if (NULL == (addr = page_alloc())) {
+                dbg(DBG_PFRAME, "WARNING: not enough kernel memory\n");
+                return NULL;
+        }
+        if (NULL == (pf = pframe_alloc_at(o, pagenum, addr, pt_virt_to_phys((uintptr_t)addr)))) {
+                page_free(addr);
+        }
+        return pf;
+}
+
 /*
  * Fills the contents of the page (using the mmobj's fillpage op).
  * Make sure to mark the page busy while it's being filled.
@@ -268,6 +324,10 @@ pframe_fill(pframe_t *pf)
         pframe_set_busy(pf);
         ret = pf->pf_obj->mmo_ops->fillpage(pf->pf_obj, pf);
         pframe_clear_busy(pf);
+        if (!mmobj_is_anon(pf->pf_obj) && !mmobj_is_shadow(pf->pf_obj)) {
+                /* Anything else is read from a file or device */
+                pagefault_note(FAULT_EV_MAJOR);
+        }
 
         sched_broadcast_on(&pf->pf_waitq);
 
@@ -298,6 +358,8 @@ int
 pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result)
 {
 	/*NOT_YET_IMPLEMENTED("VM: pframe_get");  */
+	int ret;
+
 	*result = pframe_get_resident(o, pagenum);
 	if (*result != NULL) {
 		/* success
@@ -312,23 +374,116 @@ pframe_get(struct mmobj *o, uint32_t pagenum, pframe_t **result)
 		return 0;
 	} else {
 		/* frame not found */
+		int ntries = 0;
 		while(pageoutd_needed())
 		{
+		  uint32_t nfreed = pageoutd_nfreed;
 		  pageoutd_wakeup();
-		  sched_sleep_on(&alloc_waitq);
+		  /* Merging identical pages frees memory too */
+		  ksmd_wakeup();
+		  sched_cancellable_sleep_on(&alloc_waitq);
+		  if (curthr->kt_cancelled) {
+		          return -EINTR;
+		  }
+		  if (nfreed == pageoutd_nfreed) {
+		          /* Nothing could be reclaimed (it is all dirty
+		           * anonymous memory and swap is full), waiting
+		           * longer will not help */
+		          break;
+		  }
+		}
+		while (NULL == (*result = pframe_alloc(o, pagenum))) {
+			if (curthr->kt_cancelled) {
+				return -EINTR;
+			}
+			/* Try reclaiming a few times ourselves before
+			 * resorting to killing someone */
+			if (ntries++ < PFRAME_RECLAIM_TRIES
+			    && 0 < _pframe_reclaim(PFRAME_RECLAIM_PAGES)) {
+				continue;
+			}
+			if (0 > (ret = _pframe_oom())) {
+				return ret;
+			}
 		}
-		*result = pframe_alloc(o, pagenum);
-		if (*result == NULL) {
-			pageoutd_run(0, NULL);
-			*result = pframe_alloc(o, pagenum);
+		if (0 > (ret = pframe_fill(*result))) {
+			pframe_free(*result);
+			*result = NULL;
+			return ret;
 		}
-		pframe_fill(*result);
 		return 0;
 
 	}
 	return 0;
 }
 
+/*
+ * Makes the npages pages of o starting at pagenum resident in one physically
+ * contiguous block of memory which is aligned to its own size, so that the
+ * block can be mapped with a single large page. None of the pages may already
+ * be resident. The pages are ordinary pframes afterwards and are freed one at
+ * a time like any other page.
+ *
+ * This routine may block at the mmobj operation level.
+ *
+ * @param o the parent object of the pages
+ * @param pagenum the page number of the first page
+ * @param npages the number of pages, a power of two
+ * @param paddr used to return the physical address of the block
+ * @return 0 on success, -EEXIST if some of the pages are already resident,
+ * -ENOMEM if no suitable block is available or the error from filling a page
+ */
+int
+pframe_get_contig(struct mmobj *o, uint32_t pagenum, uint32_t npages, uintptr_t *paddr)
+{
+        uint32_t i;
+        char *block;
+        int ret;
+
+        KASSERT(0 < npages && 0 == (npages & (npages - 1)));
+
+        for (i = 0; i < npages; ++i) {
+                if (NULL != pframe_get_resident(o, pagenum + i)) {
+                        return -EEXIST;
+                }
+        }
+
+        if (NULL == (block = page_alloc_n(npages))) {
+                return -ENOMEM;
+        }
+        /* Blocks are virtually aligned within their page group, but only
+         * physically aligned if the group itself is */
+        *paddr = pt_virt_to_phys((uintptr_t) block);
+        if (0 != *paddr % (npages * PAGE_SIZE)) {
+                page_free_n(block, npages);
+                return -ENOMEM;
+        }
+
+        for (i = 0; i < npages; ++i) {
+                pframe_t *pf;
+                if (NULL == (pf = pframe_alloc_at(o, pagenum + i, block + i * PAGE_SIZE,
+                                                 *paddr + i * PAGE_SIZE))) {
+                        ret = -ENOMEM;
+                        goto fail;
+                }
+                if (0 > (ret = pframe_fill(pf))) {
+                        pframe_free(pf);
+                        ++i;
+                        goto fail;
+                }
+        }
+
+        dbg(DBG_PFRAME, "made pages %u-%u of obj %p resident at 0x%08x\n",
+            pagenum, pagenum + npages - 1, o, *paddr);
+        return 0;
+
+fail:
+        for (; i < npages; ++i) {
+                page_free(block + i * PAGE_SIZE);
+        }
+        return ret;
+}
+
 int
 pframe_lookup(struct mmobj *o, uint32_t pagenum, int forwrite, pframe_t **result)
 {
@@ -341,7 +496,10 @@ pframe_lookup(struct mmobj *o, uint32_t pagenum, int forwrite, pframe_t **result
 /*
  * Migrate a page frame up the tree. The destination must be on the same
  * branch as the pframe's current object. pf must not be busy. If dest
- * already has a page with the same number as pf clean pf.
+ * already has a page with the same number as pf, resident or in swap,
+ * clean pf. The source's copy of the page in swap, if any, is freed, and
+ * the page is dirtied so that it is written out for dest before it can be
+ * reclaimed.
  *
  * @param pf page to be migrated
  * @param dest destination vm object
@@ -350,13 +508,20 @@ void
 pframe_migrate(pframe_t *pf, mmobj_t *dest)
 {
         KASSERT(!pframe_is_busy(pf));
-        if (NULL != pframe_get_resident(dest, pf->pf_pagenum)) {
-                /* dest already has a newer version of the page, clean this page */
-                pframe_unpin(pf);
-                pframe_clean(pf);
+        if (NULL != pframe_get_resident(dest, pf->pf_pagenum) || swap_has(dest, pf->pf_pagenum)) {
+                /* dest already has a newer version of the page, resident
+                 * or paged out or merged by ksmd, and nothing can see this
+                 * one any more, so its contents can be dropped */
+                while (pframe_is_pinned(pf)) {
+                        pframe_unpin(pf);
+                }
+                pframe_clear_dirty(pf);
+                swap_discard(pf->pf_obj, pf->pf_pagenum, 1);
                 pframe_free(pf);
         } else {
                 mmobj_t *src = pf->pf_obj;
+                swap_discard(src, pf->pf_pagenum, 1);
+                pframe_set_dirty(pf);
                 pf->pf_obj = dest;
                 list_remove(&pf->pf_hlink);
                 list_remove(&pf->pf_olink);
@@ -421,9 +586,9 @@ pframe_unpin(pframe_t *pf)
 	dbg(DBG_PRINT, "(GRADING3A 1.b) Pin count on the page is greater than 0\n ");
 
 	pf->pf_pincount--;
-	npinned--;
 	if (pf->pf_pincount == 0) {
 		/*move the pframe's list link from the pinned list to the allocated list*/
+		npinned--;
 		list_remove(&pf->pf_link);
 		list_insert_tail(&alloc_list, &pf->pf_link);
 		nallocated++;
@@ -487,9 +652,9 @@ pframe_clean(pframe_t *pf)
          */
         pframe_clear_dirty(pf);
 
-        /* Make sure a future write to the page will fault (and hence dirty it) */
-        tlb_flush((uintptr_t) pf->pf_addr);
-        pframe_remove_from_pts(pf);
+        /* Make sure a future write to the page will fault (and hence dirty it).
+         * Anonymous memory is only cleaned to page it out. */
+        _pframe_unmap(pf, mmobj_is_anon(pf->pf_obj) || mmobj_is_shadow(pf->pf_obj));
 
         pframe_set_busy(pf);
         if ((ret = pf->pf_obj->mmo_ops->cleanpage(pf->pf_obj, pf)) < 0) {
@@ -521,32 +686,138 @@ pframe_free(pframe_t *pf)
         mmobj_t *o = pf->pf_obj;
 
 
-        /* Flush the TLB */
-        tlb_flush((uintptr_t) pf->pf_addr);
-        /* Remove from all pagetables that map it */
+        /* Remove from all pagetables that map it (this flushes the TLB) */
         pframe_remove_from_pts(pf);
 
+        _pframe_release(pf);
+
+        /* Someone may be out of memory waiting for this page */
+        if (!sched_queue_empty(&alloc_waitq)) {
+                sched_broadcast_on(&alloc_waitq);
+        }
+
+        /* Now that pf has effectively been freed, dereference the corresponding
+         * object. We don't do this earlier as we are modifying the object's counts
+         * and also because this op can block */
+        o->mmo_ops->put(o);
+}
+
+/*
+ * Takes pf out of the cache and gives its memory back, leaving its
+ * page table entries and its reference to its object to the caller.
+ */
+static void
+_pframe_release(pframe_t *pf)
+{
+        mmobj_t *o = pf->pf_obj;
+
         list_remove(&pf->pf_hlink);
 
         pf->pf_obj = NULL;
         nallocated--;
         list_remove(&pf->pf_link);
 
-        page_free(pf->pf_addr);
-        slab_obj_free(pframe_allocator, pf);
-
         o->mmo_nrespages--;
         list_remove(&pf->pf_olink);
 
-        /* Now that pf has effectively been freed, dereference the corresponding
-         * object. We don't do this earlier as we are modifying the object's counts
-         * and also because this op can block */
-        o->mmo_ops->put(o);
+        if (NULL != pf->pf_addr) {
+                page_free(pf->pf_addr);
+        } else {
+                highmem_free(pf->pf_paddr);
+        }
+        slab_obj_free(pframe_allocator, pf);
+}
+
+/*
+ * Frees every resident page of o, and its copies in swap, once nothing
+ * but those pages and the caller refers to o. No area can see the pages
+ * then, so unlike pframe_free this does not look for page table entries
+ * to remove, and the pages' references to o are dropped all at once
+ * rather than through put. Busy pages are waited for.
+ */
+void
+pframe_release_all(mmobj_t *o)
+{
+        pframe_t *pf;
+        int nfreed = 0;
+
+        KASSERT(mmobj_is_anon(o) || mmobj_is_shadow(o));
+        KASSERT(o->mmo_refcount - 1 == o->mmo_nrespages);
+
+again:
+        list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                if (pframe_is_busy(pf)) {
+                        sched_sleep_on(&pf->pf_waitq);
+                        goto again;
+                }
+                while (pframe_is_pinned(pf)) {
+                        pframe_unpin(pf);
+                }
+                _pframe_release(pf);
+                nfreed++;
+        } list_iterate_end();
+
+        KASSERT(o->mmo_refcount > nfreed);
+        o->mmo_refcount -= nfreed;
+        swap_discard(o, 0, (uint32_t) -1);
+
+        if (0 < nfreed && !sched_queue_empty(&alloc_waitq)) {
+                sched_broadcast_on(&alloc_waitq);
+        }
+}
+
+/*
+ * Frees the resident pages [lopage, lopage + npages) of o without
+ * cleaning them, because their contents are no longer wanted (see
+ * madvise(2)), along with their copies in swap. Pinned pages are unpinned
+ * first and busy pages are waited for. o must be an anonymous or shadow object which the caller holds a
+ * reference to, so that dropping the pages' references to it does not
+ * block.
+ */
+void
+pframe_discard_range(mmobj_t *o, uint32_t lopage, uint32_t npages)
+{
+        pframe_t *pf;
+
+        KASSERT(mmobj_is_anon(o) || mmobj_is_shadow(o));
+        KASSERT(o->mmo_refcount > o->mmo_nrespages);
+
+again:
+        list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                if (pf->pf_pagenum < lopage || pf->pf_pagenum - lopage >= npages) {
+                        continue;
+                }
+                if (pframe_is_busy(pf)) {
+                        sched_sleep_on(&pf->pf_waitq);
+                        goto again;
+                }
+                while (pframe_is_pinned(pf)) {
+                        pframe_unpin(pf);
+                }
+                pframe_clear_dirty(pf);
+                pframe_free(pf);
+        } list_iterate_end();
+        swap_discard(o, lopage, npages);
+}
+
+/*
+ * Moves pf to the front of the list pageoutd reclaims pages from, so that
+ * it goes before any page which was used more recently. Pinned pages are
+ * never reclaimed and are left alone.
+ */
+void
+pframe_deactivate(pframe_t *pf)
+{
+        if (!pframe_is_pinned(pf)) {
+                list_remove(&pf->pf_link);
+                list_insert_head(&alloc_list, &pf->pf_link);
+        }
 }
 
 /*
  * Clean all allocated pages (that is, all pages that are not pinned and
- * not free). This is called by sync(2).
+ * not free). This is called by sync(2). Anonymous memory is left alone,
+ * writing it to swap would not make anything more durable.
  */
 void
 pframe_clean_all()
@@ -562,6 +833,8 @@ pframe_clean_all()
          * integrity)
          */
 list_start:
+        /* nothing is held between passes, a safe place to give way */
+        sched_preempt_point();
         list_iterate_begin(&alloc_list, pf, pframe_t, pf_link) {
                 KASSERT(!pframe_is_pinned(pf));
                 KASSERT(!pframe_is_free(pf));
@@ -569,7 +842,8 @@ list_start:
                         sched_sleep_on(&pf->pf_waitq);
                         goto list_start;
                 }
-                if (pframe_is_dirty(pf)) {
+                if (pframe_is_dirty(pf) && !mmobj_is_anon(pf->pf_obj)
+                    && !mmobj_is_shadow(pf->pf_obj)) {
                         pframe_clean(pf);
                         goto list_start;
                 }
@@ -584,9 +858,11 @@ list_start:
 /* Remove a page frame from the page tables of all processes that map it
  * To do that, traverse all processes that map the given page frame into
  * their address space, and zero the corresponding address entry.
+ * If pageout is set, entries which mapped this very page are marked as
+ * paged out instead, for the areas' counts of swapped pages.
  */
-void
-pframe_remove_from_pts(pframe_t *pf)
+static void
+_pframe_unmap(pframe_t *pf, int pageout)
 {
         vmarea_t *vma;
         list_iterate_begin(mmobj_bottom_vmas(pf->pf_obj), vma, vmarea_t, vma_olink) {
@@ -596,13 +872,29 @@ pframe_remove_from_pts(pframe_t *pf)
                         uintptr_t vaddr = (uintptr_t) PN_TO_ADDR(vma->vma_start + pf->pf_pagenum - vma->vma_off);
                         /* And unmap it from that area's proc */
                         if (NULL != vma->vma_vmmap->vmm_proc) {
-                                pt_unmap(vma->vma_vmmap->vmm_proc->p_pagedir, vaddr);
+                                pagedir_t *pd = vma->vma_vmmap->vmm_proc->p_pagedir;
+                                paddr_t paddr;
+                                uint32_t ptflags;
+                                int mine = pageout && pt_lookup(pd, vaddr, &paddr, &ptflags)
+                                           && paddr == pf->pf_paddr;
+                                vmarea_account(vma, -pt_unmap(pd, vaddr, mine), mine);
+                                /* Other page directories pick up the change
+                                 * when they are next loaded into cr3 */
+                                if (pd == pt_get()) {
+                                        tlb_flush(vaddr);
+                                }
                         }
                 }
 
         } list_iterate_end();
 }
 
+void
+pframe_remove_from_pts(pframe_t *pf)
+{
+        _pframe_unmap(pf, 0);
+}
+
 /* ------------------------------------------------------------------ */
 /* ------------------------- PAGEOUT DAEMON ------------------------- */
 /* ------------------------------------------------------------------ */
@@ -642,6 +934,108 @@ pageoutd_exit()
         pageoutd_thr = NULL;
 }
 
+/*
+ * Frees up to npages of the least recently requested pages, cleaning
+ * dirty pages first. Pages which cannot be cleaned (swap is full) are
+ * moved to the back of the list, and once every page has failed this
+ * gives up. Returns the number of pages freed. This blocks.
+ */
+static uint32_t
+_pframe_reclaim(uint32_t npages)
+{
+        uint32_t nfreed = 0;
+        int nfailed = 0;
+
+        while (nfreed < npages && !list_empty(&alloc_list) && nfailed < nallocated) {
+                pframe_t *pf;
+
+                /* obtain least-recently-requested page: */
+                pf = list_head(&alloc_list, pframe_t, pf_link);
+
+                if (pframe_is_busy(pf)) {
+                        sched_sleep_on(&pf->pf_waitq);
+                } else if (pframe_is_dirty(pf)) {
+                        if (0 > pframe_clean(pf) && !pframe_is_pinned(pf)) {
+                                list_remove(&pf->pf_link);
+                                list_insert_tail(&alloc_list, &pf->pf_link);
+                                nfailed++;
+                        }
+                } else {
+                        /* it's not busy, it's clean, and it's
+                         * least-recently-requested; reclaim it: */
+                        pframe_free(pf);
+                        pageoutd_nfreed++;
+                        nfreed++;
+                }
+        }
+        return nfreed;
+}
+
+/*
+ * Called when an allocation still fails after reclaiming. Kills the
+ * user process with the most resident pages so its memory is freed on
+ * exit; init and the kernel daemons (children of idle) are never
+ * picked. Only one process is killed at a time, while it is exiting
+ * this waits for memory to be freed instead. Returns 0 if the
+ * allocation should be retried, -ENOMEM if there is nothing to kill
+ * or we were picked ourselves, or -EINTR if we were killed while
+ * waiting.
+ */
+static int
+_pframe_oom(void)
+{
+        proc_t *p, *victim = NULL;
+
+        if (0 < vmreapd_pending()) {
+                /* Exited processes are still being torn down */
+                goto wait;
+        }
+        list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
+                if (p->p_pid == oom_victim && PROC_DEAD != p->p_state) {
+                        victim = p;
+                        goto wait;
+                }
+        } list_iterate_end();
+
+        list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
+                if (PROC_DEAD == p->p_state || PID_IDLE == p->p_pid
+                    || PID_INIT == p->p_pid || NULL == p->p_pproc
+                    || PID_IDLE == p->p_pproc->p_pid) {
+                        continue;
+                }
+                /* vfork children have nothing of their own to free */
+                if (NULL == p->p_vmmap || p != p->p_vmmap->vmm_proc) {
+                        continue;
+                }
+                if (0 < p->p_nresident
+                    && (NULL == victim || p->p_nresident > victim->p_nresident)) {
+                        victim = p;
+                }
+        } list_iterate_end();
+
+        if (NULL == victim) {
+                return -ENOMEM;
+        }
+        dbg(DBG_PFRAME, "out of memory, killing process %d (%s) with %u "
+            "resident pages\n", victim->p_pid, victim->p_comm, victim->p_nresident);
+        oom_victim = victim->p_pid;
+        if (victim == curproc) {
+                /* We may be holding busy pages, so unwind and exit
+                 * on the way back out of the fault or syscall */
+                curthr->kt_retval = (void *) ENOMEM;
+                sched_cancel(curthr);
+                return -ENOMEM;
+        }
+        proc_kill(victim, ENOMEM);
+
+wait:
+        if (victim == curproc) {
+                return -ENOMEM;
+        }
+        sched_cancellable_sleep_on(&alloc_waitq);
+        return curthr->kt_cancelled ? -EINTR : 0;
+}
+
 /*
  * The pageout daemon, when run, gets the least-recently-requested page from the
  * list of pages which are available to be paged out. Make sure to check if the
@@ -655,21 +1049,9 @@ pageoutd_run(int arg1, void *arg2)
 {
         while (1) {
                 KASSERT(nallocated >= 0);
-                while ((!pageoutd_target_met()) && (!list_empty(&alloc_list))) {
-                        pframe_t *pf;
-
-                        /* obtain least-recently-requested page: */
-                        pf = list_head(&alloc_list, pframe_t, pf_link);
-
-                        if (pframe_is_busy(pf)) {
-                                sched_sleep_on(&pf->pf_waitq);
-                        } else if (pframe_is_dirty(pf)) {
-                                pframe_clean(pf);
-                        } else {
-                                /* it's not busy, it's clean, and it's
-                                 * least-recently-requested; reclaim it: */
-                                pframe_free(pf);
-                        }
+                while (!pageoutd_target_met()
+                       && 0 < _pframe_reclaim(nfreepages_target - page_free_count())) {
+                        ;
                 }
 
                 /*   release the thundering herd... */
@@ -2,6 +2,7 @@
 #include "kernel.h"
 
 #include "mm/phys.h"
+#include "mm/highmem.h"
 
 #include "boot/config.h"
 
@@ -51,3 +52,26 @@ phys_detect_highmem(void)
         return 0;
 }
 
+
+void
+phys_detect_highmem_ranges(paddr_t direct_end)
+{
+        uint32_t i;
+        struct mmap_def *mmap = (struct mmap_def *)MEMORY_MAP_BASE;
+        for (i = 0; i < mmap->md_count; ++i) {
+                uint64_t base = ((uint64_t)mmap->md_ents[i].me_basehi << 32) | mmap->md_ents[i].me_baselo;
+                uint64_t end = base + (((uint64_t)mmap->md_ents[i].me_lenhi << 32) | mmap->md_ents[i].me_lenlo);
+
+                if (1 /* Usable */ != mmap->md_ents[i].me_type || end <= direct_end) {
+                        continue;
+                }
+#ifndef __PAE__
+                /* without PAE nothing past 4gb can be mapped */
+                if (base >= 0x100000000ULL) {
+                        continue;
+                }
+                end = MIN(end, 0x100000000ULL - PAGE_SIZE);
+#endif
+                highmem_add_range(MAX(base, direct_end), end);
+        }
+}
@@ -0,0 +1,88 @@
+#include "types.h"
+#include "kernel.h"
+#include "config.h"
+
+#include "mm/page.h"
+#include "mm/pagetable.h"
+#include "mm/tlb.h"
+
+#include "util/debug.h"
+
+void
+tlb_gather_init(tlb_gather_t *tg, pagedir_t *pd)
+{
+        KASSERT(NULL != tg && NULL != pd);
+
+        tg->tg_pd = pd;
+        tg->tg_npages = 0;
+        tg->tg_nranges = 0;
+        tg->tg_ntables = 0;
+}
+
+void
+tlb_gather_range(tlb_gather_t *tg, uintptr_t vlow, uintptr_t vhigh)
+{
+        KASSERT(PAGE_ALIGNED(vlow) && PAGE_ALIGNED(vhigh));
+        KASSERT(vlow < vhigh);
+
+        tg->tg_npages += (vhigh - vlow) >> PAGE_SHIFT;
+        if (tg->tg_npages > TLB_FLUSH_ALL_THRESHOLD) {
+                /* We are going to reload cr3 anyway, the ranges no
+                 * longer matter */
+                return;
+        }
+
+        /* Unmaps usually walk upwards, so try to extend the last range */
+        if (0 < tg->tg_nranges && tg->tg_end[tg->tg_nranges - 1] == vlow) {
+                tg->tg_end[tg->tg_nranges - 1] = vhigh;
+        } else if (TLB_GATHER_NRANGES > tg->tg_nranges) {
+                tg->tg_start[tg->tg_nranges] = vlow;
+                tg->tg_end[tg->tg_nranges] = vhigh;
+                ++tg->tg_nranges;
+        } else {
+                /* Out of room to remember ranges, fall back to a
+                 * full flush */
+                tg->tg_npages = TLB_FLUSH_ALL_THRESHOLD + 1;
+        }
+}
+
+void
+tlb_gather_table(tlb_gather_t *tg, void *pt)
+{
+        KASSERT(PAGE_ALIGNED(pt));
+
+        if (TLB_GATHER_NTABLES == tg->tg_ntables) {
+                tlb_gather_finish(tg);
+        }
+        tg->tg_tables[tg->tg_ntables++] = pt;
+}
+
+void
+tlb_gather_finish(tlb_gather_t *tg)
+{
+        uint32_t i;
+
+        if (tg->tg_pd == pt_get()) {
+                if (tg->tg_npages > TLB_FLUSH_ALL_THRESHOLD) {
+                        tlb_flush_all();
+                } else {
+                        for (i = 0; i < tg->tg_nranges; ++i) {
+                                tlb_flush_range(tg->tg_start[i],
+                                                (tg->tg_end[i] - tg->tg_start[i]) >> PAGE_SHIFT);
+                        }
+                }
+        }
+
+        /* Only now that no translation can refer to them is it safe to
+         * reuse the page tables */
+        for (i = 0; i < tg->tg_ntables; ++i) {
+                page_free(tg->tg_tables[i]);
+        }
+
+        dbg(DBG_PGTBL, "gather on pagedir %p: %u pages, %u ranges, %u page tables\n",
+            tg->tg_pd, tg->tg_npages, tg->tg_nranges, tg->tg_ntables);
+
+        tg->tg_npages = 0;
+        tg->tg_nranges = 0;
+        tg->tg_ntables = 0;
+}
@@ -7,6 +7,7 @@
 
 #include "proc/proc.h"
 #include "proc/kthread.h"
+#include "proc/sched.h"
 
 #include "mm/mm.h"
 #include "mm/mman.h"
@@ -43,6 +44,65 @@ fork_setup_stack(const regs_t *regs, void *kstack)
 }
 
 
+/*
+ * Whether the child and the parent each need a new shadow object on
+ * top of the area's object when forking, so that their writes to the
+ * area stay private. Shared areas are shared, and so are private areas
+ * which neither side can ever write (there is no mprotect(2), so an
+ * area mapped without PROT_WRITE never gains it): those are mostly
+ * program text and read-only data, and shadowing them on every fork
+ * would only make the chain under them longer to search.
+ */
+static int
+fork_needs_shadow(vmarea_t *vma)
+{
+        return (MAP_PRIVATE & vma->vma_flags) && (PROT_WRITE & vma->vma_prot);
+}
+
+/*
+ * Gives the new process p the current process's open files, working
+ * directory and break.
+ */
+static void
+fork_copy_proc(proc_t *p)
+{
+        int fd;
+
+        for (fd = 0; fd < NFILES; fd++) {
+                if (NULL != (p->p_files[fd] = curproc->p_files[fd])) {
+                        fref(p->p_files[fd]);
+                }
+        }
+        if (NULL != (p->p_cwd = curproc->p_cwd)) {
+                vref(p->p_cwd);
+        }
+        p->p_brk = curproc->p_brk;
+        p->p_start_brk = curproc->p_start_brk;
+        p->p_rsslimit = curproc->p_rsslimit;
+        p->p_nice = curproc->p_nice;
+}
+
+/*
+ * Makes thr, a clone of the current thread, the thread of the new
+ * process p, starting in userland where the current thread made the
+ * system call described by regs, with the system call returning 0.
+ */
+static void
+fork_setup_thread(kthread_t *thr, proc_t *p, const regs_t *regs)
+{
+        regs_t childregs;
+
+        memcpy(&childregs, regs, sizeof(regs_t));
+        childregs.r_eax = 0;
+
+        thr->kt_proc = p;
+        list_insert_tail(&p->p_threads, &thr->kt_plink);
+        thr->kt_ctx.c_pdptr = p->p_pagedir;
+        thr->kt_ctx.c_esp = fork_setup_stack(&childregs, thr->kt_kstack);
+        thr->kt_ctx.c_ebp = thr->kt_ctx.c_esp;
+        thr->kt_ctx.c_eip = (uint32_t) userland_entry;
+}
+
 /*
  * The implementation of fork(2). Once this works,
  * you're practically home free. This is what the
@@ -52,6 +112,130 @@ fork_setup_stack(const regs_t *regs, void *kstack)
 int
 do_fork(struct regs *regs)
 {
-        NOT_YET_IMPLEMENTED("VM: do_fork");
-        return 0;
+        proc_t *child;
+        kthread_t *thr;
+        vmmap_t *map;
+        vmarea_t *vma, *cvma;
+        list_link_t *clink;
+
+        KASSERT(NULL != regs);
+        KASSERT(NULL != curproc);
+        KASSERT(PROC_RUNNING == curproc->p_state);
+
+        if (NULL == (map = vmmap_clone(curproc->p_vmmap))) {
+                return -ENOMEM;
+        }
+
+        /* vmmap_clone keeps the areas in the same order */
+        clink = map->vmm_list.l_next;
+        list_iterate_begin(&curproc->p_vmmap->vmm_list, vma, vmarea_t, vma_plink) {
+                mmobj_t *o = vma->vma_obj;
+                cvma = list_item(clink, vmarea_t, vma_plink);
+                clink = clink->l_next;
+
+                if (fork_needs_shadow(vma)) {
+                        mmobj_t *pshadow, *cshadow;
+                        if (NULL == (pshadow = shadow_create_over(o))) {
+                                goto nomem;
+                        }
+                        if (NULL == (cshadow = shadow_create_over(o))) {
+                                pshadow->mmo_ops->put(pshadow);
+                                goto nomem;
+                        }
+                        /* o keeps the reference vma had, now held by pshadow */
+                        vma->vma_obj = pshadow;
+                        o->mmo_ops->put(o);
+                        cvma->vma_obj = cshadow;
+
+                        /* Writes from now on must fault so they go to the
+                         * new top object */
+                        pt_unmap_range(curproc->p_pagedir, (uintptr_t) PN_TO_ADDR(vma->vma_start),
+                                       (uintptr_t) PN_TO_ADDR(vma->vma_end));
+                        vmarea_recount(vma);
+                } else {
+                        o->mmo_ops->ref(o);
+                        cvma->vma_obj = o;
+                }
+                list_insert_tail(mmobj_bottom_vmas(o), &cvma->vma_olink);
+        } list_iterate_end();
+
+        if (NULL == (thr = kthread_clone(curthr))) {
+                goto nomem;
+        }
+        if (NULL == (child = proc_create(curproc->p_comm))) {
+                kthread_destroy(thr);
+                goto nomem;
+        }
+        fork_copy_proc(child);
+
+        vmmap_destroy(child->p_vmmap);
+        child->p_vmmap = map;
+        map->vmm_proc = child;
+
+        fork_setup_thread(thr, child, regs);
+        sched_make_runnable(thr);
+
+        return child->p_pid;
+
+nomem:
+        /* The areas of the parent which already got a new shadow
+         * object are still correct, they just have a longer chain */
+        vmmap_destroy(map);
+        return -ENOMEM;
+}
+
+/*
+ * vfork(2) skips everything fork(2) does to give the child a copy of
+ * the address space, which is wasted when the child is only going to
+ * exec. The child runs in the parent's vmmap and page directory until
+ * it calls vfork_release(), on exec or exit, and until then the
+ * parent sleeps so the two never run in the address space at once.
+ */
+int
+do_vfork(struct regs *regs)
+{
+        proc_t *child;
+        kthread_t *thr;
+
+        KASSERT(NULL != regs);
+
+        if (NULL == (thr = kthread_clone(curthr))) {
+                return -ENOMEM;
+        }
+        if (NULL == (child = proc_create(curproc->p_comm))) {
+                kthread_destroy(thr);
+                return -ENOMEM;
+        }
+        fork_copy_proc(child);
+
+        vmmap_destroy(child->p_vmmap);
+        child->p_vmmap = curproc->p_vmmap;
+        child->p_vfork_pagedir = child->p_pagedir;
+        child->p_pagedir = curproc->p_pagedir;
+
+        fork_setup_thread(thr, child, regs);
+        sched_make_runnable(thr);
+
+        while (NULL != child->p_vfork_pagedir) {
+                sched_sleep_on(&curproc->p_wait);
+        }
+        return child->p_pid;
+}
+
+void
+vfork_release()
+{
+        proc_t *p = curproc;
+
+        if (NULL == p->p_vfork_pagedir) {
+                return;
+        }
+        /* Nothing of the address space is ours to tear down */
+        p->p_vmmap = NULL;
+        p->p_pagedir = p->p_vfork_pagedir;
+        p->p_vfork_pagedir = NULL;
+        curthr->kt_ctx.c_pdptr = p->p_pagedir;
+        pt_set(p->p_pagedir);
+
+        sched_broadcast_on(&p->p_pproc->p_wait);
 }
@@ -79,7 +79,6 @@ kthread_create(struct proc *p, kthread_func_t func, long arg1, void *arg2)
 	/*NOT_YET_IMPLEMENTED("PROCS: kthread_create");*/
 	KASSERT(NULL != p); /* should have associated process */
 	dbg_print("kthread.c:kthread_create: (precondition)The process for which the thread is created is not NULL\n");
-	kthread_init();
 	kthread_t* new_thread = slab_obj_alloc(kthread_allocator);
 	memset(new_thread,0,sizeof(kthread_t));
 	new_thread->kt_kstack = alloc_stack();
@@ -125,13 +124,14 @@ kthread_cancel(kthread_t *kthr, void *retval)
 	KASSERT(NULL != kthr);
 	dbg_print("kthread.c:kthread_cancel: (precondition) Cancelling thread is not NULL\n");
 	if (kthr == curthr) {
-		kthr->kt_retval = 0; /* normal exit */
+		kthr->kt_retval = retval;
 		kthread_exit(kthr->kt_retval);
 		kthr->kt_state = KT_EXITED;
 	} else {
-		if (kthr->kt_state == KT_SLEEP_CANCELLABLE) {
-			kthr->kt_cancelled = 1;
-		}
+		kthr->kt_retval = retval;
+		/* Marks it cancelled and wakes it if it is in a
+		 * cancellable sleep, it exits on its way back out */
+		sched_cancel(kthr);
 	}
 }
 
@@ -172,8 +172,31 @@ kthread_exit(void *retval)
 kthread_t *
 kthread_clone(kthread_t *thr)
 {
-        NOT_YET_IMPLEMENTED("VM: kthread_clone");
-        return NULL;
+        kthread_t *new_thread;
+
+        KASSERT(KT_RUN == thr->kt_state);
+        if (NULL == (new_thread = slab_obj_alloc(kthread_allocator))) {
+                return NULL;
+        }
+        memset(new_thread, 0, sizeof(kthread_t));
+        if (NULL == (new_thread->kt_kstack = alloc_stack())) {
+                slab_obj_free(kthread_allocator, new_thread);
+                return NULL;
+        }
+        new_thread->kt_state = KT_RUN;
+
+        /* The caller decides where the new thread starts running and
+         * in which process, only the stack is set up here */
+        new_thread->kt_ctx.c_kstack = (uintptr_t) new_thread->kt_kstack;
+        new_thread->kt_ctx.c_kstacksz = DEFAULT_STACK_SIZE;
+        new_thread->kt_ctx.c_pdptr = thr->kt_ctx.c_pdptr;
+
+        list_link_init(&new_thread->kt_qlink);
+        list_link_init(&new_thread->kt_plink);
+#ifdef __MTP__
+        sched_queue_init(&new_thread->kt_joinq);
+#endif
+        return new_thread;
 }
 
 /*
@@ -20,6 +20,7 @@
 #include "mm/mman.h"
 
 #include "vm/vmmap.h"
+#include "vm/vmreapd.h"
 
 #include "fs/vfs.h"
 #include "fs/vfs_syscall.h"
@@ -154,6 +155,21 @@ proc_cleanup(int status)
 	proc_t *child = NULL;
 	list_t parent_waitlist;
 
+        /* A vfork child which never exec'd hands its parent back the
+         * address space before anything else */
+        vfork_release();
+
+        /* Hand the address space to vmreapd rather than tearing it
+         * down here, so that our parent can reap us sooner. Nothing
+         * runs in it again, so its page table entries are left alone
+         * until the whole page directory goes in do_waitpid. */
+        if (NULL != p->p_vmmap) {
+                p->p_vmmap->vmm_proc = NULL;
+                vmreapd_defer(p->p_vmmap);
+                p->p_vmmap = NULL;
+                p->p_nresident = 0;
+                p->p_nswapped = 0;
+        }
 
 		if (!list_empty(&p->p_children)) {
 			if(p != proc_initproc) {
@@ -168,7 +184,7 @@ proc_cleanup(int status)
 			}
 		}
 	curproc->p_state = PROC_DEAD;
-	curproc->p_status = 0;
+	curproc->p_status = status;
 	int i = 0;
         
 	for(i=0;i<NFILES;i++)
@@ -201,7 +217,8 @@ proc_cleanup(int status)
  * Calling this on the current process is equivalent to calling
  * do_exit().
  *
- * In Weenix, this is only called from proc_kill_all.
+ * In Weenix, this is called from proc_kill_all and by the OOM killer
+ * in mm/pframe.c.
  */
 void
 proc_kill(proc_t *p, int status)
@@ -212,10 +229,9 @@ proc_kill(proc_t *p, int status)
 		do_exit(status);
 	} else {
 		kthread_t *kthr;
-		list_iterate_begin(&curproc->p_threads, kthr, kthread_t, kt_plink) {
+		list_iterate_begin(&p->p_threads, kthr, kthread_t, kt_plink) {
 			/*cancel each thread*/
-			kthread_cancel(kthr, kthr->kt_retval);
-			sched_make_runnable(kthr);
+			kthread_cancel(kthr, (void *) status);
 		}list_iterate_end();
 	}
 }
@@ -376,7 +392,7 @@ do_exit(int status)
 
 		kthread_cancel(kthr,kthr->kt_retval);
 	}list_iterate_end();*/
-	kthread_cancel(curthr,0);
+	kthread_cancel(curthr, (void *) status);
 
 	/*proc_cleanup(curproc->p_status);*/
 }
@@ -420,6 +436,7 @@ proc_info(const void *arg, char *buf, size_t osize)
 
         iprintf(&buf, &size, "status:       %i\n", p->p_status);
         iprintf(&buf, &size, "state:        %i\n", p->p_state);
+        iprintf(&buf, &size, "nice:         %i\n", p->p_nice);
 
 #ifdef __VFS__
 #ifdef __GETCWD__
@@ -436,6 +453,16 @@ proc_info(const void *arg, char *buf, size_t osize)
 #ifdef __VM__
         iprintf(&buf, &size, "start brk:    0x%p\n", p->p_start_brk);
         iprintf(&buf, &size, "brk:          0x%p\n", p->p_brk);
+        iprintf(&buf, &size, "page faults:  %u\n", p->p_nfaults);
+        iprintf(&buf, &size, "faultaround:  %u\n", p->p_nfaultaround);
+        pagefault_stats_print(&p->p_faultstats, &buf, &size);
+        iprintf(&buf, &size, "resident:     %u pages\n", p->p_nresident);
+        iprintf(&buf, &size, "swapped:      %u pages\n", p->p_nswapped);
+        if (0 != p->p_rsslimit) {
+                iprintf(&buf, &size, "rss limit:    %u pages\n", p->p_rsslimit);
+        } else {
+                iprintf(&buf, &size, "rss limit:    -\n");
+        }
 #endif
 
         return size;
@@ -1,20 +1,61 @@
 #include "globals.h"
 #include "errno.h"
 
+#include "config.h"
+
 #include "main/interrupt.h"
+#include "main/cpuid.h"
 
 #include "proc/sched.h"
 #include "proc/kthread.h"
+#include "proc/proc.h"
 
 #include "util/init.h"
 #include "util/debug.h"
+#include "util/time.h"
+#include "util/timer.h"
+
+/*
+ * The run queue is a multi-level feedback queue. There is one queue per
+ * priority and a bitmap of the queues which are not empty, so picking
+ * the next thread is finding the lowest set bit. A thread's priority is
+ * where its process's nice value puts it plus its feedback level. A
+ * thread drops a level each time it has used up the slice of its level,
+ * which doubles at each level down, and rises SCHED_WAKE_BOOST levels
+ * when it is woken from a sleep, so threads which mostly wait for the
+ * disk or the terminal run ahead of those which mostly compute. Every
+ * SCHED_BOOST_KCYCLES all runnable threads go back to the top level so
+ * that none of them starves.
+ *
+ * The clock (see sched_tick()) asks for the current thread to be
+ * preempted once it has run SCHED_QUANTUM_TICKS and another thread at
+ * its priority or better is waiting, or as soon as a thread which
+ * should run before it is woken. Threads give way at the next
+ * preemption point, sched_preempt_point(): on the way back to userland
+ * from an interrupt, and in long loops in the kernel.
+ */
+static ktqueue_t kt_runq[SCHED_NPRIO];
+static uint32_t kt_runq_bitmap;         /* bit i set if kt_runq[i] is not empty */
+
+static uint64_t sched_switched;         /* rdtsc() when curthr started running */
+static uint64_t sched_boosted;          /* rdtsc() at the last boost */
+static int sched_idle;                  /* waiting for an interrupt in sched_switch */
+static int sched_slice;                 /* clock ticks since curthr started running */
+static int sched_resched;               /* curthr should give way at the next
+                                         * preemption point */
 
-static ktqueue_t kt_runq;
+#define SCHED_ON_RUNQ(thr) \
+        ((thr)->kt_wchan >= &kt_runq[0] && (thr)->kt_wchan < &kt_runq[SCHED_NPRIO])
 
 static __attribute__((unused)) void
 sched_init(void)
 {
-        sched_queue_init(&kt_runq);
+        int i;
+        for (i = 0; i < SCHED_NPRIO; ++i) {
+                sched_queue_init(&kt_runq[i]);
+        }
+        kt_runq_bitmap = 0;
+        sched_switched = sched_boosted = rdtsc();
 }
 init_func(sched_init);
 
@@ -76,6 +117,134 @@ ktqueue_remove(ktqueue_t *q, kthread_t *thr)
         q->tq_size--;
 }
 
+/*** PRIVATE RUN QUEUE FUNCTIONS ***/
+/*
+ * The run queue thr goes on: nice values spread over the priorities
+ * above the last SCHED_NLEVELS, and the level is added to that.
+ */
+static int
+_sched_prio(kthread_t *thr)
+{
+        int nice = thr->kt_proc->p_nice;
+
+        KASSERT(NICE_MIN <= nice && nice <= NICE_MAX);
+        KASSERT(0 <= thr->kt_level && thr->kt_level < SCHED_NLEVELS);
+        return (nice - NICE_MIN) * (SCHED_NPRIO - SCHED_NLEVELS) / (NICE_MAX - NICE_MIN)
+               + thr->kt_level;
+}
+
+/* Must be called with interrupts masked */
+static void
+_sched_runq_enqueue(kthread_t *thr)
+{
+        int prio = _sched_prio(thr);
+
+        ktqueue_enqueue(&kt_runq[prio], thr);
+        kt_runq_bitmap |= 1U << prio;
+}
+
+/* Must be called with interrupts masked */
+static kthread_t *
+_sched_runq_dequeue(void)
+{
+        kthread_t *thr;
+        int prio;
+
+        if (0 == kt_runq_bitmap)
+                return NULL;
+
+        prio = __builtin_ctz(kt_runq_bitmap);
+        thr = ktqueue_dequeue(&kt_runq[prio]);
+        KASSERT(NULL != thr);
+        if (sched_queue_empty(&kt_runq[prio]))
+                kt_runq_bitmap &= ~(1U << prio);
+        return thr;
+}
+
+/*
+ * Charges curthr for the time since it started running or was last
+ * charged, dropping it a level each time it has used up its slice.
+ */
+static void
+_sched_charge(void)
+{
+        uint64_t now = rdtsc();
+
+        curthr->kt_ran += now - sched_switched;
+        sched_switched = now;
+
+        while (curthr->kt_level < SCHED_NLEVELS - 1
+               && curthr->kt_ran >= ((uint64_t)SCHED_SLICE_KCYCLES * 1000) << curthr->kt_level) {
+                curthr->kt_ran -= ((uint64_t)SCHED_SLICE_KCYCLES * 1000) << curthr->kt_level;
+                curthr->kt_level++;
+        }
+}
+
+/*
+ * Puts every runnable thread, and curthr, back on the top level if it
+ * has been SCHED_BOOST_KCYCLES since the last time. Must be called with
+ * interrupts masked.
+ */
+static void
+_sched_boost(void)
+{
+        ktqueue_t boosted;
+        kthread_t *thr;
+        int prio;
+
+        if (rdtsc() - sched_boosted < (uint64_t)SCHED_BOOST_KCYCLES * 1000)
+                return;
+        sched_boosted = rdtsc();
+
+        sched_queue_init(&boosted);
+        for (prio = 0; prio < SCHED_NPRIO; ++prio) {
+                while (NULL != (thr = ktqueue_dequeue(&kt_runq[prio]))) {
+                        ktqueue_enqueue(&boosted, thr);
+                }
+        }
+        kt_runq_bitmap = 0;
+
+        while (NULL != (thr = ktqueue_dequeue(&boosted))) {
+                thr->kt_level = 0;
+                thr->kt_ran = 0;
+                _sched_runq_enqueue(thr);
+        }
+        curthr->kt_level = 0;
+        curthr->kt_ran = 0;
+}
+
+/* Raises a thread which is being woken from a sleep */
+static void
+_sched_wake_boost(kthread_t *thr)
+{
+        thr->kt_level = MAX(0, thr->kt_level - SCHED_WAKE_BOOST);
+        thr->kt_ran = 0;
+}
+
+/*** PREEMPTION ***/
+void
+sched_tick(void)
+{
+        if (NULL == curthr || sched_idle)
+                return;
+
+        _sched_charge();
+        if (++sched_slice >= SCHED_QUANTUM_TICKS && 0 != kt_runq_bitmap
+            && __builtin_ctz(kt_runq_bitmap) <= _sched_prio(curthr)) {
+                sched_resched = 1;
+        }
+}
+
+void
+sched_preempt_point(void)
+{
+        if (!sched_resched || KT_RUN != curthr->kt_state)
+                return;
+
+        sched_make_runnable(curthr);
+        sched_switch();
+}
+
 /*** PUBLIC KTQUEUE MANIPULATION FUNCTIONS ***/
 void
 sched_queue_init(ktqueue_t *q)
@@ -121,11 +290,11 @@ sched_cancellable_sleep_on(ktqueue_t *q)
 	/*NOT_YET_IMPLEMENTED("PROCS: sched_cancellable_sleep_on"); */
 	/*curthr->kt_state = KT_SLEEP_CANCELLABLE;*/
 
-	curthr->kt_state = KT_SLEEP_CANCELLABLE;
 	if (curthr->kt_cancelled) {
 		/*kthread_exit(curthr->kt_retval);*/
 		return -EINTR;
 	}
+	curthr->kt_state = KT_SLEEP_CANCELLABLE;
 	ktqueue_enqueue(q, curthr);
 	sched_switch();
 	/*if (curthr->kt_cancelled)
@@ -136,6 +305,73 @@ sched_cancellable_sleep_on(ktqueue_t *q)
 	return 0;
 }
 
+/*
+ * The timeout of a timed sleep. st_thr is only woken if it still
+ * sleeps, it may have been woken some other way and not run yet.
+ */
+typedef struct sched_timeout {
+        kthread_t      *st_thr;
+        int             st_expired;
+} sched_timeout_t;
+
+static void
+_sched_timeout(void *arg)
+{
+        sched_timeout_t *st = (sched_timeout_t *)arg;
+        kthread_t *thr = st->st_thr;
+
+        if ((KT_SLEEP == thr->kt_state || KT_SLEEP_CANCELLABLE == thr->kt_state)
+            && NULL != thr->kt_wchan) {
+                st->st_expired = 1;
+                ktqueue_remove(thr->kt_wchan, thr);
+                _sched_wake_boost(thr);
+                sched_make_runnable(thr);
+        }
+}
+
+static int
+_sched_sleep_on_timeout(ktqueue_t *q, uint32_t ticks, int state)
+{
+        sched_timeout_t st;
+        ktimer_t timer;
+        uint8_t ipl;
+
+        st.st_thr = curthr;
+        st.st_expired = 0;
+        ktimer_init(&timer, _sched_timeout, &st);
+
+        /* sched_switch() passes the IPL on to the next thread, so it is
+         * only held high until the thread is on both queues */
+        ipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+        curthr->kt_state = state;
+        ktqueue_enqueue(q, curthr);
+        ktimer_add(&timer, ticks);
+        intr_setipl(ipl);
+
+        sched_switch();
+        ktimer_del(&timer);
+
+        return st.st_expired ? -ETIMEDOUT : 0;
+}
+
+int
+sched_sleep_on_timeout(ktqueue_t *q, uint32_t ticks)
+{
+        return _sched_sleep_on_timeout(q, ticks, KT_SLEEP);
+}
+
+int
+sched_cancellable_sleep_on_timeout(ktqueue_t *q, uint32_t ticks)
+{
+        int ret;
+
+        if (curthr->kt_cancelled)
+                return -EINTR;
+        ret = _sched_sleep_on_timeout(q, ticks, KT_SLEEP_CANCELLABLE);
+        return curthr->kt_cancelled ? -EINTR : ret;
+}
+
 kthread_t *
 sched_wakeup_on(ktqueue_t *q)
 {
@@ -145,6 +381,7 @@ sched_wakeup_on(ktqueue_t *q)
 		KASSERT((thr->kt_state == KT_SLEEP) || (thr->kt_state == KT_SLEEP_CANCELLABLE));
 		dbg_print("sched.c: sched_wakeup_on: Thread is either in sleep or sleep cancellable state before it is made runnable\n");
 		thr->kt_state = KT_RUN;
+		_sched_wake_boost(thr);
 		sched_make_runnable(thr);
 	}
 	return thr;
@@ -179,6 +416,7 @@ sched_cancel(struct kthread *kthr)
 		 kthr->kt_state = KT_RUN;
 		ktqueue_remove(kthr->kt_wchan, kthr);
 		/*sched_switch();*/
+		_sched_wake_boost(kthr);
 		sched_make_runnable(kthr);
         }
 }
@@ -228,16 +466,29 @@ sched_switch(void)
 	        intr_setipl(IPL_HIGH);
 	        kthread_t *prevthread = curthr;
 	        kthread_t *curthread = NULL;
+	        if (!SCHED_ON_RUNQ(curthr)) {
+	        	/* a yielding thread was charged when it was queued */
+	        	_sched_charge();
+	        }
+	        _sched_boost();
 	        /*if(kt_runq.tq_size != 0) {*/
-	        	curthread = ktqueue_dequeue(&kt_runq);
+	        	curthread = _sched_runq_dequeue();
 	        /*}*/
 	        while(curthread == NULL)
 	        {
+	        	sched_idle = 1;
+	        	time_tickless_enter();
 	        	intr_setipl(IPL_LOW);
 	        	intr_wait();
 	        	intr_setipl(IPL_HIGH);
-	        	curthread = ktqueue_dequeue(&kt_runq);
+	        	time_tickless_exit();
+	        	sched_idle = 0;
+	        	curthread = _sched_runq_dequeue();
 	        }
+	        /* time spent waiting for an interrupt is nobody's */
+	        sched_switched = rdtsc();
+	        sched_slice = 0;
+	        sched_resched = 0;
 	        intr_setipl(original_ipl);
 	        curproc=curthread->kt_proc;
 	        curthr = curthread;
@@ -262,12 +513,21 @@ void
 sched_make_runnable(kthread_t *thr)
 {
     /*NOT_YET_IMPLEMENTED("PROCS: sched_make_runnable");*/
-	KASSERT(&kt_runq != thr->kt_wchan);
+	KASSERT(!SCHED_ON_RUNQ(thr));
 	dbg_print("sched.c: sched_make_runnable: (pre-condition)Thread is not blocked\n");
 	uint8_t original_ipl = intr_getipl();
     intr_setipl(IPL_HIGH);
     thr->kt_state = KT_RUN;
-    ktqueue_enqueue(&kt_runq,thr);
+    if (thr == curthr && !sched_idle) {
+	    /* charge a yielding thread before picking its queue */
+	    _sched_charge();
+    }
+    _sched_runq_enqueue(thr);
+    if (thr != curthr && NULL != curthr && !sched_idle
+        && _sched_prio(thr) < _sched_prio(curthr)) {
+	    /* a woken thread which should run first preempts curthr */
+	    sched_resched = 1;
+    }
 	/*sched_switch();*/
     intr_setipl(original_ipl);
 }
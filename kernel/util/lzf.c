@@ -0,0 +1,153 @@
+#include "types.h"
+#include "kernel.h"
+
+#include "util/string.h"
+#include "util/lzf.h"
+
+/*
+ * A small LZ77 compressor in the format of LZF, meant for pages of
+ * memory. It is fast rather than thorough: a match is only looked for
+ * at the last position with the same three bytes. The compressed data
+ * is a sequence of runs, each starting with a control byte:
+ *
+ *   000LLLLL                     L + 1 literal bytes follow
+ *   LLLooooo oooooooo            copy L + 2 bytes from o + 1 bytes back
+ *   111ooooo LLLLLLLL oooooooo   copy L + 9 bytes from o + 1 bytes back
+ */
+
+#define LZF_HASH_BITS   12
+#define LZF_MAX_LIT     (1 << 5)
+#define LZF_MAX_OFF     (1 << 13)
+#define LZF_MAX_REF     ((1 << 8) + (1 << 3))
+
+#define lzf_hash(p) \
+        ((((uint32_t)(p)[0] << 16 | (uint32_t)(p)[1] << 8 | (p)[2]) * 2654435761U) \
+         >> (32 - LZF_HASH_BITS))
+
+/* Last position seen for each hash of three bytes. Compressing never
+ * blocks, so one table does for everyone. */
+static const uint8_t *lzf_htab[1 << LZF_HASH_BITS];
+
+size_t
+lzf_compress(const void *in, size_t inlen, void *out, size_t outlen)
+{
+        const uint8_t *ip = (const uint8_t *) in;
+        const uint8_t *iend = ip + inlen;
+        uint8_t *op = (uint8_t *) out;
+        uint8_t *oend = op + outlen;
+        uint8_t *ctl;
+        size_t nlit = 0;
+
+        if (0 == inlen || 0 == outlen) {
+                return 0;
+        }
+        memset(lzf_htab, 0, sizeof(lzf_htab));
+
+        /* The control byte of a literal run is only filled in once the
+         * run ends, and taken back if the run turns out to be empty.
+         * Anything written after it checks that it fits. */
+        ctl = op++;
+        while (ip < iend) {
+                if (ip + 2 < iend) {
+                        uint32_t h = lzf_hash(ip);
+                        const uint8_t *ref = lzf_htab[h];
+                        lzf_htab[h] = ip;
+
+                        if (NULL != ref && (size_t)(ip - ref) <= LZF_MAX_OFF
+                            && ref[0] == ip[0] && ref[1] == ip[1] && ref[2] == ip[2]) {
+                                size_t off = ip - ref - 1;
+                                size_t len = 3;
+                                size_t maxlen = MIN((size_t)(iend - ip), LZF_MAX_REF);
+                                while (len < maxlen && ref[len] == ip[len]) {
+                                        ++len;
+                                }
+
+                                /* Close the literal run, or take back its
+                                 * control byte if it is empty */
+                                if (0 < nlit) {
+                                        *ctl = nlit - 1;
+                                } else {
+                                        --op;
+                                }
+                                if (op + (len - 2 < 7 ? 2 : 3) > oend) {
+                                        return 0;
+                                }
+                                if (len - 2 < 7) {
+                                        *op++ = (len - 2) << 5 | off >> 8;
+                                } else {
+                                        *op++ = 7 << 5 | off >> 8;
+                                        *op++ = len - 9;
+                                }
+                                *op++ = off;
+                                ip += len;
+
+                                ctl = op++;
+                                nlit = 0;
+                                continue;
+                        }
+                }
+
+                if (op >= oend) {
+                        return 0;
+                }
+                *op++ = *ip++;
+                if (LZF_MAX_LIT == ++nlit) {
+                        *ctl = nlit - 1;
+                        ctl = op++;
+                        nlit = 0;
+                }
+        }
+
+        if (0 < nlit) {
+                *ctl = nlit - 1;
+        } else {
+                --op;
+        }
+        return op - (uint8_t *) out;
+}
+
+size_t
+lzf_decompress(const void *in, size_t inlen, void *out, size_t outlen)
+{
+        const uint8_t *ip = (const uint8_t *) in;
+        const uint8_t *iend = ip + inlen;
+        uint8_t *op = (uint8_t *) out;
+        uint8_t *oend = op + outlen;
+
+        while (ip < iend) {
+                uint32_t ctl = *ip++;
+
+                if (ctl < LZF_MAX_LIT) {
+                        ++ctl;
+                        if (op + ctl > oend || ip + ctl > iend) {
+                                return 0;
+                        }
+                        memcpy(op, ip, ctl);
+                        op += ctl;
+                        ip += ctl;
+                } else {
+                        uint32_t len = ctl >> 5;
+                        const uint8_t *ref;
+
+                        if (7 == len) {
+                                if (ip >= iend) {
+                                        return 0;
+                                }
+                                len += *ip++;
+                        }
+                        if (ip >= iend) {
+                                return 0;
+                        }
+                        ref = op - ((ctl & 0x1f) << 8) - *ip++ - 1;
+                        len += 2;
+                        if (op + len > oend || ref < (uint8_t *) out) {
+                                return 0;
+                        }
+                        /* Byte by byte, the two may overlap */
+                        while (0 < len--) {
+                                *op++ = *ref++;
+                        }
+                }
+        }
+        return op - (uint8_t *) out;
+}
@@ -1,4 +1,5 @@
 #include "globals.h"
+#include "config.h"
 
 #include "main/interrupt.h"
 #include "main/apic.h"
@@ -6,9 +7,96 @@
 
 #include "util/debug.h"
 #include "util/init.h"
+#include "util/time.h"
+#include "util/timer.h"
 
 #include "proc/sched.h"
 #include "proc/kthread.h"
 
-#ifdef __UPREEMPT__
-#endif
+/* PIT counts in a tick, and the most ticks a one-shot can wait for */
+#define TIME_PIT_COUNTS         (PIT_CLOCK_HZ / TIME_HZ)
+#define TIME_ONESHOT_MAX        (0xffff / TIME_PIT_COUNTS)
+
+static volatile uint32_t time_nticks;   /* clock ticks so far */
+static uint32_t time_oneshot;           /* ticks the PIT was asked to wait
+                                         * for in one go, 0 when it is
+                                         * ticking periodically */
+
+uint32_t
+time_ticks(void)
+{
+        return time_nticks;
+}
+
+static void
+time_intr(regs_t *regs)
+{
+        if (0 != time_oneshot) {
+                /* the idle wait ran its full length */
+                time_nticks += time_oneshot - 1;
+                time_oneshot = 0;
+                pit_periodic(TIME_HZ);
+        }
+        time_nticks++;
+        ktimer_run(time_nticks);
+        sched_tick();
+}
+
+void
+time_tickless_enter(void)
+{
+        uint32_t next = ktimer_next();
+
+        KASSERT(IPL_HIGH == intr_getipl());
+
+        /* a one-shot which went off as the last wait ended is still to
+         * be taken, next counts from the tick after this one */
+        if (0 != time_oneshot || 0 == next)
+                return;
+        time_oneshot = (KTIMER_NONE == next) ? TIME_ONESHOT_MAX : MIN(next + 1, TIME_ONESHOT_MAX);
+        if (1 >= time_oneshot) {
+                time_oneshot = 0;
+                return;
+        }
+        pit_oneshot(time_oneshot * TIME_PIT_COUNTS);
+}
+
+void
+time_tickless_exit(void)
+{
+        uint32_t left;
+
+        KASSERT(IPL_HIGH == intr_getipl());
+
+        if (0 == time_oneshot)
+                return;
+        if (0 == (left = pit_remaining())) {
+                /* the interrupt is pending and catches up when the IPL drops */
+                return;
+        }
+
+        /* Woken early by some other interrupt. The part of a tick which
+         * had passed is lost, and a one-shot which goes off as the PIT is
+         * put back to periodic is counted as a tick of its own. */
+        time_nticks += (time_oneshot * TIME_PIT_COUNTS - left) / TIME_PIT_COUNTS;
+        time_oneshot = 0;
+        pit_periodic(TIME_HZ);
+        ktimer_run(time_nticks);
+}
+
+/*
+ * Starts the clock. The PIT is used rather than the local APIC timer
+ * because its rate is known without calibrating it against something
+ * else.
+ */
+static __attribute__((unused)) void
+time_init(void)
+{
+        time_nticks = 0;
+        time_oneshot = 0;
+        intr_register(INTR_PIT, time_intr);
+        pit_starttimer(INTR_PIT, TIME_HZ);
+}
+init_func(time_init);
+init_depends(sched_init);
+init_depends(ktimer_wheel_init);
@@ -0,0 +1,175 @@
+#include "globals.h"
+
+#include "main/interrupt.h"
+
+#include "util/debug.h"
+#include "util/init.h"
+#include "util/list.h"
+#include "util/time.h"
+#include "util/timer.h"
+
+/*
+ * A hierarchical timer wheel. Level 0 has a slot for each of the next
+ * KTIMER_SLOTS ticks, level 1 a slot for each of the next KTIMER_SLOTS
+ * runs of KTIMER_SLOTS ticks, and so on. Adding and removing a timer
+ * is O(1). Whenever level 0 wraps around, the timers in the slot of
+ * level 1 for the run of ticks starting are put back on the wheel,
+ * which spreads them over level 0, and likewise for the higher levels.
+ * A timer is moved down at most KTIMER_LEVELS - 1 times.
+ *
+ * The wheel is modified from the clock interrupt, so everything else
+ * masks interrupts while it touches it.
+ */
+#define KTIMER_BITS     6
+#define KTIMER_SLOTS    (1 << KTIMER_BITS)
+#define KTIMER_LEVELS   4
+#if KTIMER_MAX != (1U << (KTIMER_BITS * KTIMER_LEVELS)) - 1
+#error "KTIMER_MAX does not match the size of the wheel"
+#endif
+
+#define KTIMER_SLOT(tick, level) \
+        (((tick) >> (KTIMER_BITS * (level))) & (KTIMER_SLOTS - 1))
+
+static list_t ktimer_wheel[KTIMER_LEVELS][KTIMER_SLOTS];
+static uint32_t ktimer_now;             /* the next tick to run */
+static uint32_t ktimer_npending;
+
+static __attribute__((unused)) void
+ktimer_wheel_init(void)
+{
+        int level, slot;
+
+        for (level = 0; level < KTIMER_LEVELS; ++level) {
+                for (slot = 0; slot < KTIMER_SLOTS; ++slot) {
+                        list_init(&ktimer_wheel[level][slot]);
+                }
+        }
+        ktimer_now = time_ticks() + 1;
+        ktimer_npending = 0;
+}
+init_func(ktimer_wheel_init);
+
+/* Puts a timer on the slot for its expiry relative to ktimer_now */
+static void
+_ktimer_insert(ktimer_t *t)
+{
+        int32_t delta = t->tm_expires - ktimer_now;
+        int level;
+
+        if (delta < 0) {
+                /* overdue, it goes off on the next tick run */
+                list_insert_tail(&ktimer_wheel[0][KTIMER_SLOT(ktimer_now, 0)], &t->tm_link);
+                return;
+        }
+        for (level = 0; level < KTIMER_LEVELS - 1; ++level) {
+                if ((uint32_t)delta < 1U << (KTIMER_BITS * (level + 1)))
+                        break;
+        }
+        list_insert_tail(&ktimer_wheel[level][KTIMER_SLOT(t->tm_expires, level)], &t->tm_link);
+}
+
+/* Moves the timers in level's slot for ktimer_now down the wheel */
+static void
+_ktimer_cascade(int level)
+{
+        list_t *slot = &ktimer_wheel[level][KTIMER_SLOT(ktimer_now, level)];
+        list_t moving;
+        ktimer_t *t;
+
+        if (0 == KTIMER_SLOT(ktimer_now, level) && level < KTIMER_LEVELS - 1) {
+                _ktimer_cascade(level + 1);
+        }
+
+        list_init(&moving);
+        while (!list_empty(slot)) {
+                t = list_head(slot, ktimer_t, tm_link);
+                list_remove(&t->tm_link);
+                list_insert_tail(&moving, &t->tm_link);
+        }
+        while (!list_empty(&moving)) {
+                t = list_head(&moving, ktimer_t, tm_link);
+                list_remove(&t->tm_link);
+                _ktimer_insert(t);
+        }
+}
+
+void
+ktimer_init(ktimer_t *t, void (*func)(void *arg), void *arg)
+{
+        list_link_init(&t->tm_link);
+        t->tm_expires = 0;
+        t->tm_func = func;
+        t->tm_arg = arg;
+}
+
+void
+ktimer_add(ktimer_t *t, uint32_t ticks)
+{
+        uint8_t ipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+
+        KASSERT(!list_link_is_linked(&t->tm_link));
+        t->tm_expires = time_ticks() + MIN(ticks, KTIMER_MAX);
+        _ktimer_insert(t);
+        ktimer_npending++;
+
+        intr_setipl(ipl);
+}
+
+int
+ktimer_del(ktimer_t *t)
+{
+        int pending;
+        uint8_t ipl = intr_getipl();
+        intr_setipl(IPL_HIGH);
+
+        if ((pending = list_link_is_linked(&t->tm_link))) {
+                list_remove(&t->tm_link);
+                ktimer_npending--;
+        }
+
+        intr_setipl(ipl);
+        return pending;
+}
+
+void
+ktimer_run(uint32_t now)
+{
+        list_t *slot;
+        ktimer_t *t;
+
+        while ((int32_t)(now - ktimer_now) >= 0) {
+                if (0 == KTIMER_SLOT(ktimer_now, 0)) {
+                        _ktimer_cascade(1);
+                }
+
+                slot = &ktimer_wheel[0][KTIMER_SLOT(ktimer_now, 0)];
+                while (!list_empty(slot)) {
+                        t = list_head(slot, ktimer_t, tm_link);
+                        list_remove(&t->tm_link);
+                        ktimer_npending--;
+                        t->tm_func(t->tm_arg);
+                }
+                ktimer_now++;
+        }
+}
+
+uint32_t
+ktimer_next(void)
+{
+        uint32_t i;
+
+        if (0 == ktimer_npending)
+                return KTIMER_NONE;
+
+        for (i = 0; i < KTIMER_SLOTS; ++i) {
+                /* either a timer goes off or the higher levels have to be
+                 * looked at */
+                if (0 == KTIMER_SLOT(ktimer_now + i, 0)
+                    || !list_empty(&ktimer_wheel[0][KTIMER_SLOT(ktimer_now + i, 0)])) {
+                        return i;
+                }
+        }
+        panic("ktimer_next: level 0 did not wrap around\n");
+        return KTIMER_NONE;
+}
@@ -10,11 +10,31 @@
 #include "mm/page.h"
 #include "mm/slab.h"
 #include "mm/tlb.h"
+#include "mm/pagetable.h"
+
+#include "vm/anon.h"
+#include "vm/swap.h"
+#include "vm/pagefault.h"
 
 int anon_count = 0; /* for debugging/verification purposes */
 
+/*
+ * An anonymous object as allocated by anon_create(). The mmobj must
+ * come first, everything outside this file only sees that part.
+ */
+typedef struct anon {
+        mmobj_t          an_mmobj;
+        list_t           an_swapped;  /* pages with a copy in swap (see vm/swap.c) */
+} anon_t;
+
+#define ANON(o) ((anon_t *)(o))
+
 static slab_allocator_t *anon_allocator;
 
+/* A page of zeroes which every never-written page of anonymous memory is
+ * mapped to, read-only, until it is first written (see vm/pagefault.c) */
+static paddr_t anon_zero_paddr;
+
 static void anon_ref(mmobj_t *o);
 static void anon_put(mmobj_t *o);
 static int anon_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf);
@@ -39,10 +59,21 @@ static mmobj_ops_t anon_mmobj_ops = {
 void
 anon_init()
 {
-       anon_allocator = slab_allocator_create("anonobj", sizeof(mmobj_t));
+       anon_allocator = slab_allocator_create("anonobj", sizeof(anon_t));
        KASSERT(NULL != anon_allocator);
        dbg(DBG_PRINT, "(GRADING3A 4.a)anon object is successfully created\n "); 
 /* NOT_YET_IMPLEMENTED("VM: anon_init");*/
+
+        void *zero = page_alloc();
+        KASSERT(NULL != zero);
+        memset(zero, 0, PAGE_SIZE);
+        anon_zero_paddr = pt_virt_to_phys((uintptr_t) zero);
+}
+
+paddr_t
+anon_zero_page(void)
+{
+        return anon_zero_paddr;
 }
 
 /*
@@ -61,6 +92,7 @@ anon_create()
 	 memset(anoncreate,0,sizeof(anoncreate));
 	 list_init(&anoncreate->mmo_respages);
          list_init(&anoncreate->mmo_un.mmo_vmas);
+         list_init(&ANON(anoncreate)->an_swapped);
 
          mmobj_init(anoncreate,&anon_mmobj_ops);        
          anoncreate->mmo_refcount++;
@@ -68,6 +100,18 @@ anon_create()
        return anoncreate;
 }
 
+int
+mmobj_is_anon(mmobj_t *o)
+{
+        return &anon_mmobj_ops == o->mmo_ops;
+}
+
+list_t *
+anon_swapped(mmobj_t *o)
+{
+        return &ANON(o)->an_swapped;
+}
+
 /* Implementation of mmobj entry points: */
 
 /*
@@ -92,34 +136,17 @@ anon_ref(mmobj_t *o)
 static void
 anon_put(mmobj_t *o)
 {
-    KASSERT(o && (0 < o->mmo_refcount) && (&anon_mmobj_ops == o->mmo_ops));        
-dbg(DBG_PRINT, "(GRADING3A 4.c)Reference count of the anon object is greater than zero\n ");
-o->mmo_refcount--;
-       if(o->mmo_nrespages == o->mmo_refcount &&
-	  o->mmo_nrespages != 0)
-             {
-                        pframe_t *i = NULL;
-                        list_iterate_begin(&(o->mmo_respages), i, pframe_t, pf_olink)
-                           {
-                               while(pframe_is_pinned(i))
-                                       pframe_unpin(i);
-                               if (pframe_is_busy(i))
-                                      sched_sleep_on(&i->pf_waitq);
-                               else if (pframe_is_dirty(i))
-                                       pframe_clean(i);
-                               else
-                                       pframe_free(i);
-                               
-                            }list_iterate_end();
-               }
-       
-        else if(0 == o->mmo_refcount && 0 == o->mmo_nrespages )
-       {
-                o = NULL;
+        KASSERT(o && (0 < o->mmo_refcount) && (&anon_mmobj_ops == o->mmo_ops));
+        dbg(DBG_PRINT, "(GRADING3A 4.c)Reference count of the anon object is greater than zero\n ");
+
+        if (o->mmo_refcount - 1 == o->mmo_nrespages) {
+                /* Only the resident pages refer to o now. Each page drops
+                 * its reference as it is freed, ours is dropped last */
+                pframe_release_all(o);
+        }
+        if (0 == --o->mmo_refcount) {
                 slab_obj_free(anon_allocator, o);
-       }
-       /* NOT_YET_IMPLEMENTED("VM: shadow_put");*/
-
+        }
 }
 
 /* Get the corresponding page from the mmobj. No special handling is
@@ -127,18 +154,7 @@ o->mmo_refcount--;
 static int
 anon_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
 {
-       pframe_t *pflookup = pframe_get_resident(o,pagenum);
-       if(pflookup)
-       {
-               while(!pframe_is_busy(pflookup))
-               {
-                       *pf = pflookup;
-                        return 0;
-               }
-       }
-       return -1; 
-       
-       /*NOT_YET_IMPLEMENTED("VM: anon_lookuppage");*/
+        return pframe_get(o, pagenum, pf);
 }
 
 static int
@@ -150,9 +166,18 @@ anon_fillpage(mmobj_t *o,pframe_t *pf)
        dbg(DBG_PRINT, "(GRADING3A 4.d)PF_BUSY flag set for the page frame\n ");
 	 KASSERT(!pframe_is_pinned(pf));    
 	dbg(DBG_PRINT, "(GRADING3A 4.d)Page frame is NOT pinned\n ");    
-               memset(pf->pf_addr,0,PAGE_SIZE);
+        int ret = swap_in(pf);
+        if (0 > ret) {
+                return ret;
+        } else if (0 == ret) {
+               memset(pframe_kmap(pf, PT_TMP_SLOT_KMAP0),0,PAGE_SIZE);
+               pagefault_note(FAULT_EV_ZERO);
+        }
+        if (!swap_enabled()) {
+                /* There is nowhere to page anonymous memory out to */
+                pframe_pin(pf);
+        }
 	return 0;
-               
 }
 
 static int
@@ -165,5 +190,5 @@ static int
 anon_cleanpage(mmobj_t *o, pframe_t *pf)
 {
         /*NOT_YET_IMPLEMENTED("VM: anon_cleanpage");*/
-        return 0;
+        return swap_out(pf);
 }
@@ -0,0 +1,488 @@
+#include "config.h"
+#include "types.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/list.h"
+#include "util/init.h"
+#include "util/string.h"
+#include "util/printf.h"
+
+#include "mm/mm.h"
+#include "mm/mman.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/slab.h"
+
+#include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/kthread.h"
+
+#include "vm/vmmap.h"
+#include "vm/anon.h"
+#include "vm/shadow.h"
+#include "vm/swap.h"
+#include "vm/ksm.h"
+
+/*
+ * Kernel same-page merging. Processes which were forked from the same
+ * parent, or run the same program, end up with many private pages with
+ * the same contents (zeroed bss, heap headers, relocated data of the
+ * dynamic linker). ksmd looks through the private pages of every
+ * process, a batch at a time, and merges pages with the same contents
+ * into one read-only ksm_page_t; see swap_merge().
+ *
+ * A page is only merged once its contents were the same on two passes
+ * in a row, so that pages which are being written are left alone. The
+ * hash of each page seen on the last pass is kept in a ksm_item_t,
+ * found by object and page number. Items whose page was the same on
+ * the last two passes are also found by that hash, so that two such
+ * pages can be merged. Pages are always compared in full before they
+ * are merged: the items only say where to look, they may be stale.
+ */
+typedef struct ksm_item {
+        mmobj_t        *ki_obj;
+        uint32_t        ki_pagenum;
+        uint32_t        ki_hash;        /* of the page when last scanned */
+        uint32_t        ki_pass;        /* pass it was last scanned on */
+        list_link_t     ki_link;        /* on the ksm_items chain */
+        list_link_t     ki_ulink;       /* on the ksm_unstable chain */
+} ksm_item_t;
+
+typedef struct ksm_cand {
+        mmobj_t        *kc_obj;
+        uint32_t        kc_pagenum;
+} ksm_cand_t;
+
+#define hash_item(obj, pagenum)  ((((uint32_t)(obj)) + (pagenum)) % KSM_HASH_SIZE)
+
+static list_t ksm_items[KSM_HASH_SIZE];
+static list_t ksm_unstable[KSM_HASH_SIZE];
+static list_t ksm_stable[KSM_HASH_SIZE];
+
+static slab_allocator_t *ksm_item_allocator;
+static slab_allocator_t *ksm_page_allocator;
+
+static mmobj_t *ksm_obj;                /* owns the frames of merged pages */
+static uint32_t ksm_next_pagenum = 0;
+
+static uint32_t ksm_pass = 0;
+static pid_t ksm_cursor_pid;            /* where the pass has got to */
+static uint32_t ksm_cursor_vfn;
+static ksm_cand_t ksm_batch[KSM_SCAN_PAGES];
+
+static uint32_t ksm_npages = 0;         /* ksm_page_ts */
+static uint32_t ksm_nsharing = 0;       /* swap entries referring to them */
+static uint32_t ksm_nitems = 0;
+static uint32_t ksm_nmerges = 0;
+
+static ktqueue_t ksmd_waitq;
+static ktqueue_t ksmd_syncq;            /* woken when ksmd goes back to sleep */
+static uint32_t ksm_wanted = 0;         /* pass ksmd_sync() waits for */
+
+static uint32_t
+_ksm_hash(pframe_t *pf)
+{
+        const uint32_t *w = pframe_kmap(pf, PT_TMP_SLOT_KMAP0);
+        uint32_t h = 2166136261u;
+        uint32_t i;
+
+        for (i = 0; i < PAGE_SIZE / sizeof(*w); ++i) {
+                h = (h ^ w[i]) * 16777619u;
+        }
+        return h;
+}
+
+static int
+_ksm_same(pframe_t *a, pframe_t *b)
+{
+        return 0 == memcmp(pframe_kmap(a, PT_TMP_SLOT_KMAP0), pframe_kmap(b, PT_TMP_SLOT_KMAP1),
+                           PAGE_SIZE);
+}
+
+/*
+ * Returns the page of o which may be merged, or NULL if it is not
+ * resident or is in use.
+ */
+static pframe_t *
+_ksm_lookup(mmobj_t *o, uint32_t pagenum)
+{
+        pframe_t *pf = pframe_get_resident(o, pagenum);
+
+        if (NULL == pf || pframe_is_busy(pf) || pframe_is_pinned(pf)
+            || (!mmobj_is_anon(pf->pf_obj) && !mmobj_is_shadow(pf->pf_obj))
+            || ksm_obj == pf->pf_obj) {
+                return NULL;
+        }
+        return pf;
+}
+
+static ksm_item_t *
+_ksm_item_get(mmobj_t *o, uint32_t pagenum)
+{
+        ksm_item_t *ki;
+
+        list_iterate_begin(&ksm_items[hash_item(o, pagenum)], ki, ksm_item_t, ki_link) {
+                if (o == ki->ki_obj && pagenum == ki->ki_pagenum) {
+                        return ki;
+                }
+        } list_iterate_end();
+        return NULL;
+}
+
+static void
+_ksm_item_free(ksm_item_t *ki)
+{
+        list_remove(&ki->ki_link);
+        if (list_link_is_linked(&ki->ki_ulink)) {
+                list_remove(&ki->ki_ulink);
+        }
+        slab_obj_free(ksm_item_allocator, ki);
+        ksm_nitems--;
+}
+
+static void
+_ksm_page_free(ksm_page_t *kp)
+{
+        KASSERT(0 == kp->kp_refcount);
+        if (list_link_is_linked(&kp->kp_link)) {
+                list_remove(&kp->kp_link);
+        }
+        while (pframe_is_pinned(kp->kp_pf)) {
+                pframe_unpin(kp->kp_pf);
+        }
+        pframe_free(kp->kp_pf);
+        slab_obj_free(ksm_page_allocator, kp);
+        ksm_npages--;
+}
+
+void
+ksm_page_put(ksm_page_t *kp)
+{
+        KASSERT(0 < kp->kp_refcount);
+        ksm_nsharing--;
+        if (0 == --kp->kp_refcount) {
+                _ksm_page_free(kp);
+        }
+}
+
+static ksm_page_t *
+_ksm_stable_lookup(pframe_t *pf, uint32_t hash)
+{
+        ksm_page_t *kp;
+
+        list_iterate_begin(&ksm_stable[hash % KSM_HASH_SIZE], kp, ksm_page_t, kp_link) {
+                if (hash == kp->kp_hash && _ksm_same(pf, kp->kp_pf)) {
+                        return kp;
+                }
+        } list_iterate_end();
+        return NULL;
+}
+
+/*
+ * Replaces pf by a reference to kp, if their contents are the same.
+ * Every mapping of pf is removed, the next read maps kp's frame
+ * instead. This only blocks in dropping pf's reference to its object,
+ * after which pf is gone.
+ */
+static int
+_ksm_merge(pframe_t *pf, ksm_page_t *kp)
+{
+        if (!_ksm_same(pf, kp->kp_pf)) {
+                return -EINVAL;
+        }
+        kp->kp_refcount++;
+        if (0 > swap_merge(pf->pf_obj, pf->pf_pagenum, kp)) {
+                kp->kp_refcount--;
+                return -ENOMEM;
+        }
+        ksm_nsharing++;
+        ksm_nmerges++;
+        pframe_free(pf);
+        return 0;
+}
+
+/*
+ * Makes a new ksm_page_t out of the pages of the items a and b and
+ * merges both into it. This blocks to allocate the frame, after which
+ * either page may have changed or gone, so they are looked up again.
+ */
+static void
+_ksm_merge_pair(ksm_item_t *a, ksm_item_t *b)
+{
+        ksm_page_t *kp;
+        pframe_t *pf;
+
+        if (NULL == (kp = slab_obj_alloc(ksm_page_allocator))) {
+                return;
+        }
+        if (0 > pframe_get(ksm_obj, ksm_next_pagenum++, &kp->kp_pf)) {
+                slab_obj_free(ksm_page_allocator, kp);
+                return;
+        }
+        pframe_pin(kp->kp_pf);
+        /* Held by us until the merges are done, freeing a page may
+         * block and let its object go along with our reference */
+        kp->kp_refcount = 1;
+        list_link_init(&kp->kp_link);
+        ksm_npages++;
+
+        if (NULL != (pf = _ksm_lookup(a->ki_obj, a->ki_pagenum))) {
+                memcpy(pframe_kmap(kp->kp_pf, PT_TMP_SLOT_KMAP1), pframe_kmap(pf, PT_TMP_SLOT_KMAP0),
+                       PAGE_SIZE);
+                kp->kp_hash = _ksm_hash(kp->kp_pf);
+                list_insert_head(&ksm_stable[kp->kp_hash % KSM_HASH_SIZE], &kp->kp_link);
+
+                _ksm_merge(pf, kp);
+                if (NULL != (pf = _ksm_lookup(b->ki_obj, b->ki_pagenum))) {
+                        _ksm_merge(pf, kp);
+                }
+        }
+        _ksm_item_free(a);
+        _ksm_item_free(b);
+        if (0 == --kp->kp_refcount) {
+                _ksm_page_free(kp);
+        }
+}
+
+/*
+ * Looks at one page which may be merged. Returns 1 if it was merged or
+ * is seen for the first time, 0 otherwise.
+ */
+static int
+_ksm_scan_page(mmobj_t *o, uint32_t pagenum)
+{
+        pframe_t *pf, *opf;
+        ksm_item_t *ki, *other;
+        ksm_page_t *kp;
+        uint32_t hash;
+
+        if (NULL == (pf = _ksm_lookup(o, pagenum))) {
+                return 0;
+        }
+        hash = _ksm_hash(pf);
+
+        if (NULL == (ki = _ksm_item_get(o, pagenum))) {
+                if (NULL == (ki = slab_obj_alloc(ksm_item_allocator))) {
+                        return 0;
+                }
+                ki->ki_obj = o;
+                ki->ki_pagenum = pagenum;
+                ki->ki_hash = hash;
+                ki->ki_pass = ksm_pass;
+                list_link_init(&ki->ki_ulink);
+                list_insert_head(&ksm_items[hash_item(o, pagenum)], &ki->ki_link);
+                ksm_nitems++;
+                return 1;
+        }
+        ki->ki_pass = ksm_pass;
+        if (hash != ki->ki_hash) {
+                /* Still being written */
+                ki->ki_hash = hash;
+                if (list_link_is_linked(&ki->ki_ulink)) {
+                        list_remove(&ki->ki_ulink);
+                }
+                return 0;
+        }
+
+        if (NULL != (kp = _ksm_stable_lookup(pf, hash))) {
+                _ksm_item_free(ki);
+                return 0 == _ksm_merge(pf, kp);
+        }
+
+        list_iterate_begin(&ksm_unstable[hash % KSM_HASH_SIZE], other, ksm_item_t, ki_ulink) {
+                if (other != ki && hash == other->ki_hash
+                    && NULL != (opf = _ksm_lookup(other->ki_obj, other->ki_pagenum))
+                    && opf != pf && _ksm_same(pf, opf)) {
+                        _ksm_merge_pair(ki, other);
+                        return 1;
+                }
+        } list_iterate_end();
+
+        if (!list_link_is_linked(&ki->ki_ulink)) {
+                list_insert_head(&ksm_unstable[hash % KSM_HASH_SIZE], &ki->ki_ulink);
+        }
+        return 0;
+}
+
+/*
+ * Returns the live process with the smallest pid above pid which has
+ * an address space of its own, or NULL.
+ */
+static proc_t *
+_ksm_next_proc(pid_t pid)
+{
+        proc_t *p, *next = NULL;
+
+        list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
+                if (p->p_pid > pid && PROC_DEAD != p->p_state && NULL != p->p_vmmap
+                    && p == p->p_vmmap->vmm_proc && (NULL == next || p->p_pid < next->p_pid)) {
+                        next = p;
+                }
+        } list_iterate_end();
+        return next;
+}
+
+/*
+ * Fills ksm_batch with the resident private pages which come next on
+ * this pass, looking at no more than KSM_SCAN_PAGES pages of memory.
+ * Returns how many were found, and sets *done at the end of the pass.
+ * This does not block, so that the process and its areas stay put.
+ */
+static int
+_ksm_collect(int *done)
+{
+        int nlooked = 0, n = 0;
+        proc_t *p = proc_lookup(ksm_cursor_pid);
+        vmarea_t *vma;
+
+        if (NULL == p || NULL == p->p_vmmap || p != p->p_vmmap->vmm_proc) {
+                ksm_cursor_vfn = 0;
+                p = _ksm_next_proc(ksm_cursor_pid);
+        }
+        for (; NULL != p; p = _ksm_next_proc(p->p_pid), ksm_cursor_vfn = 0) {
+                ksm_cursor_pid = p->p_pid;
+                list_iterate_begin(&p->p_vmmap->vmm_list, vma, vmarea_t, vma_plink) {
+                        uint32_t vfn;
+
+                        if (vma->vma_end <= ksm_cursor_vfn || !(MAP_PRIVATE & vma->vma_flags)
+                            || (!mmobj_is_anon(vma->vma_obj) && !mmobj_is_shadow(vma->vma_obj))) {
+                                continue;
+                        }
+                        for (vfn = MAX(vma->vma_start, ksm_cursor_vfn); vfn < vma->vma_end; ++vfn) {
+                                uint32_t pagenum = vfn - vma->vma_start + vma->vma_off;
+
+                                if (nlooked++ == KSM_SCAN_PAGES) {
+                                        ksm_cursor_vfn = vfn;
+                                        return n;
+                                }
+                                if (NULL != _ksm_lookup(vma->vma_obj, pagenum)) {
+                                        ksm_batch[n].kc_obj = vma->vma_obj;
+                                        ksm_batch[n].kc_pagenum = pagenum;
+                                        n++;
+                                }
+                        }
+                        ksm_cursor_vfn = vma->vma_end;
+                } list_iterate_end();
+        }
+        *done = 1;
+        return n;
+}
+
+/*
+ * Goes through the private pages of every process once, a batch at a
+ * time, letting everyone else run between batches. Items of pages which
+ * were not seen are dropped at the end. Returns the number of pages
+ * merged or seen for the first time.
+ */
+static int
+_ksm_run_pass(void)
+{
+        int i, n, done = 0, progress = 0;
+        ksm_item_t *ki;
+
+        ksm_pass++;
+        ksm_cursor_pid = -1;
+        ksm_cursor_vfn = 0;
+
+        while (!done) {
+                n = _ksm_collect(&done);
+                for (i = 0; i < n; ++i) {
+                        progress += _ksm_scan_page(ksm_batch[i].kc_obj, ksm_batch[i].kc_pagenum);
+                }
+                sched_make_runnable(curthr);
+                sched_switch();
+        }
+
+        for (i = 0; i < KSM_HASH_SIZE; ++i) {
+                list_iterate_begin(&ksm_items[i], ki, ksm_item_t, ki_link) {
+                        if (ksm_pass != ki->ki_pass) {
+                                _ksm_item_free(ki);
+                        }
+                } list_iterate_end();
+        }
+        dbg(DBG_VM, "ksm: pass %u, %u pages merged into %u\n", ksm_pass, ksm_nsharing, ksm_npages);
+        return progress;
+}
+
+void
+ksmd_wakeup(void)
+{
+        sched_wakeup_on(&ksmd_waitq);
+}
+
+void
+ksmd_sync(void)
+{
+        /* A pass under way may have gone past pages changed since, the
+         * next one has not */
+        ksm_wanted = ksm_pass + 1;
+        ksmd_wakeup();
+        sched_sleep_on(&ksmd_syncq);
+}
+
+/*
+ * The same-page merging daemon. It is woken when memory is getting
+ * short, and then makes passes until one finds nothing new, and at
+ * least until the pass ksmd_sync() asked for is done.
+ */
+static void *
+ksmd_run(int arg1, void *arg2)
+{
+        while (1) {
+                while (0 < _ksm_run_pass() || ksm_pass < ksm_wanted) {
+                        ;
+                }
+                sched_broadcast_on(&ksmd_syncq);
+                if (sched_cancellable_sleep_on(&ksmd_waitq) < 0) {
+                        return (void *)0;
+                }
+        }
+}
+
+size_t
+ksm_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+
+        iprintf(&buf, &size, "merged:       %u pages into %u, %u pages saved\n",
+                ksm_nsharing, ksm_npages, ksm_nsharing - ksm_npages);
+        iprintf(&buf, &size, "merges:       %u\n", ksm_nmerges);
+        iprintf(&buf, &size, "tracked:      %u pages\n", ksm_nitems);
+        iprintf(&buf, &size, "passes:       %u\n", ksm_pass);
+        return size;
+}
+
+static __attribute__((unused)) void
+ksmd_init(void)
+{
+        proc_t *p;
+        kthread_t *thr;
+        int i;
+
+        for (i = 0; i < KSM_HASH_SIZE; ++i) {
+                list_init(&ksm_items[i]);
+                list_init(&ksm_unstable[i]);
+                list_init(&ksm_stable[i]);
+        }
+        ksm_item_allocator = slab_allocator_create("ksmitem", sizeof(ksm_item_t));
+        ksm_page_allocator = slab_allocator_create("ksmpage", sizeof(ksm_page_t));
+        KASSERT(NULL != ksm_item_allocator && NULL != ksm_page_allocator);
+        ksm_obj = anon_create();
+        KASSERT(NULL != ksm_obj);
+        sched_queue_init(&ksmd_waitq);
+        sched_queue_init(&ksmd_syncq);
+
+        KASSERT(NULL != curproc && (PID_IDLE == curproc->p_pid));
+        p = proc_create("ksmd");
+        KASSERT(NULL != p);
+        /* Merging is background work, keep it out of the way of everything else */
+        p->p_nice = NICE_MAX;
+        thr = kthread_create(p, ksmd_run, 0, NULL);
+        KASSERT(NULL != thr);
+
+        sched_make_runnable(thr);
+}
+init_func(ksmd_init);
+init_depends(sched_init);
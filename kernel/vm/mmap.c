@@ -6,6 +6,9 @@
 #include "mm/tlb.h"
 #include "mm/mman.h"
 #include "mm/page.h"
+#include "mm/pagetable.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
 
 #include "proc/proc.h"
 
@@ -17,12 +20,16 @@
 #include "fs/file.h"
 
 #include "vm/vmmap.h"
+#include "vm/anon.h"
 #include "vm/mmap.h"
+#include "vm/pagefault.h"
+#include "vm/shm.h"
 
 /*
  * This function implements the mmap(2) syscall, but only
- * supports the MAP_SHARED, MAP_PRIVATE, MAP_FIXED, and
- * MAP_ANON flags.
+ * supports the MAP_SHARED, MAP_PRIVATE, MAP_FIXED, MAP_ANON,
+ * MAP_LARGEPAGE, MAP_POPULATE and MAP_SHM flags. With MAP_SHM fd is
+ * the id of a shared memory segment from shm_open(2).
  *
  * Add a mapping to the current process's address space.
  * You need to do some error checking; see the ERRORS section
@@ -31,21 +38,83 @@
  * done by vmmap_map(), but remember to clear the TLB.
  */
 int
-do_mmap(void *addr, size_t len, int prot, int flags,int fd, off_t off, void **ret)
+do_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off, void **ret)
 {
-	/*NOT_YET_IMPLEMENTED("VM: do_mmap");*/
+        uintptr_t vaddr = (uintptr_t) addr;
+        file_t *f = NULL;
+        vnode_t *vn = NULL;
+        mmobj_t *shm = NULL;
+        vmarea_t *vma;
+        int err;
 
-	int address = (uintptr_t) addr;
+        if (0 == len || USER_MEM_HIGH - USER_MEM_LOW < len || !PAGE_ALIGNED(off) || 0 > off) {
+                return -EINVAL;
+        }
+        if (MAP_SHARED != (MAP_TYPE & flags) && MAP_PRIVATE != (MAP_TYPE & flags)) {
+                return -EINVAL;
+        }
+        if ((MAP_FIXED & flags) && (!PAGE_ALIGNED(vaddr) || USER_MEM_LOW > vaddr
+                                    || USER_MEM_HIGH - vaddr < len)) {
+                return -EINVAL;
+        }
+        if ((MAP_LARGEPAGE & flags) && !(MAP_ANON & flags)) {
+                return -EINVAL;
+        }
 
-	tlb_flush(address);
+        if (MAP_SHM & flags) {
+                if (MAP_ANON & flags) {
+                        return -EINVAL;
+                }
+                if (0 > (err = shm_get(fd, off, len, &shm))) {
+                        return err;
+                }
+        } else if (!(MAP_ANON & flags)) {
+                if (NULL == (f = fget(fd))) {
+                        return -EBADF;
+                }
+                if (!(FMODE_READ & f->f_mode)
+                    || ((MAP_SHARED & flags) && (PROT_WRITE & prot)
+                        && (!(FMODE_WRITE & f->f_mode) || (FMODE_APPEND & f->f_mode)))) {
+                        fput(f);
+                        return -EACCES;
+                }
+                vn = f->f_vnode;
+                if (NULL == vn->vn_ops->mmap) {
+                        fput(f);
+                        return -ENODEV;
+                }
+        }
 
-	KASSERT(NULL != curproc->p_pagedir);
-	dbg(DBG_PRINT, "(GRADING3A 2.a)curproc->p_pagedir; first ten bits of the virtual address is NOT NULL\n ");
+        KASSERT(NULL != curproc->p_pagedir);
+        dbg(DBG_PRINT, "(GRADING3A 2.a)curproc->p_pagedir; first ten bits of the virtual address is NOT NULL\n ");
 
-	vmmap_map(curproc->p_vmmap, curproc->p_files[fd]->f_vnode, 0, 0, prot, flags, off, NULL, (vmarea_t**) ret);
-	return 0;
+        if (NULL != shm) {
+                err = vmmap_map_obj(curproc->p_vmmap, shm, (MAP_FIXED & flags) ? ADDR_TO_PN(vaddr) : 0,
+                                    ADDR_TO_PN(PAGE_ALIGN_UP(len)), prot, flags, off, VMMAP_DIR_HILO, &vma);
+                shm->mmo_ops->put(shm);
+        } else {
+                err = vmmap_map(curproc->p_vmmap, vn, (MAP_FIXED & flags) ? ADDR_TO_PN(vaddr) : 0,
+                                ADDR_TO_PN(PAGE_ALIGN_UP(len)), prot, flags, off, VMMAP_DIR_HILO, &vma);
+        }
+        if (NULL != f) {
+                fput(f);
+        }
+        if (0 > err) {
+                return err;
+        }
+
+        /* A fixed mapping may have replaced others */
+        pt_unmap_range(curproc->p_pagedir, (uintptr_t) PN_TO_ADDR(vma->vma_start),
+                       (uintptr_t) PN_TO_ADDR(vma->vma_end));
 
+        /* Like on Linux, a mapping which could not be populated is still
+         * a mapping, the pages are faulted in as they are touched instead */
+        if (MAP_POPULATE & flags) {
+                pagefault_populate(vma);
+        }
 
+        *ret = PN_TO_ADDR(vma->vma_start);
+        return 0;
 }
 
 
@@ -59,17 +128,196 @@ do_mmap(void *addr, size_t len, int prot, int flags,int fd, off_t off, void **re
 int
 do_munmap(void *addr, size_t len)
 {
+	uintptr_t vaddr = (uintptr_t) addr;
 
-	/*NOT_YET_IMPLEMENTED("VM: do_munmap");*/
-
-	int temp_addr = (uintptr_t) addr;
-
-	tlb_flush(temp_addr);
+	if (!PAGE_ALIGNED(vaddr) || 0 == len || USER_MEM_LOW > vaddr
+	    || USER_MEM_HIGH - vaddr < len) {
+		return -EINVAL;
+	}
 
 	KASSERT(NULL != curproc->p_pagedir);
-	dbg(DBG_PRINT, "(GRADING3A 2.b)curproc->p_pagedir; first ten bits of the virtual address is NOT NULL\n ");
 
-	vmmap_remove(curproc->p_vmmap, 0, 0);
+	uint32_t npages = ADDR_TO_PN(PAGE_ALIGN_UP(len));
+	vmmap_remove(curproc->p_vmmap, ADDR_TO_PN(vaddr), npages);
+
+	/* Clears the page table entries and flushes the TLB once for the
+	 * whole range rather than page by page */
+	pt_unmap_range(curproc->p_pagedir, vaddr, vaddr + (uintptr_t) PN_TO_ADDR(npages));
 	return 0;
+}
+
+/*
+ * Drops the pages [lopage, hipage) of vma for MADV_DONTNEED and
+ * MADV_FREE. The range is unmapped and the area's own copies of the
+ * pages are thrown away without being written anywhere, so that the
+ * next touch sees what lies below them, i.e. zeroes or the file. Pages
+ * of shared areas belong to everyone mapping the object and are kept,
+ * but are reclaimed before any other page.
+ */
+static void
+_madvise_dontneed(vmarea_t *vma, uint32_t lopage, uint32_t hipage)
+{
+        uint32_t lo = lopage - vma->vma_start + vma->vma_off;
+        pframe_t *pf;
+
+        pt_unmap_range(curproc->p_pagedir, (uintptr_t) PN_TO_ADDR(lopage),
+                       (uintptr_t) PN_TO_ADDR(hipage));
+        vmarea_recount(vma);
+
+        if (MAP_PRIVATE & vma->vma_flags) {
+                pframe_discard_range(vma->vma_obj, lo, hipage - lopage);
+        } else {
+                list_iterate_begin(&vma->vma_obj->mmo_respages, pf, pframe_t, pf_olink) {
+                        if (pf->pf_pagenum >= lo && pf->pf_pagenum - lo < hipage - lopage) {
+                                pframe_deactivate(pf);
+                        }
+                } list_iterate_end();
+        }
+}
+
+/*
+ * Reads in the pages [lopage, hipage) of vma for MADV_WILLNEED, without
+ * mapping them. Only file pages are read, anonymous memory is created on
+ * first touch anyway.
+ */
+static int
+_madvise_willneed(vmarea_t *vma, uint32_t lopage, uint32_t hipage)
+{
+        mmobj_t *obj = vma->vma_obj;
+        uint32_t lo = lopage - vma->vma_start + vma->vma_off;
+        uint32_t i;
+        pframe_t *pf;
+        int ret = 0;
+
+        if (mmobj_is_anon(mmobj_bottom_obj(obj))) {
+                return 0;
+        }
+        /* Hold on to the object, the area may go away while we block */
+        obj->mmo_ops->ref(obj);
+        for (i = 0; i < hipage - lopage && 0 <= ret; ++i) {
+                ret = pframe_lookup(obj, lo + i, 0, &pf);
+        }
+        obj->mmo_ops->put(obj);
+        return ret;
+}
+
+/*
+ * This function implements the madvise(2) syscall.
+ *
+ * MADV_NORMAL, MADV_RANDOM and MADV_SEQUENTIAL are kept in the areas of
+ * the range and decide what a page fault maps besides the faulting page
+ * (see vm/pagefault.c). MADV_WILLNEED reads the range in ahead of use,
+ * MADV_DONTNEED and MADV_FREE give it up. MADV_FREE is only allowed on
+ * private mappings. The whole range must be mapped.
+ */
+int
+do_madvise(void *addr, size_t len, int advice)
+{
+        uintptr_t vaddr = (uintptr_t) addr;
+        uint32_t lopage, hipage, vfn, hi;
+        vmarea_t *vma;
+        int ret;
+
+        if (!PAGE_ALIGNED(vaddr) || USER_MEM_LOW > vaddr || USER_MEM_HIGH - vaddr < len) {
+                return -EINVAL;
+        }
+        if (0 == len) {
+                return 0;
+        }
+        lopage = ADDR_TO_PN(vaddr);
+        hipage = ADDR_TO_PN(PAGE_ALIGN_UP(vaddr + len));
+
+        switch (advice) {
+                case MADV_NORMAL:
+                case MADV_RANDOM:
+                case MADV_SEQUENTIAL:
+                        return vmmap_set_advice(curproc->p_vmmap, lopage, hipage - lopage, advice);
+                case MADV_WILLNEED:
+                case MADV_DONTNEED:
+                case MADV_FREE:
+                        break;
+                default:
+                        return -EINVAL;
+        }
+
+        for (vfn = lopage; vfn < hipage; vfn = vma->vma_end) {
+                if (NULL == (vma = vmmap_lookup(curproc->p_vmmap, vfn))) {
+                        return -ENOMEM;
+                }
+                if (MADV_FREE == advice && !(MAP_PRIVATE & vma->vma_flags)) {
+                        return -EINVAL;
+                }
+        }
+
+        for (vfn = lopage; vfn < hipage; vfn = hi) {
+                /* Areas may change while MADV_WILLNEED blocks */
+                if (NULL == (vma = vmmap_lookup(curproc->p_vmmap, vfn))) {
+                        return -ENOMEM;
+                }
+                hi = MIN(hipage, vma->vma_end);
+                if (MADV_WILLNEED != advice) {
+                        _madvise_dontneed(vma, vfn, hi);
+                } else if (0 > (ret = _madvise_willneed(vma, vfn, hi))) {
+                        return ret;
+                }
+        }
+        return 0;
+}
+
+/*
+ * This function implements the mremap(2) syscall, which resizes the
+ * mapping of [old, old + oldlen) to newlen bytes, moving it elsewhere
+ * if it cannot grow where it is and flags has MREMAP_MAYMOVE. The whole
+ * old range must lie within one mapping. Pages that were mapped are
+ * carried over to the new place by moving their page table entries,
+ * nothing is copied.
+ */
+int
+do_mremap(void *old, size_t oldlen, size_t newlen, int flags, void **ret)
+{
+        uintptr_t vaddr = (uintptr_t) old;
+        uint32_t lopage, oldnpages, newnpages, to, i;
+        uintptr_t from, dest;
+        paddr_t paddr;
+        uint32_t ptflags;
+        int err;
+
+        if (!PAGE_ALIGNED(vaddr) || 0 == oldlen || 0 == newlen
+            || (flags & ~MREMAP_MAYMOVE) || USER_MEM_LOW > vaddr
+            || USER_MEM_HIGH - vaddr < oldlen || USER_MEM_HIGH - USER_MEM_LOW < newlen) {
+                return -EINVAL;
+        }
+
+        KASSERT(NULL != curproc->p_pagedir);
+
+        lopage = ADDR_TO_PN(vaddr);
+        oldnpages = ADDR_TO_PN(PAGE_ALIGN_UP(oldlen));
+        newnpages = ADDR_TO_PN(PAGE_ALIGN_UP(newlen));
+        if (0 > (err = vmmap_remap(curproc->p_vmmap, lopage, oldnpages, newnpages,
+                                   MREMAP_MAYMOVE & flags, &to))) {
+                return err;
+        }
+
+        if (to != lopage) {
+                for (i = 0; i < oldnpages; ++i) {
+                        from = (uintptr_t) PN_TO_ADDR(lopage + i);
+                        dest = (uintptr_t) PN_TO_ADDR(to + i);
+                        if (pt_lookup(curproc->p_pagedir, from, &paddr, &ptflags)
+                            && 0 > pt_map(curproc->p_pagedir, dest, paddr,
+                                          PD_PRESENT | PD_WRITE | PD_USER, ptflags)) {
+                                /* Out of memory for a page table, the
+                                 * page will just be faulted in again */
+                                break;
+                        }
+                }
+                pt_unmap_range(curproc->p_pagedir, vaddr,
+                               vaddr + (uintptr_t) PN_TO_ADDR(oldnpages));
+                vmarea_recount(vmmap_lookup(curproc->p_vmmap, to));
+        } else if (newnpages < oldnpages) {
+                pt_unmap_range(curproc->p_pagedir, (uintptr_t) PN_TO_ADDR(lopage + newnpages),
+                               vaddr + (uintptr_t) PN_TO_ADDR(oldnpages));
+        }
 
+        *ret = PN_TO_ADDR(to);
+        return 0;
 }
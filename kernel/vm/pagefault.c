@@ -1,9 +1,13 @@
 #include "types.h"
 #include "globals.h"
 #include "kernel.h"
+#include "config.h"
 #include "errno.h"
 
 #include "util/debug.h"
+#include "util/printf.h"
+
+#include "main/cpuid.h"
 
 #include "proc/proc.h"
 
@@ -13,18 +17,460 @@
 #include "mm/mmobj.h"
 #include "mm/pframe.h"
 #include "mm/pagetable.h"
+#include "mm/tlb.h"
 
 #include "vm/pagefault.h"
 #include "vm/vmmap.h"
+#include "vm/anon.h"
+#include "vm/shadow.h"
+#include "vm/swap.h"
+
+static fault_stats_t pagefault_stats; /* of every process since boot */
+
+void
+pagefault_note(uint32_t ev)
+{
+        if (FAULT_EV_ACTIVE & curthr->kt_faultev) {
+                curthr->kt_faultev |= ev;
+        }
+}
+
+/*
+ * Counts a fault which was resolved having done ev (FAULT_EV_*) and
+ * taken the given number of cycles.
+ */
+static void
+_pagefault_count(fault_stats_t *fs, uint32_t ev, uint64_t cycles)
+{
+        int bucket = (cycles >> 32) ? FAULT_HIST_BUCKETS - 1
+                     : 31 - __builtin_clz((uint32_t)cycles | 1);
+
+        if (FAULT_EV_MAJOR & ev) {
+                fs->fs_major++;
+        } else {
+                fs->fs_minor++;
+        }
+        if (FAULT_EV_COW & ev) {
+                fs->fs_cow++;
+        }
+        if (FAULT_EV_ZERO & ev) {
+                fs->fs_zero++;
+        }
+        fs->fs_hist[MIN(bucket, FAULT_HIST_BUCKETS - 1)]++;
+}
+
+void
+pagefault_stats_print(const fault_stats_t *fs, char **buf, size_t *size)
+{
+        int i;
+
+        iprintf(buf, size, "faults:       %u minor, %u major\n", fs->fs_minor, fs->fs_major);
+        iprintf(buf, size, "              %u copy-on-write, %u zero-fill\n", fs->fs_cow, fs->fs_zero);
+        iprintf(buf, size, "fault cycles:\n");
+        for (i = 0; i < FAULT_HIST_BUCKETS; ++i) {
+                if (0 != fs->fs_hist[i]) {
+                        iprintf(buf, size, "     < 2^%-2d   %u\n", i + 1, fs->fs_hist[i]);
+                }
+        }
+}
+
+size_t
+pagefault_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+
+        pagefault_stats_print(&pagefault_stats, &buf, &size);
+        return size;
+}
+
+/*
+ * Maps paddr at the page aligned vaddr of vma in the current page
+ * table, keeping the area's counts of resident and swapped pages.
+ */
+static int
+_pagefault_pt_map(vmarea_t *vma, uintptr_t vaddr, paddr_t paddr, uint32_t ptflags)
+{
+        pagedir_t *pd = curproc->p_pagedir;
+        int mapped = pt_is_mapped(pd, vaddr);
+        int pagedout = pt_is_pagedout(pd, vaddr);
+        int ret;
+
+        if (0 > (ret = pt_map(pd, vaddr, paddr, PD_PRESENT | PD_WRITE | PD_USER, ptflags))) {
+                return ret;
+        }
+        vmarea_account(vma, !mapped, -pagedout);
+        return 0;
+}
+
+/*
+ * Tries to back the whole large page region around vaddr with one large page.
+ * This is only done for anonymous areas which asked for it with
+ * MAP_LARGEPAGE and cover the whole region, on the first fault anywhere
+ * in the region and only if none of its pages is resident yet. Anything
+ * which later maps or unmaps part of the region (COW, munmap, pageout)
+ * splits the large page back into small pages.
+ *
+ * Returns 0 if the large page was mapped, and < 0 if the caller should
+ * fall back to mapping a single page.
+ */
+static int
+_pagefault_map_large(vmarea_t *vma, uintptr_t vaddr)
+{
+        uintptr_t lo = vaddr & ~(PT_LARGE_SIZE - 1);
+        uint32_t lopage = ADDR_TO_PN(lo);
+        uint32_t pagenum, i;
+        uintptr_t paddr;
+        int ret;
+
+        if (!(MAP_LARGEPAGE & vma->vma_flags) || !mmobj_is_anon(mmobj_bottom_obj(vma->vma_obj))
+            || lopage < vma->vma_start || lopage + PT_LARGE_NPAGES > vma->vma_end) {
+                return -EINVAL;
+        }
+        if (!pt_can_map_large(curproc->p_pagedir, lo)) {
+                return -EEXIST;
+        }
+        pagenum = lopage - vma->vma_start + vma->vma_off;
+        if (0 > (ret = pframe_get_contig(vma->vma_obj, pagenum, PT_LARGE_NPAGES, &paddr))) {
+                return ret;
+        }
+
+        /* As with small pages, own pages are only mapped writable once
+         * they are dirty, or what is written could be thrown away */
+        if (PROT_WRITE & vma->vma_prot) {
+                for (i = 0; i < PT_LARGE_NPAGES; ++i) {
+                        pframe_t *pf = pframe_get_resident(vma->vma_obj, pagenum + i);
+                        if (NULL == pf) {
+                                /* Reclaimed while an earlier page was
+                                 * dirtied. Leaving the rest of the block
+                                 * resident, and partly dirty, is intended:
+                                 * the caller falls back to small pages,
+                                 * which find those frames as they are */
+                                return -EAGAIN;
+                        }
+                        if (0 > (ret = pframe_dirty(pf))) {
+                                return ret;
+                        }
+                }
+        }
+
+        pt_map_large(curproc->p_pagedir, lo, paddr, PD_PRESENT | PD_USER
+                     | ((PROT_WRITE & vma->vma_prot) ? PD_WRITE : 0));
+        vmarea_account(vma, PT_LARGE_NPAGES, 0);
+        dbg(DBG_VM, "mapped large page 0x%08x => 0x%08x\n", lo, paddr);
+        return 0;
+}
+
+/*
+ * Returns the resident page which a read of pagenum in o would see, looking
+ * down the shadow chain, or NULL if that page is not resident. Unlike
+ * pframe_lookup this never fills a page or blocks. If swapped is not NULL
+ * it is set to whether the page which would be seen is in swap. A page
+ * merged by ksmd is seen in the page it was merged into, which is only
+ * ever mapped read-only since it belongs to none of the chain.
+ */
+static pframe_t *
+_pagefault_find_resident(mmobj_t *o, uint32_t pagenum, int *swapped)
+{
+        pframe_t *pf;
+        int inswap = 0;
+        for (pf = NULL; NULL != o; o = o->mmo_shadowed) {
+                if (NULL != (pf = pframe_get_resident(o, pagenum))
+                    || 0 != (inswap = ((mmobj_is_anon(o) || mmobj_is_shadow(o))
+                                       && swap_has(o, pagenum)))) {
+                        if (inswap && NULL != (pf = swap_merged_page(o, pagenum))) {
+                                inswap = 0;
+                        }
+                        break;
+                }
+        }
+        if (NULL != swapped) {
+                *swapped = inswap;
+        }
+        return pf;
+}
+
+#if FAULT_AROUND_PAGES > 0
+/*
+ * Fault-around: after a fault at vaddr, also maps the pages of vma in the
+ * FAULT_AROUND_PAGES aligned window around it which are already resident
+ * and not busy, so that touching them later does not fault. They are
+ * mapped read-only, a write to one of them still faults and goes through
+ * the normal path, so copy-on-write and dirtying work as before.
+ */
+static void
+_pagefault_map_around(vmarea_t *vma, uintptr_t vaddr)
+{
+        pagedir_t *pd = curproc->p_pagedir;
+        uint32_t vfn = ADDR_TO_PN(vaddr);
+        uint32_t lo = MAX(vma->vma_start, vfn - vfn % FAULT_AROUND_PAGES);
+        uint32_t hi = MIN(vma->vma_end, vfn - vfn % FAULT_AROUND_PAGES + FAULT_AROUND_PAGES);
+        uint32_t i;
+
+        if (!(PROT_READ & vma->vma_prot)) {
+                return;
+        }
+
+        for (i = lo; i < hi; ++i) {
+                uintptr_t addr = (uintptr_t)PN_TO_ADDR(i);
+                pframe_t *pf;
+
+                if (i == vfn || pt_is_mapped(pd, addr)) {
+                        continue;
+                }
+                pf = _pagefault_find_resident(vma->vma_obj, i - vma->vma_start + vma->vma_off, NULL);
+                if (NULL == pf || pframe_is_busy(pf)) {
+                        continue;
+                }
+                if (0 > _pagefault_pt_map(vma, addr, pf->pf_paddr, PT_PRESENT | PT_USER)) {
+                        return;
+                }
+                ++curproc->p_nfaultaround;
+        }
+}
+#endif
+
+/*
+ * Read-ahead for areas advised MADV_SEQUENTIAL: after a fault at vaddr,
+ * reads in the READAHEAD_PAGES pages of vma after it and maps them
+ * read-only like fault-around does, so that a sequential scan takes one
+ * fault per window rather than one per page. The window before the one
+ * just passed has been scanned already and will not be needed again, its
+ * pages are handed to pageoutd ahead of everything else (drop-behind).
+ */
+static void
+_pagefault_read_ahead(vmarea_t *vma, uintptr_t vaddr)
+{
+        pagedir_t *pd = curproc->p_pagedir;
+        uint32_t vfn = ADDR_TO_PN(vaddr);
+        uint32_t hi = MIN(vma->vma_end, vfn + 1 + READAHEAD_PAGES);
+        uint32_t i;
+        pframe_t *pf;
+
+        /* Anonymous memory has nothing to read, its pages are zeroes
+         * until written */
+        if (!(PROT_READ & vma->vma_prot) || mmobj_is_anon(mmobj_bottom_obj(vma->vma_obj))) {
+                return;
+        }
+
+        if (vfn >= vma->vma_start + READAHEAD_PAGES) {
+                for (i = MAX(vma->vma_start, vfn - 2 * READAHEAD_PAGES);
+                     i < vfn - READAHEAD_PAGES; ++i) {
+                        pf = _pagefault_find_resident(vma->vma_obj, i - vma->vma_start + vma->vma_off, NULL);
+                        if (NULL != pf) {
+                                pframe_deactivate(pf);
+                        }
+                }
+        }
+
+        for (i = vfn + 1; i < hi; ++i) {
+                uintptr_t addr = (uintptr_t)PN_TO_ADDR(i);
+
+                if (pt_is_mapped(pd, addr)) {
+                        continue;
+                }
+                if (0 > pframe_lookup(vma->vma_obj, i - vma->vma_start + vma->vma_off, 0, &pf)
+                    || 0 > _pagefault_pt_map(vma, addr, pf->pf_paddr, PT_PRESENT | PT_USER)) {
+                        return;
+                }
+        }
+}
+
+/*
+ * Maps the page which a read of vma at vaddr sees. Pages of anonymous
+ * memory which have never been written are all zeroes, those are mapped
+ * to the shared zero page instead of getting a frame of their own. Other
+ * pages are mapped read-only unless they are the area's own private or
+ * anonymous pages which are already dirty, so that the first write to
+ * them faults and goes through _pagefault_map_write. (A clean page may
+ * have a copy in swap, it must be dirtied before it is written.)
+ */
+static int
+_pagefault_map_read(vmarea_t *vma, uintptr_t vaddr)
+{
+        uint32_t pagenum = ADDR_TO_PN(vaddr) - vma->vma_start + vma->vma_off;
+        int swapped;
+        pframe_t *pf = _pagefault_find_resident(vma->vma_obj, pagenum, &swapped);
+        uint32_t ptflags = PT_PRESENT | PT_USER;
+        paddr_t paddr;
+        int ret;
+
+        if (NULL == pf && !swapped && mmobj_is_anon(mmobj_bottom_obj(vma->vma_obj))) {
+                paddr = anon_zero_page();
+                pagefault_note(FAULT_EV_ZERO);
+        } else {
+                if ((NULL == pf || pframe_is_busy(pf))
+                    && 0 > (ret = pframe_lookup(vma->vma_obj, pagenum, 0, &pf))) {
+                        return ret;
+                }
+                paddr = pf->pf_paddr;
+                if (pf->pf_obj == vma->vma_obj && (PROT_WRITE & vma->vma_prot) && pframe_is_dirty(pf)
+                    && (mmobj_is_anon(pf->pf_obj) || mmobj_is_shadow(pf->pf_obj))) {
+                        ptflags |= PT_WRITE;
+                }
+        }
+        return _pagefault_pt_map(vma, (uintptr_t)PAGE_ALIGN_DOWN(vaddr), paddr, ptflags);
+}
+
+/*
+ * Makes the page of vma at vaddr resident for writing, dirties it and
+ * maps it writable. For a private area this is where the area's own
+ * object gets its copy of the page. A page of a shared anonymous object
+ * which is written for the first time may still be mapped to the zero
+ * page by others sharing the object, those mappings are removed.
+ */
+static int
+_pagefault_map_write(vmarea_t *vma, uintptr_t vaddr)
+{
+        uint32_t pagenum = ADDR_TO_PN(vaddr) - vma->vma_start + vma->vma_off;
+        int fresh = mmobj_is_anon(vma->vma_obj) && NULL == pframe_get_resident(vma->vma_obj, pagenum)
+                    && !swap_has(vma->vma_obj, pagenum);
+        pframe_t *pf;
+        int ret;
+
+        if (0 > (ret = pframe_lookup(vma->vma_obj, pagenum, 1, &pf))
+            || 0 > (ret = pframe_dirty(pf))) {
+                return ret;
+        }
+        if (fresh) {
+                pframe_remove_from_pts(pf);
+        }
+        if (0 > (ret = _pagefault_pt_map(vma, (uintptr_t)PAGE_ALIGN_DOWN(vaddr), pf->pf_paddr,
+                                         PT_PRESENT | PT_WRITE | PT_USER))) {
+                return ret;
+        }
+        /* The page may have been mapped read-only before */
+        tlb_flush((uintptr_t)PAGE_ALIGN_DOWN(vaddr));
+        return 0;
+}
+
+/*
+ * Maps every page of vma which is not mapped yet, as if each of them had
+ * been touched, for mmap(2) with MAP_POPULATE. This saves a fault per
+ * page for memory which is known to be used right away.
+ *
+ * @return 0 on success, -errno if a page could not be made resident
+ */
+int
+pagefault_populate(vmarea_t *vma)
+{
+        pagedir_t *pd = curproc->p_pagedir;
+        uint32_t vfn;
+        int ret;
+
+        if (PROT_NONE == vma->vma_prot) {
+                return 0;
+        }
+
+        for (vfn = vma->vma_start; vfn < vma->vma_end; ++vfn) {
+                uintptr_t vaddr = (uintptr_t)PN_TO_ADDR(vfn);
+
+                if (pt_is_mapped(pd, vaddr) || 0 == _pagefault_map_large(vma, vaddr)) {
+                        continue;
+                }
+                /* Like a write, private writable memory gets its own pages */
+                ret = ((PROT_WRITE & vma->vma_prot) && (MAP_PRIVATE & vma->vma_flags))
+                      ? _pagefault_map_write(vma, vaddr) : _pagefault_map_read(vma, vaddr);
+                if (0 > ret) {
+                        return ret;
+                }
+        }
+        return 0;
+}
+
+/*
+ * Unmaps the page of vma at vfn, if it is mapped, to bring the process
+ * down towards its resident set limit, and puts it at the front of the
+ * list pageoutd reclaims from.
+ */
+static void
+_pagefault_trim_page(vmarea_t *vma, uint32_t vfn)
+{
+        pagedir_t *pd = curproc->p_pagedir;
+        uintptr_t addr = (uintptr_t)PN_TO_ADDR(vfn);
+        paddr_t paddr;
+        uint32_t ptflags;
+        pframe_t *pf;
+        int pageout;
+
+        if (!pt_lookup(pd, addr, &paddr, &ptflags)) {
+                return;
+        }
+        pf = _pagefault_find_resident(vma->vma_obj, vfn - vma->vma_start + vma->vma_off, NULL);
+        if (NULL != pf && pf->pf_paddr != paddr) {
+                /* Not this page, e.g. the zero page */
+                pf = NULL;
+        }
+        pageout = NULL != pf && (mmobj_is_anon(pf->pf_obj) || mmobj_is_shadow(pf->pf_obj));
+        vmarea_account(vma, -pt_unmap(pd, addr, pageout), pageout);
+        tlb_flush(addr);
+        if (NULL != pf) {
+                pframe_deactivate(pf);
+        }
+}
+
+/*
+ * Brings a process over its resident set limit (see rsslimit(2)) back
+ * down to it after a fault, by unmapping its pages in address order
+ * from where the last trim stopped, so that it pays for its memory with
+ * its own pages rather than pushing out everyone else's. The page just
+ * faulted in at vaddr is kept.
+ */
+static void
+_pagefault_trim(uintptr_t vaddr)
+{
+        proc_t *p = curproc;
+        uint32_t keep = ADDR_TO_PN(vaddr);
+        vmarea_t *vma;
+        uint32_t vfn;
+        int pass;
+
+        for (pass = 0; pass < 2; ++pass) {
+                list_iterate_begin(&p->p_vmmap->vmm_list, vma, vmarea_t, vma_plink) {
+                        if (vma->vma_end <= p->p_rsshand || 0 == vma->vma_nresident) {
+                                continue;
+                        }
+                        for (vfn = MAX(vma->vma_start, p->p_rsshand); vfn < vma->vma_end; ++vfn) {
+                                if (p->p_nresident <= p->p_rsslimit) {
+                                        p->p_rsshand = vfn;
+                                        return;
+                                }
+                                if (vfn != keep) {
+                                        _pagefault_trim_page(vma, vfn);
+                                }
+                        }
+                } list_iterate_end();
+                p->p_rsshand = 0;
+        }
+}
+
+/*
+ * A fault which cannot be resolved kills a user process. For a fault
+ * in kernel mode the caller fixes things up instead. This includes
+ * running out of memory: retrying the access would only fault again.
+ */
+static int
+_pagefault_fail(uint32_t cause)
+{
+        if (FAULT_USER & cause) {
+                if (curthr->kt_cancelled) {
+                        /* Killed while faulting (e.g. chosen by the
+                         * OOM killer), keep the status we were given */
+                        kthread_exit(curthr->kt_retval);
+                }
+                proc_kill(curproc, EFAULT);
+        }
+        return -EFAULT;
+}
 
 /*
  * This gets called by _pt_fault_handler in mm/pagetable.c The
  * calling function has already done a lot of error checking for
- * us. In particular it has checked that we are not page faulting
- * while in kernel mode. Make sure you understand why an
- * unexpected page fault in kernel mode is bad in Weenix. You
- * should probably read the _pt_fault_handler function to get a
- * sense of what it is doing.
+ * us. In particular it has checked that any page fault in kernel
+ * mode is on a user address in one of the places listed in the
+ * exception table (see main/extable.h), i.e. in the user copy
+ * routines. Make sure you understand why any other page fault in
+ * kernel mode is bad in Weenix. You should probably read the
+ * _pt_fault_handler function to get a sense of what it is doing.
  *
  * Before you can do anything you need to find the vmarea that
  * contains the address that was faulted on. Make sure to check
@@ -32,7 +478,9 @@
  * permission to do [cause]. If either of these checks does not
  * pass kill the offending process, setting its exit status to
  * EFAULT (normally we would send the SIGSEGV signal, however
- * Weenix does not support signals).
+ * Weenix does not support signals). Faults from kernel mode do not
+ * kill the process, the error is returned and the user copy fails
+ * with -EFAULT instead.
  *
  * Now it is time to find the correct page (don't forget                
  * about shadow objects, especially copy-on-write magic!). Make
@@ -47,10 +495,12 @@
  * @param cause this is the type of operation on the memory
  *              address which caused the fault, possible values
  *              can be found in pagefault.h
+ *
+ * @return 0 if the page is now mapped, -errno otherwise
  */
 
-void
-handle_pagefault(uintptr_t vaddr, uint32_t cause)
+static int
+_pagefault_handle(uintptr_t vaddr, uint32_t cause)
 {
         /* This function is called from mm/pagetable.c
 There are 5 types of faults:-
@@ -64,12 +514,13 @@ NOTE: FAULT_READ cannnot take place in OS
 
     pagedir_t *pagetemp;
 
+    ++curproc->p_nfaults;
+
 
     vmarea_t* vma_fault = vmmap_lookup(curproc->p_vmmap, ADDR_TO_PN(vaddr));
 
 	if (vma_fault == NULL) {
-		proc_kill(curproc, EFAULT);
-		return;
+		return _pagefault_fail(cause);
 	}
 	/*check for all these :
 	 FAULT_PRESENT  0x01
@@ -79,32 +530,62 @@ NOTE: FAULT_READ cannnot take place in OS
 	 FAULT_EXEC     0x10
 	 */
     if ((cause & FAULT_PRESENT) && !(vma_fault->vma_prot & PROT_READ)) {
-         proc_kill(curproc, EFAULT);
-        return;
+         return _pagefault_fail(cause);
     }
     if ((cause & FAULT_WRITE) && !(vma_fault->vma_prot & PROT_WRITE)) {
-        proc_kill(curproc, EFAULT);
-        return;
+        return _pagefault_fail(cause);
     }
      if ((cause & FAULT_EXEC) && !(vma_fault->vma_prot & PROT_EXEC)) {
-        proc_kill(curproc, EFAULT);
-        return;
+        return _pagefault_fail(cause);
     }
     if ((cause & FAULT_RESERVED) && (vma_fault->vma_prot & PROT_NONE)) {
-         proc_kill(curproc, EFAULT);
-        return;
+         return _pagefault_fail(cause);
     }
 
-    pframe_t* res_pframe = NULL;
+    if (0 == _pagefault_map_large(vma_fault, vaddr)) {
+        return 0;
+    }
 
-    uint32_t arg2 = (ADDR_TO_PN(vaddr)) - (vma_fault->vma_start) + (vma_fault->vma_off);
+    int ret = (FAULT_WRITE & cause) ? _pagefault_map_write(vma_fault, vaddr)
+                                    : _pagefault_map_read(vma_fault, vaddr);
+    if (ret < 0) {
+        dbg(DBG_VM, "could not map 0x%08x: %d\n", vaddr, ret);
+        _pagefault_fail(cause);
+        return ret;
+    }
 
-	int ret = pframe_get(vma_fault->vma_obj, arg2 ,	&res_pframe);
-	if (ret < 0) {
-		return;
-	}
+    /* The fault is resolved, pages brought in ahead of it do not count */
+    curthr->kt_faultev &= ~FAULT_EV_ACTIVE;
 
-    uintptr_t pageaddr=pt_virt_to_phys((uint32_t)res_pframe->pf_addr);
-    pt_map(curproc->p_pagedir,(uintptr_t)PAGE_ALIGN_DOWN(vaddr),pageaddr,PD_PRESENT|PD_WRITE|PD_USER, PT_PRESENT|PT_WRITE|PT_USER);
+    if (MADV_SEQUENTIAL == vma_fault->vma_advice) {
+        _pagefault_read_ahead(vma_fault, vaddr);
+#if FAULT_AROUND_PAGES > 0
+    } else if (MADV_RANDOM != vma_fault->vma_advice) {
+        _pagefault_map_around(vma_fault, vaddr);
+#endif
+    }
+
+    if (0 != curproc->p_rsslimit && curproc->p_nresident > curproc->p_rsslimit
+        && curproc->p_vmmap->vmm_proc == curproc) {
+        _pagefault_trim(vaddr);
+    }
+    return 0;
+}
+
+int
+handle_pagefault(uintptr_t vaddr, uint32_t cause)
+{
+        uint64_t start = rdtsc();
+        uint64_t cycles;
+        int ret;
 
+        curthr->kt_faultev = FAULT_EV_ACTIVE;
+        ret = _pagefault_handle(vaddr, cause);
+        if (0 == ret) {
+                cycles = rdtsc() - start;
+                _pagefault_count(&curproc->p_faultstats, curthr->kt_faultev, cycles);
+                _pagefault_count(&pagefault_stats, curthr->kt_faultev, cycles);
+        }
+        curthr->kt_faultev = 0;
+        return ret;
 }
@@ -1,5 +1,7 @@
+#include "config.h"
 #include "globals.h"
 #include "errno.h"
+#include "limits.h"
 
 #include "util/string.h"
 #include "util/debug.h"
@@ -11,20 +13,42 @@
 #include "mm/slab.h"
 #include "mm/tlb.h"
 
+#include "proc/sched.h"
+
 #include "vm/vmmap.h"
 #include "vm/shadow.h"
+#include "vm/anon.h"
 #include "vm/shadowd.h"
-
-#define SHADOW_SINGLETON_THRESHOLD 5
+#include "vm/swap.h"
+#include "vm/pagefault.h"
 
 int shadow_count = 0; /* for debugging/verification purposes */
-#ifdef __SHADOWD__
+
 /*
- * number of shadow objects with a single parent, that is another shadow
- * object in the shadow objects tree(singletons)
+ * A shadow object as allocated by shadow_create(). The mmobj must
+ * come first, everything outside this file only sees that part.
+ *
+ * Each shadow object keeps a list of the shadow objects directly
+ * above it, so that when it is left with a single one of them it
+ * knows which object to fold itself into.
  */
-static int shadow_singleton_count = 0;
-#endif
+typedef struct shadow {
+        mmobj_t          sh_mmobj;
+        list_t           sh_children; /* shadow objects whose mmo_shadowed is us */
+        list_link_t      sh_clink;    /* link on our mmo_shadowed's sh_children */
+        list_link_t      sh_qlink;    /* link on shadow_collapse_queue */
+        list_t           sh_swapped;  /* pages with a copy in swap (see vm/swap.c) */
+} shadow_t;
+
+#define SHADOW(o) ((shadow_t *)(o))
+
+/*
+ * Shadow objects which lost a child since they were last looked at.
+ * Each queued object holds a reference of the queue's.
+ */
+static list_t shadow_collapse_queue;
+static int shadow_collapse_pending = 0;
+static int shadow_collapsing = 0;
 
 static slab_allocator_t *shadow_allocator;
 
@@ -52,8 +76,9 @@ static mmobj_ops_t shadow_mmobj_ops = {
 void
 shadow_init()
 {
-        shadow_allocator = slab_allocator_create("mmobj", sizeof(mmobj_t));
+        shadow_allocator = slab_allocator_create("shadow", sizeof(shadow_t));
         KASSERT(shadow_allocator);
+        list_init(&shadow_collapse_queue);
         dbg(DBG_PRINT, "(GRADING3A 6.a)Shadow object successfully created\n ");
 	/*NOT_YET_IMPLEMENTED("VM: shadow_init");*/
 }
@@ -67,11 +92,141 @@ shadow_init()
 mmobj_t *
 shadow_create()
 {
-	mmobj_t *shadow = (mmobj_t*)slab_obj_alloc(shadow_allocator);
-        memset(shadow, 0, sizeof(mmobj_t));
-        mmobj_init(shadow, &shadow_mmobj_ops);
-        shadow->mmo_refcount=0;        
-        return shadow;
+        shadow_t *sh;
+
+        if (NULL == (sh = (shadow_t *) slab_obj_alloc(shadow_allocator))) {
+                return NULL;
+        }
+        memset(sh, 0, sizeof(shadow_t));
+        mmobj_init(&sh->sh_mmobj, &shadow_mmobj_ops);
+        list_init(&sh->sh_children);
+        list_link_init(&sh->sh_clink);
+        list_link_init(&sh->sh_qlink);
+        list_init(&sh->sh_swapped);
+        shadow_count++;
+        return &sh->sh_mmobj;
+}
+
+/*
+ * Creates a shadow object on top of below, with a reference count of
+ * 1. The new object takes a reference of its own on below, the
+ * caller's reference is left alone.
+ */
+mmobj_t *
+shadow_create_over(mmobj_t *below)
+{
+        mmobj_t *o;
+
+        if (NULL == (o = shadow_create())) {
+                return NULL;
+        }
+        o->mmo_ops->ref(o);
+        below->mmo_ops->ref(below);
+        o->mmo_shadowed = below;
+        o->mmo_un.mmo_bottom_obj = mmobj_bottom_obj(below);
+        if (mmobj_is_shadow(below)) {
+                list_insert_tail(&SHADOW(below)->sh_children, &SHADOW(o)->sh_clink);
+        }
+        return o;
+}
+
+int
+mmobj_is_shadow(mmobj_t *o)
+{
+        return &shadow_mmobj_ops == o->mmo_ops;
+}
+
+list_t *
+shadow_swapped(mmobj_t *o)
+{
+        return &SHADOW(o)->sh_swapped;
+}
+
+static void
+_shadow_collapse_enqueue(shadow_t *sh)
+{
+        if (list_link_is_linked(&sh->sh_qlink)) {
+                return;
+        }
+        sh->sh_mmobj.mmo_ops->ref(&sh->sh_mmobj);
+        list_insert_tail(&shadow_collapse_queue, &sh->sh_qlink);
+        shadow_collapse_pending++;
+}
+
+/*
+ * Folds a dequeued shadow object into its only child if it has been
+ * left with one, then drops the queue's reference on it.
+ *
+ * An object is left with a single child when nothing but that child
+ * (and the queue) refers to it apart from its own pages: every vmarea
+ * refers to the top of its chain, never to an object with children. Its
+ * pages, resident or in swap, move up into the child where the child
+ * does not have a newer copy, and the child is relinked to shadow
+ * whatever the object shadowed, which takes the object out of the tree.
+ */
+static void
+_shadow_collapse(shadow_t *sh)
+{
+        mmobj_t *o = &sh->sh_mmobj;
+        mmobj_t *c, *below;
+        shadow_t *child;
+        pframe_t *pf;
+
+again:
+        if (o->mmo_refcount - o->mmo_nrespages == 2 && !list_empty(&sh->sh_children)
+            && sh->sh_children.l_next == sh->sh_children.l_prev) {
+                child = list_head(&sh->sh_children, shadow_t, sh_clink);
+                c = &child->sh_mmobj;
+
+                list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
+                        if (pframe_is_busy(pf)) {
+                                /* Only a fill which started while o
+                                 * was still on top can be in flight */
+                                sched_sleep_on(&pf->pf_waitq);
+                                goto again;
+                        }
+                        pframe_migrate(pf, c);
+                } list_iterate_end();
+                KASSERT(0 == o->mmo_nrespages);
+                swap_migrate(o, c);
+
+                below = o->mmo_shadowed;
+                below->mmo_ops->ref(below);
+                c->mmo_shadowed = below;
+                list_remove(&child->sh_clink);
+                if (mmobj_is_shadow(below)) {
+                        list_insert_tail(&SHADOW(below)->sh_children, &child->sh_clink);
+                }
+                dbg(DBG_VM, "collapsed shadow object %p into %p\n", o, c);
+                /* c's reference, the queue's is still held */
+                o->mmo_ops->put(o);
+        }
+        o->mmo_ops->put(o);
+}
+
+/*
+ * Collapses at most max of the queued shadow objects, returning how
+ * many are still waiting. Objects queued while this runs (collapsing
+ * one frees it, which may leave the object below it with a single
+ * child) are picked up by the same loop.
+ */
+int
+shadow_collapse_queued(int max)
+{
+        shadow_t *sh;
+
+        if (shadow_collapsing) {
+                return shadow_collapse_pending;
+        }
+        shadow_collapsing = 1;
+        while (0 < max-- && !list_empty(&shadow_collapse_queue)) {
+                sh = list_head(&shadow_collapse_queue, shadow_t, sh_qlink);
+                list_remove(&sh->sh_qlink);
+                shadow_collapse_pending--;
+                _shadow_collapse(sh);
+        }
+        shadow_collapsing = 0;
+        return shadow_collapse_pending;
 }
 
 /* Implementation of mmobj entry points: */
@@ -100,29 +255,63 @@ shadow_ref(mmobj_t *o)
 static void
 shadow_put(mmobj_t *o)
 {
-        /*NOT_YET_IMPLEMENTED("VM:_done shadow_put");*/
 	KASSERT(o && (0 < o->mmo_refcount) && (&shadow_mmobj_ops == o->mmo_ops));
 	dbg(DBG_PRINT, "(GRADING3A 6.c)Reference count of the shadow object is greater than 0\n ");
-        if ( o->mmo_refcount > o->mmo_nrespages )
-                o->mmo_refcount--;
-        if ( o->mmo_nrespages == 0  )
-                slab_obj_free(shadow_allocator,o);
-
-        else if ( o->mmo_nrespages != 0 &&
-                 o-> mmo_refcount == o->mmo_nrespages )
-        {
-                pframe_t* pf = NULL;
-                list_iterate_begin(&(o->mmo_respages), pf, pframe_t, pf_olink)
-		{
-			  if (pframe_is_busy(pf))
-                                      sched_sleep_on(&pf->pf_waitq);
-                        pframe_unpin(pf);
-                        pframe_free(pf);
-                } list_iterate_end();
-        }
 
+        if (o->mmo_refcount - 1 == o->mmo_nrespages) {
+                /* Only the resident pages refer to o now. Each page drops
+                 * its reference as it is freed, ours is dropped last */
+                pframe_release_all(o);
+        }
+        if (0 == --o->mmo_refcount) {
+                mmobj_t *shadowed = o->mmo_shadowed;
+                KASSERT(list_empty(&SHADOW(o)->sh_children));
+                KASSERT(!list_link_is_linked(&SHADOW(o)->sh_qlink));
+                if (list_link_is_linked(&SHADOW(o)->sh_clink)) {
+                        /* shadowed lost a child, it may be down to one */
+                        list_remove(&SHADOW(o)->sh_clink);
+                        _shadow_collapse_enqueue(SHADOW(shadowed));
+                }
+                slab_obj_free(shadow_allocator, o);
+                shadow_count--;
+                if (NULL != shadowed) {
+                        shadowed->mmo_ops->put(shadowed);
+                }
+#ifdef __SHADOWD__
+                /* Do a bounded amount of the work here and leave any
+                 * long tail to shadowd */
+                if (0 < shadow_collapse_queued(SHADOW_COLLAPSE_BATCH)) {
+                        shadowd_wakeup();
+                }
+#else
+                shadow_collapse_queued(INT_MAX);
+#endif
+        }
 }
 
+/*
+ * Finds the copy of the page which o sees in the chain below it, if
+ * o is the only object which sees it: every object above it in the
+ * chain is referred to by the one above it and nothing else. A copy
+ * which is in swap is left alone, o makes its own from it.
+ */
+static pframe_t *
+_shadow_sole_page(mmobj_t *o, uint32_t pagenum)
+{
+        mmobj_t *cur;
+        pframe_t *pf;
+
+        for (cur = o->mmo_shadowed; mmobj_is_shadow(cur) && 1 == cur->mmo_refcount - cur->mmo_nrespages;
+             cur = cur->mmo_shadowed) {
+                if (NULL != (pf = pframe_get_resident(cur, pagenum))) {
+                        return pframe_is_busy(pf) ? NULL : pf;
+                }
+                if (swap_has(cur, pagenum)) {
+                        return NULL;
+                }
+        }
+        return NULL;
+}
 
 /* This function looks up the given page in this shadow object. The
  * forwrite argument is true if the page is being looked up for
@@ -134,36 +323,28 @@ shadow_put(mmobj_t *o)
 static int
 shadow_lookuppage(mmobj_t *o, uint32_t pagenum, int forwrite, pframe_t **pf)
 {
-        if(forwrite==0)
-        {
-                list_link_t *link = NULL;
-                pframe_t *pfrm = NULL;
-		link = o->mmo_respages.l_next;
-		while(link!=&(o->mmo_respages))
-                {
-                        pfrm = list_item(link, pframe_t, pf_olink);
-                        if(pfrm->pf_pagenum == pagenum)
-                        {
-                                pf = &pfrm;
-                                return 0;
-                        }
-			link = link->l_next;
-                }
-                if(o->mmo_shadowed==NULL)
-                        return -1;
+        mmobj_t *cur;
+        pframe_t *sole;
 
-                return shadow_lookuppage(o->mmo_shadowed, pagenum, 0, pf);
-        }
-        else
-        {
-                int status = pframe_get(o, pagenum, pf);
-                if(status<0 && pf==NULL)
-                        return -1;
-        	return shadow_fillpage(o, *pf);
+        if (forwrite) {
+                /* If whoever shared the page with o is gone (usually the
+                 * other side of a fork, which exited or exec'd) and it
+                 * has not been collapsed into o yet, o can take the page
+                 * over instead of copying it */
+                if (NULL == pframe_get_resident(o, pagenum)
+                    && NULL != (sole = _shadow_sole_page(o, pagenum))) {
+                        pframe_migrate(sole, o);
+                }
+                /* shadow_fillpage makes o's own copy if it has none */
+                return pframe_get(o, pagenum, pf);
         }
 
-        /*NOT_YET_IMPLEMENTED("VM: shadow_lookuppage");
-        return 0;*/
+        for (cur = o; mmobj_is_shadow(cur); cur = cur->mmo_shadowed) {
+                if (NULL != pframe_get_resident(cur, pagenum) || swap_has(cur, pagenum)) {
+                        return pframe_get(cur, pagenum, pf);
+                }
+        }
+        return pframe_lookup(cur, pagenum, 0, pf);
 }
 
 /* As per the specification in mmobj.h, fill the page frame starting
@@ -181,24 +362,42 @@ shadow_fillpage(mmobj_t *o, pframe_t *pf)
 	dbg(DBG_PRINT, "(GRADING3A 6.d)PF_BUSY flag set for the page frame\n ");
 	KASSERT(!pframe_is_pinned(pf));
 	dbg(DBG_PRINT, "(GRADING3A 6.d)Page frame is NOT pinned\n ");
-        list_link_t *link = link = o->mmo_respages.l_next;
-        pframe_t *pfrm = NULL;
-	
-	while(link!=&(o->mmo_respages))
-        {
-           pfrm = list_item(link, pframe_t, pf_olink);
-           if(pfrm->pf_pagenum == pf->pf_pagenum)
-           {
-             /*memcpy(pf->pf_addr+PAGE_OFFSET(pf->pf_addr),
-		    pfrm->pf_addr + PAGE_OFFSET(pfrm->pf_addr),
-		    PAGE_SIZE - PAGE_OFFSET(pfrm->pf_addr)); */
-             return 0;
-           }
-	   link = link->l_next;
-        }
-        if(NULL == o->mmo_shadowed)
-                return -1;
-        return shadow_fillpage(o->mmo_shadowed, pf);
+
+        pframe_t *src = NULL;
+        mmobj_t *cur;
+        int ret;
+
+        /* o's own copy which was paged out */
+        if (0 != (ret = swap_in(pf))) {
+                return 0 > ret ? ret : 0;
+        }
+
+        for (cur = o->mmo_shadowed; mmobj_is_shadow(cur); cur = cur->mmo_shadowed) {
+                if (NULL != pframe_get_resident(cur, pf->pf_pagenum) || swap_has(cur, pf->pf_pagenum)) {
+                        break;
+                }
+        }
+        if (mmobj_is_anon(cur) && NULL == pframe_get_resident(cur, pf->pf_pagenum)
+            && !swap_has(cur, pf->pf_pagenum)) {
+                /* Nobody has written the page yet, don't make the
+                 * anonymous object allocate one just to copy zeroes */
+                memset(pframe_kmap(pf, PT_TMP_SLOT_KMAP0), 0, PAGE_SIZE);
+                pagefault_note(FAULT_EV_ZERO);
+        } else {
+                /* A page merged by ksmd is copied from the merged page,
+                 * cur does not need its own copy back for that */
+                if (NULL == (src = swap_merged_page(cur, pf->pf_pagenum))
+                    && 0 > (ret = pframe_lookup(o->mmo_shadowed, pf->pf_pagenum, 0, &src))) {
+                        return ret;
+                }
+                memcpy(pframe_kmap(pf, PT_TMP_SLOT_KMAP0), pframe_kmap(src, PT_TMP_SLOT_KMAP1), PAGE_SIZE);
+                pagefault_note(FAULT_EV_COW);
+        }
+        if (!swap_enabled()) {
+                /* There is nowhere to page a private copy out to */
+                pframe_pin(pf);
+        }
+        return 0;
 }
 
 /* These next two functions are not difficult. */
@@ -216,13 +415,6 @@ shadow_dirtypage(mmobj_t *o, pframe_t *pf)
 static int
 shadow_cleanpage(mmobj_t *o, pframe_t *pf)
 {
-        pframe_t *pfrm;
-        int status = pframe_get(o, pf->pf_pagenum, &pfrm);
-        if(status<0)
-                return status;
-       /* memcpy(pfrm->pf_addr+PAGE_OFFSET(pfrm->pf_addr),
-	       pf->pf_addr+PAGE_OFFSET(pf->pf_addr),
-	       PAGE_SIZE-PAGE_OFFSET(pf->pf_addr));*/
-
-	return 0;
+        /* A private copy has nowhere to go but swap */
+        return swap_out(pf);
 }
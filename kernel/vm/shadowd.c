@@ -1,3 +1,4 @@
+#include "config.h"
 #include "types.h"
 #include "globals.h"
 
@@ -11,6 +12,8 @@
 #include "proc/sched.h"
 #include "proc/kthread.h"
 
+#include "vm/shadow.h"
+
 #ifdef __SHADOWD__
 static ktqueue_t shadowd_waitq, kmem_alloc_waitq;
 static int shadowd_initialized = 0;
@@ -36,72 +39,26 @@ shadowd_alloc_sleep()
 }
 
 /*
- * The shadow daemon main routine. This should periodically
- * traverese all the shadow object trees, removing any
- * unnecessary shadow objects.
- *
- * A shadow object is considered unnecessary if it is not top most
- * (directly descendant from a vmarea), and if it has only 1
- * parent.
- *
- * For each shadow object we want to migrate all of its pages up
- * to the closest mmobj with at least 2 parents, or the topmost
- * one, then remove this object from the tree (if we remove it any
- * earlier we can cause big problems).
+ * The shadow daemon main routine.
  *
+ * Unnecessary shadow objects (ones which are not top most and have
+ * only one child) are collapsed as soon as they become unnecessary,
+ * when the object which was their other child is released, see
+ * shadow_collapse_queued(). That only does a bounded amount of work
+ * at a time, so shadowd is woken to catch up on whatever is still
+ * queued, again a batch at a time, and when memory runs out.
  */
 
 static void *
 shadowd(int arg1, void *arg2)
 {
         while (1) {
-                proc_t *p;
-                /* for each process, go through its vmareas */
-                list_iterate_begin(proc_list(), p, proc_t, p_list_link) {
-                        /* all of the dead process's shadow objects will be takenen care of by init */
-                        if (PROC_RUNNING == p->p_state) {
-                                vmarea_t *vma;
-                                list_iterate_begin(&p->p_vmmap->vmm_list, vma, vmarea_t, vma_plink) {
-                                        mmobj_t *last = vma->vma_obj, *o = last->mmo_shadowed;
-                                        /* ref last, so if all processes on this branch die while shadowd is
-                                         * sleeping, the branch won't get destroyed until shadowd() is done
-                                         * with it */
-                                        last->mmo_ops->ref(last);
-                                        while (NULL != o && NULL != o->mmo_shadowed) {
-                                                mmobj_t *shadow = o->mmo_shadowed;
-                                                /* iff the object has only one parent, and is not right under vm_area */
-                                                KASSERT(o != last);
-                                                if (o->mmo_refcount - o->mmo_nrespages == 1) {
-                                                        /* migrate all its pages to last, and remove it from the shadow tree */
-                                                        pframe_t *pf;
-                                                        list_iterate_begin(&o->mmo_respages, pf, pframe_t, pf_olink) {
-                                                                /* Because the operations that could be
-                                                                 * performed with an intermediate shadow object
-                                                                 * to make pages busy are non-blocking,
-                                                                 * we always expect to see non-busy pages. */
-                                                                KASSERT(!pframe_is_busy(pf));
-                                                                /* o has refcount 1+nrespages, so this won't delete it yet */
-                                                                pframe_migrate(pf, last);
-                                                        } list_iterate_end();
-                                                        last->mmo_shadowed = o->mmo_shadowed;
-                                                        /* Ref o's shadowed, so we don't accidentally delete it when we
-                                                         * finally put o */
-                                                        o->mmo_shadowed->mmo_ops->ref(o->mmo_shadowed);
-                                                        KASSERT(o->mmo_refcount == 1 && o->mmo_nrespages == 0);
-                                                        o->mmo_ops->put(o);
-                                                } else {
-                                                        KASSERT(o->mmo_refcount - o->mmo_nrespages == 2);
-                                                        o->mmo_ops->ref(o);
-                                                        last->mmo_ops->put(last);
-                                                        last = o;
-                                                }
-                                                o = shadow;
-                                        }
-                                        KASSERT(NULL != last);
-                                        last->mmo_ops->put(last);
-                                } list_iterate_end();
-                        }
-                } list_iterate_end();
+                while (0 < shadow_collapse_queued(SHADOW_COLLAPSE_BATCH)) {
+                        /* let everyone else run between batches */
+                        sched_broadcast_on(&kmem_alloc_waitq);
+                        sched_make_runnable(curthr);
+                        sched_switch();
+                }
 
                 sched_broadcast_on(&kmem_alloc_waitq);
                 if (sched_cancellable_sleep_on(&shadowd_waitq) < 0) {
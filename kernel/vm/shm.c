@@ -0,0 +1,143 @@
+#include "config.h"
+#include "types.h"
+#include "globals.h"
+#include "errno.h"
+
+#include "util/debug.h"
+#include "util/string.h"
+#include "util/printf.h"
+
+#include "fs/fcntl.h"
+
+#include "mm/mm.h"
+#include "mm/page.h"
+#include "mm/mmobj.h"
+#include "mm/kmalloc.h"
+
+#include "vm/anon.h"
+#include "vm/shm.h"
+
+/*
+ * Named shared memory segments. A segment is an anonymous object which
+ * any process can map by name, rather than only children inheriting a
+ * MAP_SHARED | MAP_ANON mapping. Like all anonymous memory its pages
+ * are zeroes until written and only ever go to swap, never to a file
+ * system, so processes can hand data to each other through it without
+ * a copy. The segment keeps a reference to its object until it is
+ * unlinked, each mapping keeps one of its own.
+ */
+typedef struct shm_seg {
+        char           *shm_name;       /* NULL if the slot is free */
+        uint32_t        shm_npages;
+        mmobj_t        *shm_obj;
+} shm_seg_t;
+
+static shm_seg_t shm_segs[SHM_MAX_SEGMENTS];
+
+static int
+_shm_find(const char *name)
+{
+        int id;
+
+        for (id = 0; id < SHM_MAX_SEGMENTS; ++id) {
+                if (NULL != shm_segs[id].shm_name && 0 == strcmp(name, shm_segs[id].shm_name)) {
+                        return id;
+                }
+        }
+        return -ENOENT;
+}
+
+int
+do_shm_open(const char *name, size_t len, int oflag)
+{
+        size_t namelen = strlen(name);
+        shm_seg_t *seg;
+        int id;
+
+        if (0 == namelen) {
+                return -EINVAL;
+        }
+        if (NAME_LEN < namelen) {
+                return -ENAMETOOLONG;
+        }
+        if (0 <= (id = _shm_find(name)) || !(O_CREAT & oflag)) {
+                return id;
+        }
+
+        if (0 == len || USER_MEM_HIGH - USER_MEM_LOW < len) {
+                return -EINVAL;
+        }
+        for (id = 0; id < SHM_MAX_SEGMENTS && NULL != shm_segs[id].shm_name; ++id) {
+                ;
+        }
+        if (SHM_MAX_SEGMENTS == id) {
+                return -ENFILE;
+        }
+        seg = &shm_segs[id];
+        if (NULL == (seg->shm_name = kmalloc(namelen + 1))) {
+                return -ENOMEM;
+        }
+        if (NULL == (seg->shm_obj = anon_create())) {
+                kfree(seg->shm_name);
+                seg->shm_name = NULL;
+                return -ENOMEM;
+        }
+        strcpy(seg->shm_name, name);
+        seg->shm_npages = ADDR_TO_PN(PAGE_ALIGN_UP(len));
+        dbg(DBG_VM, "shm: created %s with %u pages as %d\n", name, seg->shm_npages, id);
+        return id;
+}
+
+int
+do_shm_unlink(const char *name)
+{
+        mmobj_t *obj;
+        int id;
+
+        if (0 > (id = _shm_find(name))) {
+                return id;
+        }
+        /* The slot is free before dropping the reference blocks */
+        obj = shm_segs[id].shm_obj;
+        kfree(shm_segs[id].shm_name);
+        shm_segs[id].shm_name = NULL;
+        shm_segs[id].shm_obj = NULL;
+        obj->mmo_ops->put(obj);
+        return 0;
+}
+
+int
+shm_get(int id, off_t off, size_t len, mmobj_t **ret)
+{
+        shm_seg_t *seg;
+
+        if (0 > id || SHM_MAX_SEGMENTS <= id || NULL == (seg = &shm_segs[id])->shm_name) {
+                return -EBADF;
+        }
+        if ((uint32_t)ADDR_TO_PN(off) > seg->shm_npages
+            || seg->shm_npages - ADDR_TO_PN(off) < ADDR_TO_PN(PAGE_ALIGN_UP(len))) {
+                return -EINVAL;
+        }
+        seg->shm_obj->mmo_ops->ref(seg->shm_obj);
+        *ret = seg->shm_obj;
+        return 0;
+}
+
+size_t
+shm_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+        int id;
+
+        iprintf(&buf, &size, "%3s %-28s %6s %6s %5s\n", "ID", "NAME", "PAGES", "RES", "REFS");
+        for (id = 0; id < SHM_MAX_SEGMENTS; ++id) {
+                shm_seg_t *seg = &shm_segs[id];
+
+                if (NULL != seg->shm_name) {
+                        iprintf(&buf, &size, "%3d %-28s %6u %6u %5d\n", id, seg->shm_name,
+                                seg->shm_npages, seg->shm_obj->mmo_nrespages,
+                                seg->shm_obj->mmo_refcount - seg->shm_obj->mmo_nrespages);
+                }
+        }
+        return size;
+}
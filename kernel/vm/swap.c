@@ -0,0 +1,480 @@
+#include "config.h"
+#include "globals.h"
+#include "errno.h"
+#include "types.h"
+
+#include "util/debug.h"
+#include "util/list.h"
+#include "util/string.h"
+#include "util/init.h"
+#include "util/printf.h"
+#include "util/lzf.h"
+
+#include "drivers/blockdev.h"
+#include "drivers/dev.h"
+
+#include "mm/mm.h"
+#include "mm/page.h"
+#include "mm/slab.h"
+#include "mm/kmalloc.h"
+#include "mm/mmobj.h"
+#include "mm/pframe.h"
+
+#include "proc/kmutex.h"
+
+#include "main/cpuid.h"
+
+#include "vm/anon.h"
+#include "vm/shadow.h"
+#include "vm/swap.h"
+#include "vm/pagefault.h"
+#include "vm/ksm.h"
+
+/*
+ * Swap space is the part of disk0 after the blocks of the file system,
+ * so that it needs no disk of its own: the second ATA channel holds the
+ * CD-ROM weenix boots from. The disk image is made big enough for both
+ * (see user/Makefile).
+ */
+#define SWAP_DEVID      MKDEVID(DISK_MAJOR, 0)
+#ifdef __SWAP_BLOCKS__
+#define SWAP_START      __DISK_BLOCKS__
+#define SWAP_NSLOTS     __SWAP_BLOCKS__
+#else
+#define SWAP_START      0
+#define SWAP_NSLOTS     0
+#endif
+
+#define SWAP_BITS       (8 * sizeof(uint32_t))
+#define SWAP_NOSLOT     ((uint32_t)-1)
+
+/*
+ * The copy of a page of an anonymous or shadow object which has been
+ * paged out. It is either compressed in the pool, in which case
+ * se_zdata is the kmalloc'd buffer holding it and se_slot is
+ * SWAP_NOSLOT, or in a slot on disk. An entry may instead refer to a
+ * page which identical pages were merged into by ksmd, in se_ksm, and
+ * then holds a reference to it. Entries are found by object and
+ * page number through swap_hash, and are also kept on a list in their
+ * object so that they can be freed along with it. They do not hold a
+ * reference to the object.
+ */
+typedef struct swapent {
+        mmobj_t         *se_obj;
+        uint32_t         se_pagenum;
+        uint32_t         se_slot;
+        void            *se_zdata;
+        uint32_t         se_zlen;
+        ksm_page_t      *se_ksm;
+        list_link_t      se_hlink;      /* link on the swap_hash chain */
+        list_link_t      se_olink;      /* link on the object's list */
+} swapent_t;
+
+#define hash_swap(obj, pagenum)  ((((uint32_t)(obj)) + (pagenum)) % SWAP_HASH_SIZE)
+static list_t swap_hash[SWAP_HASH_SIZE];
+
+static slab_allocator_t *swapent_allocator;
+
+static blockdev_t *swap_dev = NULL;
+static uint32_t *swap_bitmap;
+static uint32_t swap_hint = 0;
+
+uint32_t swap_nslots = 0;
+uint32_t swap_nused = 0;
+
+/*
+ * Pages are compressed into the pool while it has room, which turns
+ * most page-ins into a decompression rather than a disk read. Pages
+ * which do not compress well, and pages paged out while the pool is
+ * full, go to disk.
+ */
+static uint32_t swap_zmax = 0;          /* bytes the pool may hold */
+static uint32_t swap_zbytes = 0;        /* bytes the pool holds */
+static uint32_t swap_zpages = 0;        /* pages the pool holds */
+static char swap_zbuf[SWAP_ZPOOL_MAX_LEN];
+
+static uint32_t swap_nzstores = 0;
+static uint32_t swap_nzrejects = 0;     /* compressed badly, or the pool was full */
+static uint32_t swap_nzloads = 0;
+static uint32_t swap_ndiskloads = 0;
+static uint64_t swap_zload_cycles = 0;
+static uint64_t swap_diskload_cycles = 0;
+
+/* Pages in high memory go through this page on their way to and from
+ * the disk, which wants a buffer in the kernel's address space */
+static char *swap_bounce;
+static kmutex_t swap_bounce_mutex;
+
+void
+swap_init(void)
+{
+        int i;
+
+        for (i = 0; i < SWAP_HASH_SIZE; ++i) {
+                list_init(&swap_hash[i]);
+        }
+        swapent_allocator = slab_allocator_create("swapent", sizeof(swapent_t));
+        KASSERT(NULL != swapent_allocator);
+        kmutex_init(&swap_bounce_mutex);
+
+        swap_zmax = page_free_count() / 100 * SWAP_ZPOOL_PERCENT * PAGE_SIZE;
+        dbg(DBG_VM, "swap: compressed pool of up to %u bytes\n", swap_zmax);
+
+        if (0 == SWAP_NSLOTS || NULL == (swap_dev = blockdev_lookup(SWAP_DEVID))) {
+                dbg(DBG_VM, "no swap device\n");
+                swap_dev = NULL;
+                return;
+        }
+        swap_bitmap = kmalloc((SWAP_NSLOTS + SWAP_BITS - 1) / SWAP_BITS * sizeof(uint32_t));
+        swap_bounce = page_alloc();
+        KASSERT(NULL != swap_bitmap && NULL != swap_bounce);
+        memset(swap_bitmap, 0, (SWAP_NSLOTS + SWAP_BITS - 1) / SWAP_BITS * sizeof(uint32_t));
+        swap_nslots = SWAP_NSLOTS;
+        dbg(DBG_VM, "swap: %u slots on disk0 from block %u\n", swap_nslots, SWAP_START);
+}
+init_func(swap_init);
+
+int
+swap_enabled(void)
+{
+        return NULL != swap_dev || 0 != swap_zmax;
+}
+
+/*
+ * Returns a free slot, searching from just after the last one handed
+ * out so that pages written out together tend to be near each other on
+ * the disk, or -ENOSPC.
+ */
+static int
+_swap_slot_alloc(void)
+{
+        uint32_t i, slot;
+
+        if (swap_nused == swap_nslots) {
+                return -ENOSPC;
+        }
+        for (i = 0; i < swap_nslots; ++i) {
+                slot = (swap_hint + i) % swap_nslots;
+                if (!(swap_bitmap[slot / SWAP_BITS] & (1 << (slot % SWAP_BITS)))) {
+                        swap_bitmap[slot / SWAP_BITS] |= 1 << (slot % SWAP_BITS);
+                        swap_hint = slot + 1;
+                        swap_nused++;
+                        return slot;
+                }
+        }
+        panic("swap_nused is wrong\n");
+        return -ENOSPC;
+}
+
+static void
+_swap_slot_free(uint32_t slot)
+{
+        KASSERT(swap_bitmap[slot / SWAP_BITS] & (1 << (slot % SWAP_BITS)));
+        swap_bitmap[slot / SWAP_BITS] &= ~(1 << (slot % SWAP_BITS));
+        swap_nused--;
+}
+
+static list_t *
+_swap_list(mmobj_t *o)
+{
+        KASSERT(mmobj_is_anon(o) || mmobj_is_shadow(o));
+        return mmobj_is_anon(o) ? anon_swapped(o) : shadow_swapped(o);
+}
+
+static swapent_t *
+_swap_lookup(mmobj_t *o, uint32_t pagenum)
+{
+        swapent_t *se;
+
+        list_iterate_begin(&swap_hash[hash_swap(o, pagenum)], se, swapent_t, se_hlink) {
+                if (o == se->se_obj && pagenum == se->se_pagenum) {
+                        return se;
+                }
+        } list_iterate_end();
+        return NULL;
+}
+
+static swapent_t *
+_swap_ent_alloc(mmobj_t *o, uint32_t pagenum)
+{
+        swapent_t *se;
+
+        if (NULL == (se = slab_obj_alloc(swapent_allocator))) {
+                return NULL;
+        }
+        se->se_obj = o;
+        se->se_pagenum = pagenum;
+        se->se_slot = SWAP_NOSLOT;
+        se->se_zdata = NULL;
+        se->se_zlen = 0;
+        se->se_ksm = NULL;
+        list_insert_head(&swap_hash[hash_swap(o, pagenum)], &se->se_hlink);
+        list_insert_tail(_swap_list(o), &se->se_olink);
+        return se;
+}
+
+/* Frees whichever copy of its page se holds, leaving it with none */
+static void
+_swap_ent_clear(swapent_t *se)
+{
+        if (NULL != se->se_zdata) {
+                kfree(se->se_zdata);
+                swap_zbytes -= se->se_zlen;
+                swap_zpages--;
+                se->se_zdata = NULL;
+                se->se_zlen = 0;
+        }
+        if (SWAP_NOSLOT != se->se_slot) {
+                _swap_slot_free(se->se_slot);
+                se->se_slot = SWAP_NOSLOT;
+        }
+        if (NULL != se->se_ksm) {
+                ksm_page_put(se->se_ksm);
+                se->se_ksm = NULL;
+        }
+}
+
+static void
+_swap_free(swapent_t *se)
+{
+        _swap_ent_clear(se);
+        list_remove(&se->se_hlink);
+        list_remove(&se->se_olink);
+        slab_obj_free(swapent_allocator, se);
+}
+
+/*
+ * Reads or writes pf's page from or to the given slot. This blocks.
+ */
+static int
+_swap_io(pframe_t *pf, uint32_t slot, int write)
+{
+        blocknum_t block = SWAP_START + slot;
+        int ret;
+
+        if (NULL != pf->pf_addr) {
+                return write ? swap_dev->bd_ops->write_block(swap_dev, pf->pf_addr, block, 1)
+                       : swap_dev->bd_ops->read_block(swap_dev, pf->pf_addr, block, 1);
+        }
+
+        kmutex_lock(&swap_bounce_mutex);
+        if (write) {
+                memcpy(swap_bounce, pframe_kmap(pf, PT_TMP_SLOT_KMAP0), PAGE_SIZE);
+                ret = swap_dev->bd_ops->write_block(swap_dev, swap_bounce, block, 1);
+        } else if (0 <= (ret = swap_dev->bd_ops->read_block(swap_dev, swap_bounce, block, 1))) {
+                memcpy(pframe_kmap(pf, PT_TMP_SLOT_KMAP0), swap_bounce, PAGE_SIZE);
+        }
+        kmutex_unlock(&swap_bounce_mutex);
+        return ret;
+}
+
+int
+swap_has(mmobj_t *o, uint32_t pagenum)
+{
+        return NULL != _swap_lookup(o, pagenum);
+}
+
+pframe_t *
+swap_merged_page(mmobj_t *o, uint32_t pagenum)
+{
+        swapent_t *se = _swap_lookup(o, pagenum);
+
+        return (NULL == se || NULL == se->se_ksm) ? NULL : se->se_ksm->kp_pf;
+}
+
+int
+swap_merge(mmobj_t *o, uint32_t pagenum, ksm_page_t *kp)
+{
+        swapent_t *se = _swap_lookup(o, pagenum);
+
+        if (NULL == se && NULL == (se = _swap_ent_alloc(o, pagenum))) {
+                return -ENOMEM;
+        }
+        _swap_ent_clear(se);
+        se->se_ksm = kp;
+        return 0;
+}
+
+/*
+ * Compresses pf's page into a new buffer of the pool. Returns the
+ * buffer, and its length in zlen, or NULL if the page does not
+ * compress well enough or there is no room for it.
+ */
+static void *
+_swap_compress(pframe_t *pf, uint32_t *zlen)
+{
+        const void *page;
+        void *zdata;
+
+        if (swap_zbytes >= swap_zmax) {
+                return NULL;
+        }
+        page = (NULL != pf->pf_addr) ? pf->pf_addr : pframe_kmap(pf, PT_TMP_SLOT_KMAP0);
+        *zlen = lzf_compress(page, PAGE_SIZE, swap_zbuf, sizeof(swap_zbuf));
+        if (0 == *zlen || swap_zbytes + *zlen > swap_zmax
+            || NULL == (zdata = kmalloc(*zlen))) {
+                return NULL;
+        }
+        memcpy(zdata, swap_zbuf, *zlen);
+        return zdata;
+}
+
+int
+swap_out(pframe_t *pf)
+{
+        mmobj_t *o = pf->pf_obj;
+        swapent_t *se = _swap_lookup(o, pf->pf_pagenum);
+        void *zdata;
+        uint32_t zlen;
+        int slot, ret;
+
+        if (NULL != (zdata = _swap_compress(pf, &zlen))) {
+                if (NULL == se && NULL == (se = _swap_ent_alloc(o, pf->pf_pagenum))) {
+                        kfree(zdata);
+                        return -ENOMEM;
+                }
+                _swap_ent_clear(se);
+                se->se_zdata = zdata;
+                se->se_zlen = zlen;
+                swap_zbytes += zlen;
+                swap_zpages++;
+                swap_nzstores++;
+                dbg(DBG_VM, "compressed page %u of obj %p to %u bytes\n",
+                    pf->pf_pagenum, o, zlen);
+                return 0;
+        }
+        if (0 != swap_zmax) {
+                swap_nzrejects++;
+        }
+
+        if (NULL == swap_dev) {
+                return -ENOSPC;
+        }
+        if (NULL != se && SWAP_NOSLOT != se->se_slot) {
+                /* Overwrite the stale copy from when the page was
+                 * last written out */
+                return _swap_io(pf, se->se_slot, 1);
+        }
+
+        if (0 > (slot = _swap_slot_alloc())) {
+                return slot;
+        }
+        if (NULL == se && NULL == (se = _swap_ent_alloc(o, pf->pf_pagenum))) {
+                _swap_slot_free(slot);
+                return -ENOMEM;
+        }
+        _swap_ent_clear(se);
+        se->se_slot = slot;
+
+        /* pf is busy, so the object and se stay around while we block */
+        if (0 > (ret = _swap_io(pf, slot, 1))) {
+                _swap_free(se);
+                return ret;
+        }
+        dbg(DBG_VM, "swapped out page %u of obj %p to slot %d\n", pf->pf_pagenum, o, slot);
+        return 0;
+}
+
+int
+swap_in(pframe_t *pf)
+{
+        swapent_t *se;
+        uint64_t start = rdtsc();
+        void *page;
+        int ret;
+
+        if (NULL == (se = _swap_lookup(pf->pf_obj, pf->pf_pagenum))) {
+                return 0;
+        }
+
+        if (NULL != se->se_ksm) {
+                /* The page was merged with identical ones, this takes
+                 * a private copy again. Everyone seeing the page here
+                 * may have the merged page mapped. */
+                memcpy(pframe_kmap(pf, PT_TMP_SLOT_KMAP0),
+                       pframe_kmap(se->se_ksm->kp_pf, PT_TMP_SLOT_KMAP1), PAGE_SIZE);
+                _swap_free(se);
+                pframe_remove_from_pts(pf);
+                pframe_set_dirty(pf);
+                return 1;
+        }
+
+        if (NULL != se->se_zdata) {
+                page = (NULL != pf->pf_addr) ? pf->pf_addr : pframe_kmap(pf, PT_TMP_SLOT_KMAP0);
+                if (PAGE_SIZE != lzf_decompress(se->se_zdata, se->se_zlen, page, PAGE_SIZE)) {
+                        panic("corrupt page %u of obj %p in the swap pool\n",
+                              pf->pf_pagenum, pf->pf_obj);
+                }
+                /* The pool only holds pages which are out of memory,
+                 * so the page is dirty again until it is next paged
+                 * out */
+                _swap_free(se);
+                pframe_set_dirty(pf);
+                swap_nzloads++;
+                swap_zload_cycles += rdtsc() - start;
+                dbg(DBG_VM, "decompressed page %u of obj %p\n", pf->pf_pagenum, pf->pf_obj);
+                return 1;
+        }
+
+        if (0 > (ret = _swap_io(pf, se->se_slot, 0))) {
+                return ret;
+        }
+        swap_ndiskloads++;
+        swap_diskload_cycles += rdtsc() - start;
+        pagefault_note(FAULT_EV_MAJOR);
+        dbg(DBG_VM, "swapped in page %u of obj %p from slot %u\n", pf->pf_pagenum, pf->pf_obj,
+            se->se_slot);
+        return 1;
+}
+
+void
+swap_discard(mmobj_t *o, uint32_t lopage, uint32_t npages)
+{
+        swapent_t *se;
+
+        list_iterate_begin(_swap_list(o), se, swapent_t, se_olink) {
+                if (se->se_pagenum >= lopage && se->se_pagenum - lopage < npages) {
+                        _swap_free(se);
+                }
+        } list_iterate_end();
+}
+
+void
+swap_migrate(mmobj_t *src, mmobj_t *dest)
+{
+        swapent_t *se;
+
+        list_iterate_begin(_swap_list(src), se, swapent_t, se_olink) {
+                if (NULL != pframe_get_resident(dest, se->se_pagenum)
+                    || NULL != _swap_lookup(dest, se->se_pagenum)) {
+                        _swap_free(se);
+                } else {
+                        list_remove(&se->se_hlink);
+                        list_remove(&se->se_olink);
+                        se->se_obj = dest;
+                        list_insert_head(&swap_hash[hash_swap(dest, se->se_pagenum)], &se->se_hlink);
+                        list_insert_tail(_swap_list(dest), &se->se_olink);
+                }
+        } list_iterate_end();
+}
+
+size_t
+swap_info(const void *arg, char *buf, size_t osize)
+{
+        size_t size = osize;
+
+        iprintf(&buf, &size, "disk slots:   %u of %u used\n", swap_nused, swap_nslots);
+        iprintf(&buf, &size, "pool:         %u pages in %u of %u bytes\n",
+                swap_zpages, swap_zbytes, swap_zmax);
+        if (0 != swap_zbytes) {
+                iprintf(&buf, &size, "compression:  %u%%\n",
+                        swap_zbytes / (swap_zpages * (PAGE_SIZE / 100)));
+        }
+        iprintf(&buf, &size, "pool stores:  %u (%u went to disk)\n",
+                swap_nzstores, swap_nzrejects);
+        iprintf(&buf, &size, "pool loads:   %u, %u cycles each\n", swap_nzloads,
+                0 == swap_nzloads ? 0 : (uint32_t)(swap_zload_cycles / swap_nzloads));
+        iprintf(&buf, &size, "disk loads:   %u, %u cycles each\n", swap_ndiskloads,
+                0 == swap_ndiskloads ? 0 : (uint32_t)(swap_diskload_cycles / swap_ndiskloads));
+        return size;
+}
@@ -23,10 +23,16 @@
 #include "mm/mm.h"
 #include "mm/mman.h"
 #include "mm/mmobj.h"
+#include "mm/pframe.h"
+#include "mm/pagetable.h"
+#include "mm/tlb.h"
 
 static slab_allocator_t *vmmap_allocator;
 static slab_allocator_t *vmarea_allocator;
 
+static int _vmmap_map(vmmap_t *map, vnode_t *file, mmobj_t *shared, uint32_t lopage, uint32_t npages,
+                      int prot, int flags, off_t off, int dir, vmarea_t **new);
+
 void
 vmmap_init(void)
 {
@@ -42,6 +48,12 @@ vmarea_alloc(void)
         vmarea_t *newvma = (vmarea_t *) slab_obj_alloc(vmarea_allocator);
         if (newvma) {
                 newvma->vma_vmmap = NULL;
+                newvma->vma_obj = NULL;
+                newvma->vma_advice = MADV_NORMAL;
+                newvma->vma_nresident = 0;
+                newvma->vma_nswapped = 0;
+                list_link_init(&newvma->vma_plink);
+                list_link_init(&newvma->vma_olink);
         }
         return newvma;
 }
@@ -52,6 +64,235 @@ vmarea_free(vmarea_t *vma)
         KASSERT(NULL != vma);
         slab_obj_free(vmarea_allocator, vma);
 }
+
+/*
+ * Adds nresident and nswapped, which may be negative, to the counts of
+ * pages of vma which are mapped and which were paged out, and to the
+ * totals of the process whose address space vma is in.
+ */
+void
+vmarea_account(vmarea_t *vma, int nresident, int nswapped)
+{
+        proc_t *p = (NULL == vma->vma_vmmap) ? NULL : vma->vma_vmmap->vmm_proc;
+
+        vma->vma_nresident += nresident;
+        vma->vma_nswapped += nswapped;
+        if (NULL != p) {
+                p->p_nresident += nresident;
+                p->p_nswapped += nswapped;
+        }
+}
+
+/*
+ * Recomputes the counts of vma from its process' page table, after
+ * its bounds changed or a range of it was unmapped.
+ */
+void
+vmarea_recount(vmarea_t *vma)
+{
+        uint32_t nmapped = 0, npagedout = 0;
+
+        if (NULL != vma->vma_vmmap && NULL != vma->vma_vmmap->vmm_proc) {
+                pt_count_range(vma->vma_vmmap->vmm_proc->p_pagedir,
+                               (uintptr_t) PN_TO_ADDR(vma->vma_start),
+                               (uintptr_t) PN_TO_ADDR(vma->vma_end), &nmapped, &npagedout);
+        }
+        vmarea_account(vma, (int) nmapped - (int) vma->vma_nresident,
+                       (int) npagedout - (int) vma->vma_nswapped);
+}
+
+/*
+ * The tree of areas.
+ *
+ * The gap of an area is the number of unmapped pages between it and
+ * the area before it on vmm_list (or USER_MEM_LOW for the first area),
+ * so it changes whenever the area before it changes. vma_maxgap is the
+ * largest gap in a subtree. Every change to the tree or to the bounds
+ * of an area is followed by _vmmap_tree_fixup on the area and on the
+ * area after it, which recomputes heights and gaps up to the root and
+ * rebalances on the way.
+ */
+
+#define vmarea_height(vma) ((NULL == (vma)) ? 0 : (vma)->vma_height)
+#define vmarea_maxgap(vma) ((NULL == (vma)) ? 0 : (vma)->vma_maxgap)
+
+static vmarea_t *
+_vmarea_prev(vmmap_t *map, vmarea_t *vma)
+{
+        return (vma->vma_plink.l_prev == &map->vmm_list) ? NULL
+               : list_item(vma->vma_plink.l_prev, vmarea_t, vma_plink);
+}
+
+static vmarea_t *
+_vmarea_next(vmmap_t *map, vmarea_t *vma)
+{
+        return (vma->vma_plink.l_next == &map->vmm_list) ? NULL
+               : list_item(vma->vma_plink.l_next, vmarea_t, vma_plink);
+}
+
+static uint32_t
+_vmarea_gap(vmmap_t *map, vmarea_t *vma)
+{
+        vmarea_t *prev = _vmarea_prev(map, vma);
+        return vma->vma_start - ((NULL == prev) ? ADDR_TO_PN(USER_MEM_LOW) : prev->vma_end);
+}
+
+static void
+_vmarea_update(vmmap_t *map, vmarea_t *vma)
+{
+        vma->vma_height = 1 + MAX(vmarea_height(vma->vma_left), vmarea_height(vma->vma_right));
+        vma->vma_maxgap = MAX(_vmarea_gap(map, vma),
+                              MAX(vmarea_maxgap(vma->vma_left), vmarea_maxgap(vma->vma_right)));
+}
+
+/* Puts new in old's place under old's parent */
+static void
+_vmmap_tree_replace(vmmap_t *map, vmarea_t *old, vmarea_t *new)
+{
+        if (NULL != new) {
+                new->vma_parent = old->vma_parent;
+        }
+        if (NULL == old->vma_parent) {
+                map->vmm_root = new;
+        } else if (old->vma_parent->vma_left == old) {
+                old->vma_parent->vma_left = new;
+        } else {
+                old->vma_parent->vma_right = new;
+        }
+}
+
+/* Rotates the right child of vma above it and returns that child */
+static vmarea_t *
+_vmmap_rotate_left(vmmap_t *map, vmarea_t *vma)
+{
+        vmarea_t *up = vma->vma_right;
+
+        _vmmap_tree_replace(map, vma, up);
+        vma->vma_right = up->vma_left;
+        if (NULL != vma->vma_right) {
+                vma->vma_right->vma_parent = vma;
+        }
+        up->vma_left = vma;
+        vma->vma_parent = up;
+
+        _vmarea_update(map, vma);
+        _vmarea_update(map, up);
+        return up;
+}
+
+/* Rotates the left child of vma above it and returns that child */
+static vmarea_t *
+_vmmap_rotate_right(vmmap_t *map, vmarea_t *vma)
+{
+        vmarea_t *up = vma->vma_left;
+
+        _vmmap_tree_replace(map, vma, up);
+        vma->vma_left = up->vma_right;
+        if (NULL != vma->vma_left) {
+                vma->vma_left->vma_parent = vma;
+        }
+        up->vma_right = vma;
+        vma->vma_parent = up;
+
+        _vmarea_update(map, vma);
+        _vmarea_update(map, up);
+        return up;
+}
+
+static void
+_vmmap_tree_fixup(vmmap_t *map, vmarea_t *vma)
+{
+        while (NULL != vma) {
+                _vmarea_update(map, vma);
+
+                int balance = vmarea_height(vma->vma_left) - vmarea_height(vma->vma_right);
+                if (1 < balance) {
+                        if (vmarea_height(vma->vma_left->vma_left) < vmarea_height(vma->vma_left->vma_right)) {
+                                _vmmap_rotate_left(map, vma->vma_left);
+                        }
+                        vma = _vmmap_rotate_right(map, vma);
+                } else if (-1 > balance) {
+                        if (vmarea_height(vma->vma_right->vma_right) < vmarea_height(vma->vma_right->vma_left)) {
+                                _vmmap_rotate_right(map, vma->vma_right);
+                        }
+                        vma = _vmmap_rotate_left(map, vma);
+                }
+                vma = vma->vma_parent;
+        }
+}
+
+/* Must be called after the bounds of an area in the map change */
+static void
+_vmmap_area_resized(vmmap_t *map, vmarea_t *vma)
+{
+        vmarea_t *next = _vmarea_next(map, vma);
+
+        _vmmap_tree_fixup(map, vma);
+        if (NULL != next) {
+                _vmmap_tree_fixup(map, next);
+        }
+}
+
+/* Takes vma out of the map, both the tree and vmm_list */
+static void
+_vmmap_tree_remove(vmmap_t *map, vmarea_t *vma)
+{
+        vmarea_t *next = _vmarea_next(map, vma);
+        vmarea_t *fix;
+
+        if (NULL != vma->vma_left && NULL != vma->vma_right) {
+                /* the successor in the tree is next, the leftmost node
+                 * of the right subtree, move it up into vma's place */
+                KASSERT(NULL == next->vma_left);
+                if (next->vma_parent == vma) {
+                        fix = next;
+                } else {
+                        fix = next->vma_parent;
+                        fix->vma_left = next->vma_right;
+                        if (NULL != next->vma_right) {
+                                next->vma_right->vma_parent = fix;
+                        }
+                        next->vma_right = vma->vma_right;
+                        next->vma_right->vma_parent = next;
+                }
+                next->vma_left = vma->vma_left;
+                next->vma_left->vma_parent = next;
+                _vmmap_tree_replace(map, vma, next);
+        } else {
+                fix = vma->vma_parent;
+                _vmmap_tree_replace(map, vma, (NULL != vma->vma_left) ? vma->vma_left : vma->vma_right);
+        }
+
+        list_remove(&vma->vma_plink);
+        if (map->vmm_cache == vma) {
+                map->vmm_cache = NULL;
+        }
+        vma->vma_vmmap = NULL;
+
+        _vmmap_tree_fixup(map, fix);
+        if (NULL != next) {
+                _vmmap_tree_fixup(map, next);
+        }
+}
+
+/* Returns the lowest area which ends after vfn, or NULL if there is none */
+static vmarea_t *
+_vmmap_first_ending_after(vmmap_t *map, uint32_t vfn)
+{
+        vmarea_t *vma = map->vmm_root;
+        vmarea_t *found = NULL;
+
+        while (NULL != vma) {
+                if (vma->vma_end > vfn) {
+                        found = vma;
+                        vma = vma->vma_left;
+                } else {
+                        vma = vma->vma_right;
+                }
+        }
+        return found;
+}
+
 vmmap_t *
 vmmap_create(void)
 {
@@ -59,7 +300,10 @@ vmmap_create(void)
         vmmap_t* new_vmmap = (vmmap_t *) slab_obj_alloc(vmmap_allocator);
         if (new_vmmap) {
                         list_init(&new_vmmap->vmm_list);
+                        new_vmmap->vmm_root = NULL;
+                        new_vmmap->vmm_cache = NULL;
                         new_vmmap->vmm_proc = NULL;
+                        list_link_init(&new_vmmap->vmm_reaplink);
         }
         return new_vmmap;
 }
@@ -79,6 +323,9 @@ vmmap_destroy(vmmap_t *map)
                 mmobj = vmarea->vma_obj;
                 if(mmobj!=NULL)
                 {
+                        /* Unlink before the put, which may free mmobj */
+                        if (list_link_is_linked(&vmarea->vma_olink))
+                                list_remove(&vmarea->vma_olink);
                         if (mmobj->mmo_ops->ref != NULL)
                         {
                                 mmobj->mmo_ops->put(mmobj);
@@ -88,12 +335,13 @@ vmmap_destroy(vmmap_t *map)
                         {
                                 mmobj->mmo_shadowed->mmo_ops->put(mmobj->mmo_shadowed);
                         }
-                        list_remove(&vmarea->vma_olink);
                 }
 
                 list_remove(&vmarea->vma_plink);
                 vmarea_free(vmarea);
 
+                /* nothing else can reach a map being destroyed */
+                sched_preempt_point();
         } list_iterate_end();
 
         slab_obj_free(vmmap_allocator, map);
@@ -118,30 +366,69 @@ vmmap_insert(vmmap_t *map, vmarea_t *newvma)
         dbg(DBG_PRINT, "(GRADING3A 3.b) VM area within memory boundaries.\n");
 
 
-        vmarea_t *iterate;
-        if(list_empty(&map->vmm_list))
-        {
-                list_insert_head(&(map->vmm_list),&(newvma->vma_plink));
+        vmarea_t **link = &map->vmm_root;
+        vmarea_t *parent = NULL;
+        vmarea_t *below = NULL;
+        while (NULL != *link) {
+                parent = *link;
+                if (newvma->vma_start < parent->vma_start) {
+                        link = &parent->vma_left;
+                } else {
+                        below = parent;
+                        link = &parent->vma_right;
+                }
+        }
+
+        newvma->vma_left = newvma->vma_right = NULL;
+        newvma->vma_parent = parent;
+        *link = newvma;
 
+        if (NULL == below) {
+                list_insert_head(&map->vmm_list, &newvma->vma_plink);
+        } else {
+                list_link_t *after = below->vma_plink.l_next;
+                list_insert_before(after, &newvma->vma_plink);
         }
-        else{
+        newvma->vma_vmmap = map;
 
-                list_iterate_begin(&map->vmm_list,iterate,vmarea_t,vma_plink)
-                {
-                        if(newvma->vma_start >iterate->vma_start){
-                                list_insert_tail(&map->vmm_list,&newvma->vma_plink );
-                                newvma->vma_vmmap=map;
-                                return;
-                        }
-                        else
-                        {
-                                list_insert_before(&iterate->vma_plink,&newvma->vma_plink);
-                                newvma->vma_vmmap=map;
-                                return;
-                        }
-                }list_iterate_end();
+        _vmmap_area_resized(map, newvma);
+}
+
+/*
+ * Splits vma at vfn, which must lie strictly inside it. vma keeps the
+ * pages below vfn and a new area, which is inserted into the map and
+ * returned, gets the rest. Returns NULL if no area could be allocated.
+ */
+static vmarea_t *
+_vmarea_split(vmmap_t *map, vmarea_t *vma, uint32_t vfn)
+{
+        vmarea_t *tail;
+
+        KASSERT(vma->vma_start < vfn && vfn < vma->vma_end);
+
+        if (NULL == (tail = vmarea_alloc())) {
+                return NULL;
+        }
+        tail->vma_start = vfn;
+        tail->vma_end = vma->vma_end;
+        tail->vma_off = vma->vma_off + (vfn - vma->vma_start);
+        tail->vma_prot = vma->vma_prot;
+        tail->vma_flags = vma->vma_flags;
+        tail->vma_advice = vma->vma_advice;
+        tail->vma_obj = vma->vma_obj;
+        if (NULL != tail->vma_obj) {
+                tail->vma_obj->mmo_ops->ref(tail->vma_obj);
+                if (list_link_is_linked(&vma->vma_olink)) {
+                        list_insert_before(vma->vma_olink.l_next, &tail->vma_olink);
+                }
         }
 
+        vma->vma_end = vfn;
+        _vmmap_area_resized(map, vma);
+        vmmap_insert(map, tail);
+        vmarea_recount(vma);
+        vmarea_recount(tail);
+        return tail;
 }
 
 
@@ -161,59 +448,74 @@ vmmap_find_range(vmmap_t *map, uint32_t npages, int dir)
         KASSERT(0 < npages);
         dbg(DBG_PRINT, "(GRADING3A 3.c) npages which has to be looked us is greater than zero.\n");
 
-        int startvfn = -1, i=-1;
-        vmarea_t *area;
-
-        if(list_empty(&(map->vmm_list)))
-        {
-                        return -1;
+        uint32_t lowvfn = ADDR_TO_PN(USER_MEM_LOW);
+        uint32_t highvfn = ADDR_TO_PN(USER_MEM_HIGH);
+        vmarea_t *last = list_empty(&map->vmm_list) ? NULL
+                         : list_tail(&map->vmm_list, vmarea_t, vma_plink);
+        uint32_t lastend = (NULL == last) ? lowvfn : last->vma_end;
+        vmarea_t *vma = map->vmm_root;
+
+        /* Apart from the gaps below each area, which the tree tracks,
+         * there is the gap above the last area */
+        if (VMMAP_DIR_HILO == dir && highvfn - lastend >= npages) {
+                return highvfn - npages;
         }
 
-        if(dir==VMMAP_DIR_HILO){
-                                        list_iterate_reverse(&(map->vmm_list), area, vmarea_t,vma_plink){
-                                                                        i = vmmap_is_range_empty(map,area->vma_start-(npages),area->vma_start-1);
-                                                                        if(i==1){
-                                                                                                        startvfn = area->vma_start-(npages);
-
-                                                                                                        break;
-                                                                        }
-                                        }list_iterate_end();
-                                        return startvfn;
-
+        if (vmarea_maxgap(vma) >= npages) {
+                /* Walk down towards the lowest (or highest) area with a
+                 * big enough gap below it, going into a subtree only if
+                 * it has one */
+                vmarea_t *first, *second;
+                while (1) {
+                        first = (VMMAP_DIR_HILO == dir) ? vma->vma_right : vma->vma_left;
+                        second = (VMMAP_DIR_HILO == dir) ? vma->vma_left : vma->vma_right;
+                        if (vmarea_maxgap(first) >= npages) {
+                                vma = first;
+                        } else if (_vmarea_gap(map, vma) >= npages) {
+                                break;
+                        } else {
+                                KASSERT(vmarea_maxgap(second) >= npages);
+                                vma = second;
+                        }
+                }
+                return (VMMAP_DIR_HILO == dir) ? vma->vma_start - npages
+                       : vma->vma_start - _vmarea_gap(map, vma);
         }
-        if(dir==VMMAP_DIR_LOHI)
-        {
-                                        list_iterate_begin(&(map->vmm_list), area, vmarea_t,vma_plink){
-                                                                        i = vmmap_is_range_empty(map,area->vma_end+1,area->vma_end+npages);
-                                                                        if(i==1){
-                                                                                                        startvfn = area->vma_end+1;
-                                                                                                        break;
-                                                                        }
-                                        }list_iterate_end();
-                                        return startvfn;
+
+        if (VMMAP_DIR_LOHI == dir && highvfn - lastend >= npages) {
+                return lastend;
         }
         return -1;
 }
-/* Find the vm_area that vfn lies in. Simply scan the address space
- * looking for a vma whose range covers vfn. If the page is unmapped,
- * return NULL. */
+
+/* Find the vm_area that vfn lies in. The area found by the previous
+ * lookup is tried first, then the tree is searched. If the page is
+ * unmapped, return NULL. */
 vmarea_t *
 vmmap_lookup(vmmap_t *map, uint32_t vfn)
 {
         /*NOT_YET_IMPLEMENTED("VM: vmmap_lookup");*/
         KASSERT(NULL != map);
         dbg(DBG_PRINT, "(GRADING3A 3.d) Map is not NULL\n ");
-        vmarea_t *vmarea;
-        if(!list_empty(&map->vmm_list))
-        {
-                list_iterate_begin(&map->vmm_list,vmarea,vmarea_t,vma_plink){
-                        if((vfn >= vmarea->vma_start) && (vfn < vmarea->vma_end))
-                                                        return vmarea;
-                }list_iterate_end();
+
+        /* Faults tend to come in runs on the same area */
+        vmarea_t *vma = map->vmm_cache;
+        if (NULL != vma && vfn >= vma->vma_start && vfn < vma->vma_end) {
+                return vma;
         }
 
-		return NULL;
-        /*return NULL;*/
+        vma = map->vmm_root;
+        while (NULL != vma) {
+                if (vfn < vma->vma_start) {
+                        vma = vma->vma_left;
+                } else if (vfn >= vma->vma_end) {
+                        vma = vma->vma_right;
+                } else {
+                        map->vmm_cache = vma;
+                        return vma;
+                }
+        }
+        return NULL;
 }
 
 /* Allocates a new vmmap containing a new vmarea for each area in the
@@ -238,10 +540,11 @@ vmmap_clone(vmmap_t *map)
                                                 vmclone->vma_start= vmarea->vma_start;
                                                 vmclone->vma_end=vmarea->vma_end;
                                                 vmclone->vma_off=vmarea->vma_off;
+                                                vmclone->vma_advice=vmarea->vma_advice;
                                                 vmmap_insert(clonemap,vmclone);
                                 }
                                 else{
-                                        vmmap_destroy(map);
+                                        vmmap_destroy(clonemap);
                                         return NULL;
                                 }
                 }list_iterate_end();
@@ -277,6 +580,24 @@ vmmap_clone(vmmap_t *map)
 int
 vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
           int prot, int flags, off_t off, int dir, vmarea_t **new)
+{
+        return _vmmap_map(map, file, NULL, lopage, npages, prot, flags, off, dir, new);
+}
+
+/* Like vmmap_map, but maps the given object, e.g. a shared memory
+ * segment, instead of a file or a new anonymous object. The area
+ * takes a reference to obj of its own. */
+int
+vmmap_map_obj(vmmap_t *map, mmobj_t *obj, uint32_t lopage, uint32_t npages,
+              int prot, int flags, off_t off, int dir, vmarea_t **new)
+{
+        KASSERT(NULL != obj);
+        return _vmmap_map(map, NULL, obj, lopage, npages, prot, flags, off, dir, new);
+}
+
+static int
+_vmmap_map(vmmap_t *map, vnode_t *file, mmobj_t *shared, uint32_t lopage, uint32_t npages,
+           int prot, int flags, off_t off, int dir, vmarea_t **new)
 {
         /*NOT_YET_IMPLEMENTED("VM: vmmap_map");
         return -1;*/
@@ -294,70 +615,67 @@ vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
         dbg(DBG_PRINT, "(GRADING3A 3.f)(0 == lopage) || (ADDR_TO_PN(USER_MEM_HIGH) >= (lopage + npages))\n ");
         KASSERT(PAGE_ALIGNED(off));
         dbg(DBG_PRINT, "(GRADING3A 3.f)PAGE_ALIGNED(off)\n ");
-        int gap,j;
-        vmarea_t *new_vma;
-        mmobj_t *mobj;
-
-        if(lopage==0){
-                        int x=vmmap_find_range(map,npages,dir);
-						if(!x)
-								return NULL;
-						lopage=x;
+        vmarea_t *vma;
+        mmobj_t *obj;
+        int ret;
 
+        if (0 == lopage) {
+                int vfn = vmmap_find_range(map, npages, dir);
+                if (-1 == vfn) {
+                        return -ENOMEM;
                 }
-		else{
-				if(!vmmap_is_range_empty(map,lopage,npages)){
-						if(vmmap_remove(map,lopage,npages)!=0){
-								return -1;
-						}
-				}
-
-
-         }
-        new_vma=vmarea_alloc();
-        new_vma->vma_flags=flags;
-        new_vma->vma_end=lopage+npages;
-        new_vma->vma_off=off;
-        new_vma->vma_prot=prot;
-        new_vma->vma_start=lopage;
-        vmmap_insert(map, new_vma);
-        if(file)
-        {
-                KASSERT(file->vn_ops!=NULL&&file->vn_ops->mmap!=NULL);
-                j=(file->vn_ops->mmap)(file,new_vma,&mobj);
-                if(j<0)
-                return j;
-                else
-                {
-                        mmobj_t *shadow;
-                        new_vma->vma_obj = mobj;
-                        mobj->mmo_ops->ref(mobj);
-                        /*if((shadow = shadow_create()) !=NULL)
-                        {
-                                shadow->mmo_shadowed = mobj;
-                                (shadow)->mmo_un.mmo_bottom_obj = mobj;
-                                mobj->mmo_ops->ref(mobj);
-                                new_vma->vma_obj = shadow;
+                lopage = vfn;
+        }
 
-                        }*/
+        if (NULL == (vma = vmarea_alloc())) {
+                return -ENOMEM;
+        }
+        vma->vma_start = lopage;
+        vma->vma_end = lopage + npages;
+        vma->vma_off = ADDR_TO_PN(off);
+        vma->vma_prot = prot;
+        vma->vma_flags = flags;
+
+        if (NULL != shared) {
+                obj = shared;
+                obj->mmo_ops->ref(obj);
+        } else if (NULL != file) {
+                KASSERT(NULL != file->vn_ops && NULL != file->vn_ops->mmap);
+                if (0 > (ret = file->vn_ops->mmap(file, vma, &obj))) {
+                        vmarea_free(vma);
+                        return ret;
+                }
+        } else if (NULL == (obj = anon_create())) {
+                vmarea_free(vma);
+                return -ENOMEM;
+        }
 
+        if (MAP_PRIVATE & flags) {
+                mmobj_t *shadow = shadow_create_over(obj);
+                obj->mmo_ops->put(obj);
+                if (NULL == shadow) {
+                        vmarea_free(vma);
+                        return -ENOMEM;
                 }
+                obj = shadow;
         }
-        else
-        {
-                if(flags!=MAP_PRIVATE)
-                         mobj=anon_create();
-                else
-                        mobj=shadow_create();
 
-                 if(mobj==NULL)
-                         return -1;
-                 new_vma->vma_obj = mobj;
-                 mobj->mmo_ops->ref(mobj);
+        /* Unmapping whatever was there is the one step which cannot be
+         * undone, so it comes last */
+        if (!vmmap_is_range_empty(map, lopage, npages)
+            && 0 > (ret = vmmap_remove(map, lopage, npages))) {
+                obj->mmo_ops->put(obj);
+                vmarea_free(vma);
+                return ret;
         }
-        if (new!=NULL)
-                new=&new_vma;
 
+        vma->vma_obj = obj;
+        list_insert_tail(mmobj_bottom_vmas(obj), &vma->vma_olink);
+        vmmap_insert(map, vma);
+
+        if (NULL != new) {
+                *new = vma;
+        }
         return 0;
 }
 
@@ -393,61 +711,127 @@ vmmap_map(vmmap_t *map, vnode_t *file, uint32_t lopage, uint32_t npages,
 int
 vmmap_remove(vmmap_t *map, uint32_t lopage, uint32_t npages)
 {
-	if(list_empty(&(map->vmm_list))){
-	                return -1;
-	}
-	  uint32_t start,end;
-	  start = lopage;
-	  end = start + npages ;
-	vmarea_t *vma,*vmnew;
-	list_iterate_begin(&(map->vmm_list), vma, vmarea_t, vma_plink)
-	{
-		if( start > vma->vma_start && end<vma->vma_end ) /* case 1 */
-		{
-            vmnew=vmarea_alloc();
-			vmnew->vma_start=lopage+npages;
-			vmnew->vma_end=vma->vma_end;
-			vmnew->vma_obj=vma->vma_obj;
-			vmnew->vma_prot=vma->vma_prot;
-			vmnew->vma_flags=vma->vma_flags;
-
-			vma->vma_off += npages;
-			vma->vma_end=lopage;
-			if(vmnew->vma_obj)
-					vmnew->vma_obj->mmo_refcount++;
-                    vmmap_insert(map, vmnew);
-		}
-		else if( start>vma->vma_start && start<=vma->vma_end && end>=vma->vma_end ) /* case 2 */
-		{
-
-		   vma->vma_end = lopage;
-
-		}
-		else if( start<=vma->vma_start && end<vma->vma_end && end>=vma->vma_start ) /* case 3 */
-		{
-
-		   vma->vma_off = vma->vma_off +lopage+npages-vma->vma_start;
-		   vma->vma_start = lopage+npages;
-
-		}
-		else if(start<=vma->vma_start && end>=vma->vma_end) /* case 4 */
-		{
-
-		   list_remove(&vma->vma_plink);
-		   list_remove(&vma->vma_olink);
-		   if ( vma->vma_obj != NULL )
-						   vma->vma_obj->mmo_ops->put(vma->vma_obj);
-		   vmarea_free(vma);
-		}
-		else if( start<vma->vma_start && end<vma->vma_start ) /* case 5 */
-		{
-
-				   return 0;
-		}
-
-	}list_iterate_end();
-
-		return 0;
+        uint32_t hipage = lopage + npages;
+        vmarea_t *vma = _vmmap_first_ending_after(map, lopage);
+
+        while (NULL != vma && vma->vma_start < hipage) {
+                vmarea_t *next = _vmarea_next(map, vma);
+
+                if (vma->vma_start < lopage && vma->vma_end > hipage) { /* case 1 */
+                        if (NULL == _vmarea_split(map, vma, hipage)) {
+                                return -ENOMEM;
+                        }
+                        vma->vma_end = lopage;
+                        _vmmap_area_resized(map, vma);
+                        vmarea_recount(vma);
+                } else if (vma->vma_start < lopage) { /* case 2 */
+                        vma->vma_end = lopage;
+                        _vmmap_area_resized(map, vma);
+                        vmarea_recount(vma);
+                } else if (vma->vma_end > hipage) { /* case 3 */
+                        vma->vma_off += hipage - vma->vma_start;
+                        vma->vma_start = hipage;
+                        _vmmap_area_resized(map, vma);
+                        vmarea_recount(vma);
+                } else { /* case 4 */
+                        vmarea_account(vma, -(int) vma->vma_nresident, -(int) vma->vma_nswapped);
+                        _vmmap_tree_remove(map, vma);
+                        if (list_link_is_linked(&vma->vma_olink)) {
+                                list_remove(&vma->vma_olink);
+                        }
+                        if (NULL != vma->vma_obj) {
+                                vma->vma_obj->mmo_ops->put(vma->vma_obj);
+                        }
+                        vmarea_free(vma);
+                }
+                vma = next;
+        }
+
+        return 0;
+}
+
+/*
+ * Resizes the mapping of [lopage, lopage + oldnpages), which must lie
+ * within one area, to newnpages pages, for mremap(2), and returns the
+ * page it now starts at in *newlopage.
+ *
+ * Shrinking unmaps the end of the range. When growing, the pages added
+ * are a new mapping of what follows in the file, or of zeroes, right
+ * after the range if nothing is mapped there. Otherwise, if maymove,
+ * the range moves somewhere it can grow: a new area maps the same
+ * object at the same offset there, so none of the pages are copied,
+ * and the old range is unmapped. The caller deals with page tables.
+ * (The pages added to a shared anonymous mapping are a new object,
+ * which processes already sharing the mapping do not see.)
+ */
+int
+vmmap_remap(vmmap_t *map, uint32_t lopage, uint32_t oldnpages, uint32_t newnpages,
+            int maymove, uint32_t *newlopage)
+{
+        vmarea_t *vma = vmmap_lookup(map, lopage);
+        uint32_t hipage = lopage + oldnpages;
+        uint32_t to = lopage;
+        mmobj_t *bottom;
+        vnode_t *file = NULL;
+        int ret;
+
+        KASSERT(0 < oldnpages && 0 < newnpages);
+        if (NULL == vma || vma->vma_end < hipage) {
+                return -EFAULT;
+        }
+
+        if (newnpages <= oldnpages) {
+                if (newnpages < oldnpages
+                    && 0 > (ret = vmmap_remove(map, lopage + newnpages, oldnpages - newnpages))) {
+                        return ret;
+                }
+                *newlopage = lopage;
+                return 0;
+        }
+
+        if (ADDR_TO_PN(USER_MEM_HIGH) - hipage < newnpages - oldnpages
+            || !vmmap_is_range_empty(map, hipage, newnpages - oldnpages)) {
+                vmarea_t *moved;
+                if (!maymove || 0 > (ret = vmmap_find_range(map, newnpages, VMMAP_DIR_HILO))
+                    || NULL == (moved = vmarea_alloc())) {
+                        return -ENOMEM;
+                }
+                to = ret;
+                moved->vma_start = to;
+                moved->vma_end = to + oldnpages;
+                moved->vma_off = vma->vma_off + (lopage - vma->vma_start);
+                moved->vma_prot = vma->vma_prot;
+                moved->vma_flags = vma->vma_flags;
+                moved->vma_advice = vma->vma_advice;
+                moved->vma_obj = vma->vma_obj;
+                moved->vma_obj->mmo_ops->ref(moved->vma_obj);
+                list_insert_tail(mmobj_bottom_vmas(moved->vma_obj), &moved->vma_olink);
+                vmmap_insert(map, moved);
+        }
+
+        bottom = mmobj_bottom_obj(vma->vma_obj);
+        if (!mmobj_is_anon(bottom)) {
+                file = CONTAINER_OF(bottom, vnode_t, vn_mmobj);
+        }
+        if (0 > (ret = vmmap_map(map, file, to + oldnpages, newnpages - oldnpages,
+                                 vma->vma_prot, vma->vma_flags,
+                                 (off_t) PN_TO_ADDR(vma->vma_off + (hipage - vma->vma_start)),
+                                 VMMAP_DIR_HILO, NULL))) {
+                goto undo;
+        }
+        if (to != lopage && 0 > (ret = vmmap_remove(map, lopage, oldnpages))) {
+                vmmap_remove(map, to + oldnpages, newnpages - oldnpages);
+                goto undo;
+        }
+
+        *newlopage = to;
+        return 0;
+
+undo:
+        if (to != lopage) {
+                vmmap_remove(map, to, oldnpages);
+        }
+        return ret;
 }
 
 /*
@@ -462,18 +846,49 @@ vmmap_is_range_empty(vmmap_t *map, uint32_t startvfn, uint32_t npages)
         uint32_t endvfn = startvfn+npages;
         KASSERT((startvfn < endvfn) && (ADDR_TO_PN(USER_MEM_LOW) <= startvfn) && (ADDR_TO_PN(USER_MEM_HIGH) >= endvfn));
         dbg(DBG_PRINT, "(GRADING3A 3.e)(startvfn < endvfn) && (ADDR_TO_PN(USER_MEM_LOW) <= startvfn) && (ADDR_TO_PN(USER_MEM_HIGH) >= endvfn)\n ");
-        vmarea_t *vmarea;
-        if(!list_empty(&map->vmm_list)){
+        vmarea_t *vma = _vmmap_first_ending_after(map, startvfn);
+        return NULL == vma || vma->vma_start >= endvfn;
+}
 
+/*
+ * Sets the access pattern advice (MADV_NORMAL, MADV_RANDOM or
+ * MADV_SEQUENTIAL) of the pages [lopage, lopage + npages), splitting
+ * areas which only partly overlap the range. The whole range must be
+ * mapped, otherwise nothing is changed and -ENOMEM is returned.
+ */
+int
+vmmap_set_advice(vmmap_t *map, uint32_t lopage, uint32_t npages, int advice)
+{
+        uint32_t hipage = lopage + npages;
+        uint32_t vfn = lopage;
+        vmarea_t *vma;
 
-			list_iterate_begin(&map->vmm_list,vmarea,vmarea_t,vma_plink)
-			{
-					if(vmarea->vma_start>=startvfn && vmarea->vma_end < endvfn )
-							return 0;
+        KASSERT(MADV_NORMAL == advice || MADV_RANDOM == advice || MADV_SEQUENTIAL == advice);
 
-			}list_iterate_end();
+        for (vma = _vmmap_first_ending_after(map, lopage); vfn < hipage;
+             vma = _vmarea_next(map, vma)) {
+                if (NULL == vma || vma->vma_start > vfn) {
+                        return -ENOMEM;
+                }
+                vfn = vma->vma_end;
         }
-        return 1;
+
+        vma = _vmmap_first_ending_after(map, lopage);
+        if (vma->vma_start < lopage) {
+                if (vma->vma_advice == advice) {
+                        vma = _vmarea_next(map, vma);
+                } else if (NULL == (vma = _vmarea_split(map, vma, lopage))) {
+                        return -ENOMEM;
+                }
+        }
+        for (; NULL != vma && vma->vma_start < hipage; vma = _vmarea_next(map, vma)) {
+                if (vma->vma_advice != advice && vma->vma_end > hipage
+                    && NULL == _vmarea_split(map, vma, hipage)) {
+                        return -ENOMEM;
+                }
+                vma->vma_advice = advice;
+        }
+        return 0;
 }
 
 /* Read into 'buf' from the virtual address space of 'map' starting at
@@ -487,59 +902,28 @@ vmmap_is_range_empty(vmmap_t *map, uint32_t startvfn, uint32_t npages)
 int
 vmmap_read(vmmap_t *map, const void *vaddr, void *buf, size_t count)
 {
-    uint32_t vfn = ADDR_TO_PN(vaddr);
-    int size=0;
-    if(count/PAGE_SIZE==0){
-    	size=1;
-    }
-    else {
-    	if(count%PAGE_SIZE==0)
-    		size=count/PAGE_SIZE;
-    	else
-    		size=count/PAGE_SIZE+1;
-
-    }
-
-    /*First iterate through the list to get correct vmareas*/
-    if(list_empty(&(map->vmm_list)))
-    {
-        return -EFAULT;
-
-    }
-
-	vmarea_t *area;
-	pframe_t *frame;
-	while(size>0)
-	{
-			area = vmmap_lookup(map,vfn);
-			if(!area)
-				return -EFAULT;
-			if(area!=NULL)
-			{
-
-				pframe_get(area->vma_obj,vfn-area->vma_start+area->vma_off,&frame);
-				if(frame)
-				{
-						if(count<=PAGE_SIZE-PAGE_OFFSET((uintptr_t)vaddr))
-								memcpy((char*)buf,
-									(char*)frame->pf_addr+PAGE_OFFSET(vaddr),count);
-						else
-						{
-								memcpy(buf,
-									frame->pf_addr,
-									PAGE_SIZE-PAGE_OFFSET(vaddr));
-								count-=PAGE_SIZE-PAGE_OFFSET((uintptr_t)vaddr);
-						}
-				}
-
-						size--;
-
-						vfn=vfn+1;
-			}
-		}
-
-    return 0;
-     }
+        uintptr_t addr = (uintptr_t) vaddr;
+        char *dst = buf;
+        int ret;
+
+        while (0 < count) {
+                vmarea_t *vma = vmmap_lookup(map, ADDR_TO_PN(addr));
+                size_t n = MIN(count, PAGE_SIZE - PAGE_OFFSET(addr));
+                pframe_t *pf;
+
+                KASSERT(NULL != vma);
+                /* A read must not give the area copies of its pages */
+                if (0 > (ret = pframe_lookup(vma->vma_obj, ADDR_TO_PN(addr) - vma->vma_start
+                                             + vma->vma_off, 0, &pf))) {
+                        return ret;
+                }
+                memcpy(dst, (char *)pframe_kmap(pf, PT_TMP_SLOT_KMAP0) + PAGE_OFFSET(addr), n);
+                dst += n;
+                addr += n;
+                count -= n;
+        }
+        return 0;
+}
 
 /* Write from 'buf' into the virtual address space of 'map' starting at
  * 'vaddr' for size 'count'. To do this, you will need to find the correct
@@ -552,53 +936,36 @@ vmmap_read(vmmap_t *map, const void *vaddr, void *buf, size_t count)
 int
 vmmap_write(vmmap_t *map, void *vaddr, const void *buf, size_t count)
 {
-        uint32_t vfn = ADDR_TO_PN(vaddr);
-        int size=0;
-        if(count/PAGE_SIZE==0){
-        		size=1;
-        }
-        else {
-        	if(count%PAGE_SIZE==0)
-        		size=count/PAGE_SIZE;
-        	else
-        		size=count/PAGE_SIZE+1;
-
-        }
-
-        /*First iterate through the list to get correct vmareas*/
-        if(list_empty(&(map->vmm_list)))
-        {
-            return -EFAULT;
-
-        }
-
-		vmarea_t *area;
-		pframe_t *frame;
-		while(size>0)
-		{
-				area = vmmap_lookup(map,vfn);
-				if(!area)
-					return -EFAULT;
-				if(area!=NULL)
-				{
-
-					pframe_get(area->vma_obj,vfn-area->vma_start+area->vma_off,&frame);
-					if(frame)
-					{
-							if(count<=PAGE_SIZE-PAGE_OFFSET(vaddr))
-									memcpy((char*)frame->pf_addr+PAGE_OFFSET(vaddr),(char*)buf,count);
-							else
-							{
-									memcpy(frame->pf_addr,buf,PAGE_SIZE-PAGE_OFFSET(vaddr));
-									count=count+PAGE_SIZE-PAGE_OFFSET(vaddr);
-							}
-					}
-							size--;
-
-							vfn=vfn+1;
-				}
-		}
-
+        uintptr_t addr = (uintptr_t) vaddr;
+        const char *src = buf;
+        int ret;
+
+        while (0 < count) {
+                vmarea_t *vma = vmmap_lookup(map, ADDR_TO_PN(addr));
+                size_t n = MIN(count, PAGE_SIZE - PAGE_OFFSET(addr));
+                pframe_t *pf;
+
+                KASSERT(NULL != vma);
+                if (0 > (ret = pframe_lookup(vma->vma_obj, ADDR_TO_PN(addr) - vma->vma_start
+                                             + vma->vma_off, 1, &pf))
+                    || 0 > (ret = pframe_dirty(pf))) {
+                        return ret;
+                }
+                memcpy((char *)pframe_kmap(pf, PT_TMP_SLOT_KMAP0) + PAGE_OFFSET(addr), src, n);
+
+                /* The process may still map what the page looked like
+                 * before it had its own copy, e.g. the zero page */
+                if (NULL != map->vmm_proc) {
+                        uintptr_t page = (uintptr_t) PAGE_ALIGN_DOWN(addr);
+                        vmarea_account(vma, -pt_unmap(map->vmm_proc->p_pagedir, page, 0), 0);
+                        if (map->vmm_proc->p_pagedir == pt_get()) {
+                                tlb_flush(page);
+                        }
+                }
+                src += n;
+                addr += n;
+                count -= n;
+        }
         return 0;
 }
 
@@ -615,26 +982,34 @@ vmmap_mapping_info(const void *vmmap, char *buf, size_t osize)
         vmarea_t *vma;
         ssize_t size = (ssize_t)osize;
 
-        int len = snprintf(buf, size, "%21s %5s %7s %8s %10s %12s\n",
+        int len = snprintf(buf, size, "%21s %5s %7s %8s %10s %12s %5s %5s %5s\n",
                            "VADDR RANGE", "PROT", "FLAGS", "MMOBJ", "OFFSET",
-                           "VFN RANGE");
+                           "VFN RANGE", "DEPTH", "RES", "SWAP");
 
         list_iterate_begin(&map->vmm_list, vma, vmarea_t, vma_plink) {
+                mmobj_t *o;
+                int depth = 0;
+
                 size -= len;
                 buf += len;
                 if (0 >= size) {
                         goto end;
                 }
 
+                /* shadow objects between the area and its bottom object */
+                for (o = vma->vma_obj; NULL != o && mmobj_is_shadow(o); o = o->mmo_shadowed) {
+                        ++depth;
+                }
                 len = snprintf(buf, size,
-                               "%#.8x-%#.8x  %c%c%c  %7s 0x%p %#.5x %#.5x-%#.5x\n",
+                               "%#.8x-%#.8x  %c%c%c  %7s 0x%p %#.5x %#.5x-%#.5x %5d %5u %5u\n",
                                vma->vma_start << PAGE_SHIFT,
                                vma->vma_end << PAGE_SHIFT,
                                (vma->vma_prot & PROT_READ ? 'r' : '-'),
                                (vma->vma_prot & PROT_WRITE ? 'w' : '-'),
                                (vma->vma_prot & PROT_EXEC ? 'x' : '-'),
                                (vma->vma_flags & MAP_SHARED ? " SHARED" : "PRIVATE"),
-                               vma->vma_obj, vma->vma_off, vma->vma_start, vma->vma_end);
+                               vma->vma_obj, vma->vma_off, vma->vma_start, vma->vma_end,
+                               depth, vma->vma_nresident, vma->vma_nswapped);
         } list_iterate_end();
 
 end:
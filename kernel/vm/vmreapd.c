@@ -0,0 +1,93 @@
+#include "config.h"
+#include "types.h"
+#include "globals.h"
+
+#include "util/debug.h"
+#include "util/list.h"
+#include "util/init.h"
+
+#include "proc/proc.h"
+#include "proc/sched.h"
+#include "proc/kthread.h"
+
+#include "vm/vmmap.h"
+#include "vm/vmreapd.h"
+
+static ktqueue_t vmreapd_waitq, vmreapd_drainq;
+static list_t vmreapd_list;        /* maps waiting to be destroyed */
+static uint32_t vmreapd_npending;  /* queued or being destroyed */
+
+void
+vmreapd_defer(vmmap_t *map)
+{
+        KASSERT(NULL == map->vmm_proc);
+
+        list_insert_tail(&vmreapd_list, &map->vmm_reaplink);
+        vmreapd_npending++;
+        sched_wakeup_on(&vmreapd_waitq);
+}
+
+uint32_t
+vmreapd_pending(void)
+{
+        return vmreapd_npending;
+}
+
+void
+vmreapd_drain(void)
+{
+        while (0 < vmreapd_npending) {
+                sched_sleep_on(&vmreapd_drainq);
+        }
+}
+
+/*
+ * The reaper daemon main routine.
+ *
+ * An exiting process gives its address space to vmreapd instead of
+ * tearing it down itself, so that its parent can reap it without
+ * waiting for every page to be freed. Destroying the map puts the
+ * areas' objects, which frees the pages nothing else refers to (see
+ * pframe_release_all()). The map is only counted as done once that
+ * has happened, so that the OOM killer can wait for the memory.
+ */
+static void *
+vmreapd_run(int arg1, void *arg2)
+{
+        vmmap_t *map;
+
+        while (1) {
+                while (!list_empty(&vmreapd_list)) {
+                        map = list_head(&vmreapd_list, vmmap_t, vmm_reaplink);
+                        list_remove(&map->vmm_reaplink);
+                        vmmap_destroy(map);
+                        vmreapd_npending--;
+                }
+
+                sched_broadcast_on(&vmreapd_drainq);
+                if (sched_cancellable_sleep_on(&vmreapd_waitq) < 0) {
+                        return (void *)0;
+                }
+        }
+}
+
+static __attribute__((unused)) void
+vmreapd_init()
+{
+        proc_t *p;
+        kthread_t *thr;
+
+        sched_queue_init(&vmreapd_waitq);
+        sched_queue_init(&vmreapd_drainq);
+        list_init(&vmreapd_list);
+
+        KASSERT(NULL != curproc && (PID_IDLE == curproc->p_pid));
+        p = proc_create("vmreapd");
+        KASSERT(NULL != p);
+        thr = kthread_create(p, vmreapd_run, 0, NULL);
+        KASSERT(NULL != thr);
+
+        sched_make_runnable(thr);
+}
+init_func(vmreapd_init);
+init_depends(sched_init);
@@ -1222,9 +1222,13 @@ static int execute(int argc, char *argv[], redirect_map_t *map)
                 return 0;
         }
 
-        if (!(pid = fork())) {
+        /* The child only sets up its file descriptors and execs, so
+         * there is no need to copy our address space for it. Being a
+         * vfork child it must not return from here, and leaves with
+         * _exit() so it runs none of our atexit handlers. */
+        if (!(pid = vfork())) {
                 if (do_redirect(map) < 0)
-                        exit(1);
+                        _exit(1);
 
                 execve(argv[0], argv, my_envp);
                 if (errno == ENOENT) {
@@ -1235,10 +1239,10 @@ static int execute(int argc, char *argv[], redirect_map_t *map)
                 } else
                         fprintf(stderr, "sh: exec failed for %s: %s\n",
                                 argv[0], strerror(errno));
-                exit(1);
+                _exit(1);
         } else {
                 if (0 > pid) {
-                        fprintf(stderr, "sh: fork failed errno = %d\n", errno);
+                        fprintf(stderr, "sh: vfork failed errno = %d\n", errno);
                 }
         }
 
@@ -0,0 +1 @@
+../../kernel/include/api/time.h
\ No newline at end of file
@@ -17,6 +17,7 @@ struct dirent;
 
 /* User exec-related */
 int     fork(void);
+int     vfork(void);
 int     execl(const char *filename, const char *arg, ...); /* NYI */
 int     execle(const char *filename, const char *arg, ...); /* NYI */
 int     execv(const char *filename, char *const argv[]); /* NYI */
@@ -30,6 +31,9 @@ void    thr_exit(int status);
 int     thr_errno(void);
 void    thr_set_errno(int n);
 void    yield(void);
+void    sched_yield(void);
+int     nice(int incr);
+unsigned int sleep(unsigned int sec);
 pid_t   getpid(void);
 int     halt(void);
 void    sync(void);
@@ -56,6 +60,11 @@ int     stat(const char *path, struct stat *buf);
 /* VM-related */
 void    *mmap(void *addr, size_t len, int prot, int flags, int fd, off_t off);
 int     munmap(void *addr, size_t len);
+int     madvise(void *addr, size_t len, int advice);
+void    *mremap(void *old_addr, size_t old_len, size_t new_len, int flags);
+int     rsslimit(size_t npages);
+int     shm_open(const char *name, size_t len, int oflag);
+int     shm_unlink(const char *name);
 int     brk(void *addr);
 void    *sbrk(int incr);
 
@@ -60,16 +60,17 @@ typedef unsigned long long  u_quad_t;
  *                      unit of alignment used for the storage
  *                      returned by malloc/realloc.
  *
+ * malloc_bigsize       allocations of at least this many bytes get
+ *                      a mapping of their own, which realloc can
+ *                      grow or move with mremap() instead of copying.
+ *
  */
 #define malloc_pageshift        12U
 #define malloc_minsize          16U
+#define malloc_bigsize          (16U << malloc_pageshift)
 
-static int fdzero;
-#define MMAP_FD fdzero
-#define INIT_MMAP() \
-        { if ((fdzero = _open("/dev/zero", O_RDWR, 0000)) == -1) \
-                        wrterror("open of /dev/zero"); }
-#define MADV_FREE                       MADV_DONTNEED
+#define HAS_MADVISE
+#define HAS_MREMAP
 
 /*
  * No user serviceable parts behind this point.
@@ -192,7 +193,7 @@ static int suicide;
 static int malloc_realloc;
 
 /* pass the kernel a hint on free pages ?  */
-static int malloc_hint = 0;
+static int malloc_hint = 1;
 
 /* xmalloc behaviour ?  */
 static int malloc_xmalloc;
@@ -240,9 +241,23 @@ static char *malloc_func;
 
 /* Macro for mmap */
 #define MMAP(size) \
-        mmap(0, (size), PROT_READ|PROT_WRITE, MAP_PRIVATE, \
+        mmap(0, (size), PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, \
              MMAP_FD, 0);
 
+#ifdef HAS_MREMAP
+/*
+ * Header in front of an allocation with a mapping of its own, keeping
+ * the returned pointer aligned to malloc_minsize.
+ */
+struct bigblk {
+        size_t len;                     /* Bytes mapped, header included */
+        u_long magic;                   /* BIG_MAGIC while allocated */
+        u_long pad[2];
+};
+#define BIG_MAGIC       0x62696721
+#define ptr2big(foo)    ((struct bigblk *)(foo) - 1)
+#endif /* HAS_MREMAP */
+
 /*
  * Necessary function declarations
  */
@@ -694,6 +709,69 @@ malloc_bytes(size_t size)
         return (u_char *)bp->page + k;
 }
 
+#ifdef HAS_MREMAP
+/*
+ * Allocate a piece of memory with a mapping of its own
+ */
+static void *
+malloc_big(size_t size)
+{
+        struct bigblk *bp;
+        size_t len = pageround(size + sizeof * bp);
+
+        if (len < size)
+                return 0;
+        bp = MMAP(len);
+        if (bp == MAP_FAILED)
+                return 0;
+        bp->len = len;
+        bp->magic = BIG_MAGIC;
+        return bp + 1;
+}
+
+/*
+ * Is this a piece of memory from malloc_big()?  These live above
+ * the heap, and are never page aligned.
+ */
+static int
+is_big(void *ptr)
+{
+        return ptr2index(ptr) > last_index &&
+            ((u_long)ptr & malloc_pagemask) == sizeof(struct bigblk) &&
+            ptr2big(ptr)->magic == BIG_MAGIC;
+}
+
+/*
+ * Resize a piece of memory from malloc_big(), letting the kernel grow
+ * it in place or move its pages elsewhere
+ */
+static void *
+realloc_big(void *ptr, size_t size)
+{
+        struct bigblk *bp = ptr2big(ptr);
+        size_t len = pageround(size + sizeof * bp);
+
+        if (len < size)
+                return 0;
+        if (len == bp->len)
+                return ptr;
+        bp = mremap(bp, bp->len, len, MREMAP_MAYMOVE);
+        if (bp == MAP_FAILED)
+                return 0;
+        bp->len = len;
+        return bp + 1;
+}
+
+static void
+free_big(void *ptr)
+{
+        struct bigblk *bp = ptr2big(ptr);
+
+        bp->magic = 0;
+        munmap(bp, bp->len);
+}
+#endif /* HAS_MREMAP */
+
 /*
  * Allocate a piece of memory
  */
@@ -709,6 +787,10 @@ imalloc(size_t size)
                 result = 0;
         else if (size <= malloc_maxsize)
                 result =  malloc_bytes(size);
+#ifdef HAS_MREMAP
+        else if (size >= malloc_bigsize)
+                result =  malloc_big(size);
+#endif /* HAS_MREMAP */
         else
                 result =  malloc_pages(size);
 
@@ -735,6 +817,15 @@ irealloc(void *ptr, size_t size)
         if (suicide)
                 abort();
 
+#ifdef HAS_MREMAP
+        if (is_big(ptr)) {
+                if (size >= malloc_bigsize)
+                        return realloc_big(ptr, size);
+                osize = ptr2big(ptr)->len - sizeof(struct bigblk);
+                goto copy;
+        }
+#endif /* HAS_MREMAP */
+
         index = ptr2index(ptr);
 
         if (index < malloc_pageshift) {
@@ -798,6 +889,9 @@ irealloc(void *ptr, size_t size)
                 return 0;
         }
 
+#ifdef HAS_MREMAP
+copy:
+#endif /* HAS_MREMAP */
         p = imalloc(size);
 
         if (p) {
@@ -1030,6 +1124,13 @@ ifree(void *ptr)
         if (suicide)
                 return;
 
+#ifdef HAS_MREMAP
+        if (is_big(ptr)) {
+                free_big(ptr);
+                return;
+        }
+#endif /* HAS_MREMAP */
+
         index = ptr2index(ptr);
 
         if (index < malloc_pageshift) {
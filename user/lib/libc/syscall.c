@@ -8,6 +8,7 @@
 #include "weenix/trap.h"
 
 #include "dirent.h"
+#include "time.h"
 
 static void *__curbrk = NULL;
 #define MAX_EXIT_HANDLERS 32
@@ -61,6 +62,14 @@ int fork(void)
         return trap(SYS_fork, 0);
 }
 
+/* vfork() itself is in vfork.S, it comes here to set errno when the
+ * system call fails */
+__attribute__((visibility("hidden"))) int __vfork_error(void)
+{
+        trap(SYS_errno, 0);
+        return -1;
+}
+
 int atexit(void (*func)(void))
 {
         if (atexit_handlers < MAX_EXIT_HANDLERS) {
@@ -98,6 +107,31 @@ void yield(void)
         (fork() ? wait(NULL) : exit(0));
 }
 
+void sched_yield(void)
+{
+        trap(SYS_thr_yield, 0);
+}
+
+int nice(int incr)
+{
+        return trap(SYS_nice, (uint32_t) incr);
+}
+
+unsigned int sleep(unsigned int sec)
+{
+        return trap(SYS_sleep, (uint32_t) sec);
+}
+
+int nanosleep(const struct timespec *req, struct timespec *rem)
+{
+        nanosleep_args_t args;
+
+        args.req = req;
+        args.rem = rem;
+
+        return trap(SYS_nanosleep, (uint32_t) &args);
+}
+
 pid_t wait(int *status)
 {
         waitpid_args_t args;
@@ -159,6 +193,54 @@ int munmap(void *addr, size_t len)
         return trap(SYS_munmap, (uint32_t) &args);
 }
 
+int madvise(void *addr, size_t len, int advice)
+{
+        madvise_args_t args;
+
+        args.addr = addr;
+        args.len = len;
+        args.advice = advice;
+
+        return trap(SYS_madvise, (uint32_t) &args);
+}
+
+void *mremap(void *old_addr, size_t old_len, size_t new_len, int flags)
+{
+        mremap_args_t args;
+
+        args.old_addr = old_addr;
+        args.old_len = old_len;
+        args.new_len = new_len;
+        args.flags = flags;
+
+        return (void *) trap(SYS_mremap, (uint32_t) &args);
+}
+
+int rsslimit(size_t npages)
+{
+        return trap(SYS_rsslimit, (uint32_t) npages);
+}
+
+int shm_open(const char *name, size_t len, int oflag)
+{
+        shm_open_args_t args;
+
+        args.name.as_len = strlen(name);
+        args.name.as_str = name;
+        args.len = len;
+        args.oflag = oflag;
+
+        return trap(SYS_shm_open, (uint32_t) &args);
+}
+
+int shm_unlink(const char *name)
+{
+        argstr_t args;
+        args.as_len = strlen(name);
+        args.as_str = name;
+        return trap(SYS_shm_unlink, (uint32_t) &args);
+}
+
 void sync(void)
 {
         trap(SYS_sync, 0);
@@ -37,12 +37,12 @@ static int open_tty(char *tty)
 
 static void spawn_shell_on(char *tty)
 {
-        if (!fork()) {
+        if (!vfork()) {
                 close(0);
                 close(1);
                 close(2);
                 if (-1 == open_tty(tty)) {
-                        exit(1);
+                        _exit(1);
                 }
 
                 chdir(home);
@@ -53,6 +53,7 @@ static void spawn_shell_on(char *tty)
 
                 execve(sh, empty, empty);
                 fprintf(stderr, "exec failed!\n");
+                _exit(1);
         }
 }
 
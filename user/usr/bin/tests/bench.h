@@ -0,0 +1,16 @@
+#pragma once
+
+/* Helpers shared by the userland benchmarks. */
+
+#include <sys/types.h>
+
+/* Reads the processor's time stamp counter */
+static inline uint64_t bench_rdtsc(void)
+{
+        uint32_t lo, hi;
+        __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+        return ((uint64_t)hi << 32) | lo;
+}
+
+/* Cycle counts are printed in thousands so they fit in a long */
+#define bench_kcycles(c) ((unsigned long)((c) / 1000))
@@ -19,23 +19,47 @@
 /* TODO ensure this matches the kernel value */
 #define PAGE_SIZE 4096
 
-static void eat(void *addr, int *count, int *num)
+/* Touches one page. Reading never-written anonymous memory only maps the
+ * zero page, writing it takes a page of memory (or swap) for real. */
+static void bite(void *addr, int *count, int write)
+{
+        char *page = (char *)addr + ((*count)++ * PAGE_SIZE);
+        if (write) {
+                *(int *)page = *count;
+        } else {
+                char foo = *page;
+        }
+        if ((*count & 0x7f) == 0)
+                printf("Ate %d pages\n", *count);
+}
+
+/* Checks that every written page still holds what was written to it,
+ * wherever it has been in between */
+static int digest(void *addr, int count)
+{
+        int i;
+        for (i = 0; i < count; i++) {
+                if (*(int *)((char *)addr + i * PAGE_SIZE) != i + 1) {
+                        fprintf(stderr, "Page %d lost its contents!\n", i);
+                        return 1;
+                }
+        }
+        return 0;
+}
+
+static void eat(void *addr, int *count, int *num, int write)
 {
         int status;
         test_fork_begin() {
                 if (*num <= 0) {
                         /* Eat the memory until we die */
                         while (1) {
-                                char foo = *((char *)addr + ((*count)++ * PAGE_SIZE));
-                                if ((*count & 0x7f) == 0)
-                                        printf("Ate %d pages\n", *count);
+                                bite(addr, count, write);
                         }
                 } else {
                         /* Eat until we have the necessary number of pages */
                         while (*count < *num) {
-                                char foo = *((char *)addr + ((*count)++ * PAGE_SIZE));
-                                if ((*count & 0x7f) == 0)
-                                        printf("Ate %d pages\n", *count);
+                                bite(addr, count, write);
                         }
                 }
         } test_fork_end(&status);
@@ -55,11 +79,13 @@ static void eat(void *addr, int *count, int *num)
 #define FLAG_INFINITE "-i"
 #define FLAG_ITER     "-y"
 #define FLAG_NUM      "-#"
+#define FLAG_WRITE    "-w"
 
 #define OPT_DAEMON    1
 #define OPT_INFINITE  2
 #define OPT_ITER       4
 #define OPT_NUM    8
+#define OPT_WRITE     16
 
 int parse_args(int argc, char **argv, int *opts, int *iter, int *num)
 {
@@ -77,6 +103,8 @@ int parse_args(int argc, char **argv, int *opts, int *iter, int *num)
                                             0 != errno)) {
                                 return -1;
                         }
+                } else if (!strcmp(FLAG_WRITE, argv[i])) {
+                        *opts |= OPT_WRITE;
                 } else if (!strcmp(FLAG_NUM, argv[i])) {
                         *opts |= OPT_NUM;
                         if (++i >= argc || (errno = 0,
@@ -126,7 +154,8 @@ int main(int argc, char **argv)
                         FLAG_DAEMON   "          run as daemon\n"
                         FLAG_INFINITE "          run forever\n"
                         FLAG_ITER     " [num]    number of iterations to yield\n"
-                        FLAG_NUM      " [num]    number of pages to eat (if negative, to relinquish)\n");
+                        FLAG_NUM      " [num]    number of pages to eat (if negative, to relinquish)\n"
+                        FLAG_WRITE    "          write the pages instead of only reading them\n");
                 return 1;
         }
 
@@ -139,9 +168,11 @@ int main(int argc, char **argv)
                         exit(0);
         }
 
-        eat(addr, count, num);
+        eat(addr, count, num, *opts & OPT_WRITE);
 
         printf("Ate %d pages in total\n", *count);
+        if ((*opts & OPT_WRITE) && 0 < *num && digest(addr, *count))
+                return 1;
 
         if (*opts & OPT_INFINITE) {
                 while (1) {
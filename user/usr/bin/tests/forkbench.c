@@ -0,0 +1,134 @@
+/*
+ * Fork-heavy benchmark. The process maps its own executable read-only
+ * and private, as the text of a program is mapped, and reads it all,
+ * then repeatedly forks a child which reads it all again and exits.
+ *
+ * It reports the cost of each fork and of reading the mapping again
+ * afterwards, in the parent and in the child. Read-only private areas
+ * are shared between parent and child, so the parent keeps its
+ * mappings across the fork and never has to fault them back in, and
+ * the chain under the area does not grow with every fork (the depth
+ * of each area's chain is shown by the vmmap debug output).
+ *
+ * Then it writes every page of a private anonymous area, forks a child
+ * which writes them all again and exits, and writes them all again
+ * itself. The child's writes have to copy each page, the parent still
+ * sees the old contents. Once the child is gone the parent is the only
+ * one left with the pages and its writes should not copy anything.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <stdio.h>
+
+#include "page.h"
+#include "bench.h"
+
+#define ROUNDS  64
+#define SELF    "/usr/bin/forkbench"
+#define NWRITE  256
+
+static unsigned long read_all(const char *addr, size_t len)
+{
+        unsigned long sum = 0;
+        size_t off;
+
+        for (off = 0; off < len; off += PAGE_SIZE) {
+                sum += addr[off];
+        }
+        return sum;
+}
+
+static void write_all(char *addr, size_t len, char c)
+{
+        size_t off;
+
+        for (off = 0; off < len; off += PAGE_SIZE) {
+                addr[off] = c;
+        }
+}
+
+static int fork_then_write(void)
+{
+        uint64_t start, child, parent = 0;
+        char *mem;
+        int i, status;
+
+        if (MAP_FAILED == (mem = mmap(NULL, NWRITE * PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                      MAP_PRIVATE | MAP_ANON, -1, 0))) {
+                fprintf(stderr, "forkbench: mmap failed\n");
+                return 1;
+        }
+        write_all(mem, NWRITE * PAGE_SIZE, 'p');
+
+        for (i = 0; i < ROUNDS / 8; ++i) {
+                if (0 == fork()) {
+                        start = bench_rdtsc();
+                        write_all(mem, NWRITE * PAGE_SIZE, 'c');
+                        child = bench_rdtsc() - start;
+                        if (0 == i) {
+                                printf("%d pages written by the child, copying: %lu cycles/page\n",
+                                       NWRITE, (unsigned long)(child / NWRITE));
+                        }
+                        exit(0);
+                }
+                wait(&status);
+
+                start = bench_rdtsc();
+                write_all(mem, NWRITE * PAGE_SIZE, 'p');
+                parent += bench_rdtsc() - start;
+        }
+
+        printf("%d pages written by the parent after the child exited: %lu cycles/page\n",
+               NWRITE, (unsigned long)(parent / (ROUNDS / 8) / NWRITE));
+        munmap(mem, NWRITE * PAGE_SIZE);
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        uint64_t start, forking = 0, parent = 0;
+        struct stat st;
+        char *text;
+        int fd, i, pid, status;
+
+        if (0 > stat(SELF, &st) || 0 > (fd = open(SELF, O_RDONLY, 0))) {
+                fprintf(stderr, "forkbench: cannot open " SELF "\n");
+                return 1;
+        }
+        if (MAP_FAILED == (text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0))) {
+                fprintf(stderr, "forkbench: mmap failed\n");
+                return 1;
+        }
+        close(fd);
+        read_all(text, st.st_size);
+
+        for (i = 0; i < ROUNDS; ++i) {
+                start = bench_rdtsc();
+                if (0 == (pid = fork())) {
+                        read_all(text, st.st_size);
+                        exit(0);
+                } else if (0 > pid) {
+                        fprintf(stderr, "forkbench: fork failed\n");
+                        return 1;
+                }
+                forking += bench_rdtsc() - start;
+
+                start = bench_rdtsc();
+                read_all(text, st.st_size);
+                parent += bench_rdtsc() - start;
+
+                wait(&status);
+        }
+
+        printf("%d read-only pages, %d forks: fork %lu kcycles, parent re-read %lu kcycles\n",
+               (int)((st.st_size + PAGE_SIZE - 1) / PAGE_SIZE), ROUNDS,
+               bench_kcycles(forking / ROUNDS), bench_kcycles(parent / ROUNDS));
+
+        munmap(text, st.st_size);
+        return fork_then_write();
+}
@@ -0,0 +1,62 @@
+/*
+ * Sweeps a large anonymous array, once mapped with ordinary pages and
+ * once with MAP_LARGEPAGE, and reports the cost of faulting it in and of
+ * repeatedly touching one word per page (which is mostly TLB misses
+ * when the array is mapped with small pages).
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+
+#include "page.h"
+#include "bench.h"
+
+/* 4mb aligned so that each 4mb of the array can be a large page */
+#define ARRAY_ADDR   ((void *)0x40000000)
+#define ARRAY_SIZE   (8 * 1024 * 1024)
+#define NSWEEPS      32
+
+static int sweep(const char *name, int flags)
+{
+        volatile char *array;
+        uint64_t start, fault, touch;
+        int i, j;
+
+        array = mmap(ARRAY_ADDR, ARRAY_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANON | MAP_FIXED | flags, -1, 0);
+        if (MAP_FAILED == array) {
+                fprintf(stderr, "largepage: mmap failed for %s pages\n", name);
+                return 1;
+        }
+
+        start = bench_rdtsc();
+        for (i = 0; i < ARRAY_SIZE; i += PAGE_SIZE) {
+                array[i] = (char)i;
+        }
+        fault = bench_rdtsc() - start;
+
+        start = bench_rdtsc();
+        for (j = 0; j < NSWEEPS; ++j) {
+                for (i = 0; i < ARRAY_SIZE; i += PAGE_SIZE) {
+                        (void)array[i];
+                }
+        }
+        touch = bench_rdtsc() - start;
+
+        printf("%6s pages: fault-in %lu kcycles, %d sweeps %lu kcycles (%lu cycles/page)\n",
+               name, bench_kcycles(fault), NSWEEPS, bench_kcycles(touch),
+               (unsigned long)(touch / (NSWEEPS * (ARRAY_SIZE / PAGE_SIZE))));
+
+        munmap((void *)array, ARRAY_SIZE);
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        if (sweep("small", 0) || sweep("large", MAP_LARGEPAGE)) {
+                return 1;
+        }
+        return 0;
+}
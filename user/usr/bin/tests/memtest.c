@@ -591,6 +591,346 @@ static int test_mmap_beyond(void)
         return 0;
 }
 
+static int test_madvise(void)
+{
+        char *addr, *shared;
+        int i;
+
+        printf("Testing madvise() and MAP_POPULATE\n");
+
+        test_assert(MAP_FAILED != (addr = mmap(NULL, PAGE_SIZE * 8, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANON | MAP_POPULATE, -1, 0)), NULL);
+        for (i = 0; i < 8; ++i) {
+                test_assert('\0' == *(addr + PAGE_SIZE * i), NULL);
+                *(addr + PAGE_SIZE * i) = 'a';
+        }
+
+        /* Access pattern advice doesn't change the contents */
+        test_assert(0 == madvise(addr + PAGE_SIZE, PAGE_SIZE * 2, MADV_SEQUENTIAL), NULL);
+        test_assert(0 == madvise(addr + PAGE_SIZE * 5, PAGE_SIZE, MADV_RANDOM), NULL);
+        test_assert(0 == madvise(addr, PAGE_SIZE * 8, MADV_WILLNEED), NULL);
+        for (i = 0; i < 8; ++i) {
+                test_assert('a' == *(addr + PAGE_SIZE * i), NULL);
+        }
+
+        /* Private pages which are given up come back zeroed */
+        test_assert(0 == madvise(addr + PAGE_SIZE * 2, PAGE_SIZE * 2, MADV_DONTNEED), NULL);
+        test_assert(0 == madvise(addr + PAGE_SIZE * 6, PAGE_SIZE, MADV_FREE), NULL);
+        test_assert('a' == *(addr + PAGE_SIZE), NULL);
+        test_assert('\0' == *(addr + PAGE_SIZE * 2), NULL);
+        test_assert('\0' == *(addr + PAGE_SIZE * 3), NULL);
+        test_assert('a' == *(addr + PAGE_SIZE * 4), NULL);
+        test_assert('\0' == *(addr + PAGE_SIZE * 6), NULL);
+        test_assert('a' == *(addr + PAGE_SIZE * 7), NULL);
+        assert_nofault(*(addr + PAGE_SIZE * 6) = 'b', "");
+
+        /* Shared pages are kept */
+        test_assert(MAP_FAILED != (shared = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                                 MAP_SHARED | MAP_ANON, -1, 0)), NULL);
+        *shared = 's';
+        test_assert(0 == madvise(shared, PAGE_SIZE, MADV_DONTNEED), NULL);
+        test_assert('s' == *shared, NULL);
+        test_assert(-1 == madvise(shared, PAGE_SIZE, MADV_FREE) && EINVAL == errno, NULL);
+
+        /* Bad arguments */
+        test_assert(-1 == madvise(addr + 1, PAGE_SIZE, MADV_DONTNEED) && EINVAL == errno, NULL);
+        test_assert(-1 == madvise(addr, PAGE_SIZE, 42) && EINVAL == errno, NULL);
+        test_assert(0 == munmap(addr + PAGE_SIZE * 4, PAGE_SIZE), NULL);
+        test_assert(-1 == madvise(addr, PAGE_SIZE * 8, MADV_RANDOM) && ENOMEM == errno, NULL);
+        test_assert(-1 == madvise(addr, PAGE_SIZE * 8, MADV_DONTNEED) && ENOMEM == errno, NULL);
+        test_assert('a' == *addr, "nothing is done unless the whole range is mapped");
+
+        test_assert(0 == munmap(addr, PAGE_SIZE * 8), NULL);
+        test_assert(0 == munmap(shared, PAGE_SIZE), NULL);
+        return 0;
+}
+
+static int test_zero_page(void)
+{
+        char *priv, *shared;
+        int i, status;
+
+        printf("Testing never-written anonymous memory\n");
+
+        test_assert(MAP_FAILED != (priv = mmap(NULL, PAGE_SIZE * 16, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)), NULL);
+        test_assert(MAP_FAILED != (shared = mmap(NULL, PAGE_SIZE * 4, PROT_READ | PROT_WRITE,
+                                                 MAP_SHARED | MAP_ANONYMOUS, -1, 0)), NULL);
+
+        /* Reading leaves every page zero, writing one page leaves the others alone */
+        for (i = 0; i < 16; ++i) {
+                test_assert('\0' == *(priv + PAGE_SIZE * i), NULL);
+        }
+        *(priv + PAGE_SIZE * 3) = 'p';
+        for (i = 0; i < 16; ++i) {
+                test_assert((3 == i ? 'p' : '\0') == *(priv + PAGE_SIZE * i), NULL);
+        }
+
+        /* A page which was only read must see writes made through
+         * the mapping by another process */
+        test_assert('\0' == *shared, NULL);
+        test_fork_begin() {
+                *shared = 's';
+                *priv = 'c';
+                return 0;
+        } test_fork_end(&status);
+        test_assert(0 == status, NULL);
+        test_assert('s' == *shared, NULL);
+        test_assert('\0' == *priv, "private memory is not shared with the child");
+
+        test_assert(0 == munmap(priv, PAGE_SIZE * 16), NULL);
+        test_assert(0 == munmap(shared, PAGE_SIZE * 4), NULL);
+        return 0;
+}
+
+static int test_fork_chain(void)
+{
+        char *priv;
+        int i, j, status;
+
+        printf("Testing private memory across repeated forks\n");
+
+        test_assert(MAP_FAILED != (priv = mmap(NULL, PAGE_SIZE * 8, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)), NULL);
+
+        /* Every fork adds a level to the shadow chain under priv and
+         * every child that exits should take one away again, the
+         * pages written before the fork must survive the collapse */
+        for (i = 0; i < 64; ++i) {
+                *(priv + PAGE_SIZE * (i % 8)) = (char)i;
+                test_fork_begin() {
+                        for (j = 0; j < 8 && j <= i; ++j) {
+                                if (*(priv + PAGE_SIZE * j) != (char)(i - (i - j) % 8)) {
+                                        return 1;
+                                }
+                        }
+                        *(priv + PAGE_SIZE * (i % 8)) = 'c';
+                        return 0;
+                } test_fork_end(&status);
+                test_assert(0 == status, "child saw the pages written before the fork");
+                test_assert((char)i == *(priv + PAGE_SIZE * (i % 8)), NULL);
+        }
+
+        test_assert(0 == munmap(priv, PAGE_SIZE * 8), NULL);
+        return 0;
+}
+
+static int test_vfork(void)
+{
+        volatile int shared = 0;
+        int pid, status;
+
+        printf("Testing vfork\n");
+
+        /* The parent does not run again until the child exits, and
+         * sees what the child wrote since they share the address space */
+        if (0 == (pid = vfork())) {
+                shared = 1;
+                _exit(3);
+        }
+        test_assert(0 < pid, NULL);
+        test_assert(1 == shared, "child ran in the parent's address space before the parent resumed");
+        test_assert(pid == wait(&status), NULL);
+        test_assert(3 == status, NULL);
+        return 0;
+}
+
+static int test_mremap(void)
+{
+        char *addr, *moved, *blocker, *big;
+        int i;
+
+        printf("Testing mremap()\n");
+
+        /* Grow in place into the free pages right after the mapping */
+        test_assert(MAP_FAILED != (addr = mmap(NULL, PAGE_SIZE * 8, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANON, -1, 0)), NULL);
+        test_assert(0 == munmap(addr + PAGE_SIZE * 4, PAGE_SIZE * 4), NULL);
+        for (i = 0; i < 4; ++i) {
+                *(addr + PAGE_SIZE * i) = 'a' + i;
+        }
+        test_assert(addr == mremap(addr, PAGE_SIZE * 4, PAGE_SIZE * 6, 0), NULL);
+        test_assert('\0' == *(addr + PAGE_SIZE * 5), NULL);
+        *(addr + PAGE_SIZE * 5) = 'f';
+
+        /* Something in the way: only grows if it may move */
+        test_assert(MAP_FAILED != (blocker = mmap(addr + PAGE_SIZE * 6, PAGE_SIZE,
+                                                  PROT_READ | PROT_WRITE,
+                                                  MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0)), NULL);
+        test_assert(MAP_FAILED == mremap(addr, PAGE_SIZE * 6, PAGE_SIZE * 12, 0)
+                    && ENOMEM == errno, NULL);
+        test_assert(MAP_FAILED != (moved = mremap(addr, PAGE_SIZE * 6, PAGE_SIZE * 12,
+                                                  MREMAP_MAYMOVE)), NULL);
+        test_assert(moved != addr, NULL);
+        for (i = 0; i < 4; ++i) {
+                test_assert('a' + i == *(moved + PAGE_SIZE * i), "contents move with the mapping");
+        }
+        test_assert('f' == *(moved + PAGE_SIZE * 5), NULL);
+        test_assert('\0' == *(moved + PAGE_SIZE * 11), NULL);
+        assert_fault(char c = *addr, "old range is unmapped");
+
+        /* Shrinking unmaps the end */
+        test_assert(moved == mremap(moved, PAGE_SIZE * 12, PAGE_SIZE * 2, 0), NULL);
+        test_assert('b' == *(moved + PAGE_SIZE), NULL);
+        assert_fault(char c = *(moved + PAGE_SIZE * 2), "");
+
+        /* Bad arguments */
+        test_assert(MAP_FAILED == mremap(moved + 1, PAGE_SIZE, PAGE_SIZE * 2, 0)
+                    && EINVAL == errno, NULL);
+        test_assert(MAP_FAILED == mremap(moved, PAGE_SIZE, PAGE_SIZE * 2, 42)
+                    && EINVAL == errno, NULL);
+        test_assert(MAP_FAILED == mremap(moved, PAGE_SIZE * 4, PAGE_SIZE * 8, MREMAP_MAYMOVE)
+                    && EFAULT == errno, "range must be mapped");
+
+        test_assert(0 == munmap(moved, PAGE_SIZE * 2), NULL);
+        test_assert(0 == munmap(blocker, PAGE_SIZE), NULL);
+
+        /* realloc() of large blocks keeps the contents */
+        test_assert(NULL != (big = malloc(PAGE_SIZE * 32)), NULL);
+        for (i = 0; i < 32; ++i) {
+                big[PAGE_SIZE * i] = 'a' + i;
+        }
+        test_assert(NULL != (big = realloc(big, PAGE_SIZE * 256)), NULL);
+        for (i = 0; i < 32; ++i) {
+                test_assert('a' + i == big[PAGE_SIZE * i], NULL);
+        }
+        big[PAGE_SIZE * 255] = 'z';
+        free(big);
+        return 0;
+}
+
+static int test_rsslimit(void)
+{
+        char *addr;
+        int i, pass, status;
+
+        printf("Testing rsslimit()\n");
+
+        /* Touching many more pages than the limit keeps working, pages
+         * taken away to stay under it come back with what was in them */
+        test_assert(0 == rsslimit(16), NULL);
+        test_assert(MAP_FAILED != (addr = mmap(NULL, PAGE_SIZE * 64, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANON, -1, 0)), NULL);
+        for (pass = 0; pass < 2; ++pass) {
+                for (i = 0; i < 64; ++i) {
+                        *(addr + PAGE_SIZE * i) = 'a' + (i + pass) % 26;
+                }
+                for (i = 0; i < 64; ++i) {
+                        test_assert('a' + (i + pass) % 26 == *(addr + PAGE_SIZE * i), NULL);
+                }
+        }
+
+        /* Children get the limit too */
+        test_fork_begin() {
+                for (i = 0; i < 64; ++i) {
+                        if ('a' + (i + 1) % 26 != *(addr + PAGE_SIZE * i)) {
+                                exit(1);
+                        }
+                        *(addr + PAGE_SIZE * i) = 'z';
+                }
+        } test_fork_end(&status);
+        test_assert(0 == status, "child saw the parent's pages");
+        test_assert('a' == *(addr + PAGE_SIZE * 25), "parent's copy is its own");
+
+        test_assert(0 == rsslimit(0), NULL);
+        test_assert(0 == munmap(addr, PAGE_SIZE * 64), NULL);
+        return 0;
+}
+
+static int test_exit_teardown(void)
+{
+        char *addr;
+        int i, n, status;
+
+        printf("Testing address space teardown on exit\n");
+
+        /* Children copy every page and exit, freeing their copies
+         * must leave the pages they were copied from alone */
+        test_assert(MAP_FAILED != (addr = mmap(NULL, PAGE_SIZE * 64, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_ANON, -1, 0)), NULL);
+        for (i = 0; i < 64; ++i) {
+                *(addr + PAGE_SIZE * i) = 'a' + i % 26;
+        }
+        for (n = 0; n < 32; ++n) {
+                test_fork_begin() {
+                        for (i = 0; i < 64; ++i) {
+                                *(addr + PAGE_SIZE * i) = 'z';
+                        }
+                } test_fork_end(&status);
+                test_assert(0 == status, NULL);
+        }
+        for (i = 0; i < 64; ++i) {
+                test_assert('a' + i % 26 == *(addr + PAGE_SIZE * i), "parent's pages changed");
+        }
+
+        test_assert(0 == munmap(addr, PAGE_SIZE * 64), NULL);
+        return 0;
+}
+
+static int test_shm(void)
+{
+        char *addr, *view;
+        size_t i;
+        int id, status;
+
+        printf("Testing shm_open()\n");
+
+        test_assert(-1 == shm_open("memtest", PAGE_SIZE * 4, 0) && ENOENT == errno, NULL);
+        test_assert(0 <= (id = shm_open("memtest", PAGE_SIZE * 4, O_CREAT)), NULL);
+        test_assert(id == shm_open("memtest", 0, 0), "a segment is found by name");
+        test_assert(MAP_FAILED != (addr = mmap(NULL, PAGE_SIZE * 4, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_SHM, id, 0)), NULL);
+        test_assert('\0' == *(addr + PAGE_SIZE * 3), "a new segment is zeroed");
+
+        /* A child which maps the segment by name itself shares its pages */
+        test_fork_begin() {
+                int cid = shm_open("memtest", 0, 0);
+                char *caddr;
+
+                munmap(addr, PAGE_SIZE * 4);
+                if (MAP_FAILED == (caddr = mmap(NULL, PAGE_SIZE * 2, PROT_READ | PROT_WRITE,
+                                                MAP_SHARED | MAP_SHM, cid, PAGE_SIZE * 2))) {
+                        return 1;
+                }
+                for (i = 0; i < PAGE_SIZE * 2; ++i) {
+                        caddr[i] = 'a' + i % 26;
+                }
+                return 0;
+        } test_fork_end(&status);
+        test_assert(0 == status, NULL);
+        for (i = 0; i < PAGE_SIZE * 2; ++i) {
+                if ((char)('a' + i % 26) != addr[PAGE_SIZE * 2 + i]) {
+                        break;
+                }
+        }
+        test_assert(PAGE_SIZE * 2 == i, "the parent sees what the child wrote");
+
+        /* A private mapping sees the segment but keeps its writes */
+        test_assert(MAP_FAILED != (view = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                               MAP_PRIVATE | MAP_SHM, id, PAGE_SIZE * 2)), NULL);
+        test_assert('a' == *view, NULL);
+        *view = 'p';
+        test_assert('a' == *(addr + PAGE_SIZE * 2), NULL);
+        test_assert(0 == munmap(view, PAGE_SIZE), NULL);
+
+        /* Bad arguments */
+        test_assert(MAP_FAILED == mmap(NULL, PAGE_SIZE * 2, PROT_READ, MAP_SHARED | MAP_SHM, id, PAGE_SIZE * 3)
+                    && EINVAL == errno, "the mapping must be inside the segment");
+        test_assert(MAP_FAILED == mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED | MAP_SHM, 1000, 0)
+                    && EBADF == errno, NULL);
+        test_assert(-1 == shm_open("", PAGE_SIZE, O_CREAT) && EINVAL == errno, NULL);
+
+        /* Unlinking takes the name away, not the memory */
+        test_assert(0 == shm_unlink("memtest"), NULL);
+        test_assert(-1 == shm_unlink("memtest") && ENOENT == errno, NULL);
+        test_assert(-1 == shm_open("memtest", 0, 0) && ENOENT == errno, NULL);
+        test_assert('c' == *(addr + PAGE_SIZE * 2 + 2), NULL);
+        *addr = 'x';
+        test_assert('x' == *addr, NULL);
+        test_assert(0 == munmap(addr, PAGE_SIZE * 4), NULL);
+        return 0;
+}
+
 int main(int argc, char **argv)
 {
         if (argc != 1) {
@@ -622,6 +962,14 @@ int main(int argc, char **argv)
         childtest(test_mmap_fill);
         childtest(test_mmap_repeat);
         childtest(test_mmap_beyond);
+        childtest(test_madvise);
+        childtest(test_zero_page);
+        childtest(test_fork_chain);
+        childtest(test_vfork);
+        childtest(test_mremap);
+        childtest(test_rsslimit);
+        childtest(test_exit_teardown);
+        childtest(test_shm);
         test_fini();
 
         return 0;
@@ -0,0 +1,116 @@
+/*
+ * Scheduler benchmark: interactive wakeup latency under CPU-bound load.
+ *
+ * usage: schedbench [spinners [nice]]
+ *
+ * The process starts a number of spinners, children which burn the
+ * CPU and yield it every SPIN_KCYCLES thousand cycles, so that the
+ * benchmark also works without preemption (see spinlat for spinners
+ * which never yield), reniced by the given amount if there is one.
+ * Then it repeatedly forks a child which notes the time and exits
+ * straight away, and measures how long after that it is running again
+ * on return from wait(). That is how long a thread woken from a sleep,
+ * as a shell woken by a keypress is, waits behind the spinners.
+ *
+ * The spinners drop to the lower levels of the run queue as they use
+ * the CPU and the waiting parent is raised when it is woken, so the
+ * latency should be about one spinner's turn rather than one turn of
+ * every spinner. Renicing the spinners to a positive value should make
+ * it smaller still.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+
+#include "page.h"
+#include "bench.h"
+
+#define ROUNDS          256
+#define NSPIN           4
+#define SPIN_KCYCLES    500
+
+typedef struct shared {
+        volatile int            stop;
+        volatile uint64_t       exited;
+} shared_t;
+
+static void spin(shared_t *sh)
+{
+        uint64_t start;
+
+        while (!sh->stop) {
+                start = bench_rdtsc();
+                while (bench_rdtsc() - start < (uint64_t)SPIN_KCYCLES * 1000);
+                sched_yield();
+        }
+        exit(0);
+}
+
+int main(int argc, char **argv)
+{
+        uint64_t latency, total = 0, max = 0;
+        int nspin = NSPIN, incr = 0;
+        shared_t *sh;
+        int i, pid, status;
+
+        if (argc > 1) {
+                nspin = atoi(argv[1]);
+        }
+        if (argc > 2) {
+                incr = atoi(argv[2]);
+        }
+
+        if (MAP_FAILED == (sh = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_ANON, -1, 0))) {
+                fprintf(stderr, "schedbench: mmap failed\n");
+                return 1;
+        }
+        sh->stop = 0;
+
+        for (i = 0; i < nspin; ++i) {
+                if (0 == (pid = fork())) {
+                        if (0 != incr) {
+                                nice(incr);
+                        }
+                        spin(sh);
+                } else if (0 > pid) {
+                        fprintf(stderr, "schedbench: fork failed\n");
+                        return 1;
+                }
+        }
+
+        /* let the spinners use up their first slices */
+        for (i = 0; i < nspin * 8; ++i) {
+                sched_yield();
+        }
+
+        for (i = 0; i < ROUNDS; ++i) {
+                if (0 == (pid = fork())) {
+                        sh->exited = bench_rdtsc();
+                        exit(0);
+                } else if (0 > pid) {
+                        fprintf(stderr, "schedbench: fork failed\n");
+                        sh->stop = 1;
+                        return 1;
+                }
+                waitpid(pid, 0, &status);
+                latency = bench_rdtsc() - sh->exited;
+                total += latency;
+                if (latency > max) {
+                        max = latency;
+                }
+        }
+
+        sh->stop = 1;
+        for (i = 0; i < nspin; ++i) {
+                wait(&status);
+        }
+
+        printf("%d spinners at nice %d, %d wakeups\n", nspin, incr, ROUNDS);
+        printf("wakeup latency: %lu kcycles average, %lu kcycles max\n",
+               bench_kcycles(total / ROUNDS), bench_kcycles(max));
+        munmap(sh, PAGE_SIZE);
+        return 0;
+}
@@ -0,0 +1,92 @@
+/*
+ * Sleep benchmark: how long nanosleep() really sleeps for.
+ *
+ * usage: sleepbench [spinners]
+ *
+ * The process first sleeps for a second to find out how many cycles
+ * that is, then sleeps for a range of shorter times ROUNDS times each
+ * and reports how long the sleeps took on average and at most. A sleep
+ * takes at least as long as asked for and up to a clock tick more.
+ *
+ * With no spinners the machine is idle while the process sleeps, and
+ * the clock only ticks when a timer is due. With spinners running next
+ * to it the oversleep also shows how long it waits for the CPU once
+ * its time is up.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "page.h"
+#include "bench.h"
+
+#define ROUNDS  16
+
+static const long sleep_usecs[] = { 1000, 10000, 25000, 100000 };
+
+int main(int argc, char **argv)
+{
+        uint64_t start, took, total, max, per_sec;
+        struct timespec req;
+        volatile int *stop;
+        int nspin = 0;
+        unsigned int i;
+        int j, pid, status;
+
+        if (argc > 1) {
+                nspin = atoi(argv[1]);
+        }
+
+        if (MAP_FAILED == (stop = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_ANON, -1, 0))) {
+                fprintf(stderr, "sleepbench: mmap failed\n");
+                return 1;
+        }
+        *stop = 0;
+        for (j = 0; j < nspin; ++j) {
+                if (0 == (pid = fork())) {
+                        while (!*stop);
+                        exit(0);
+                } else if (0 > pid) {
+                        fprintf(stderr, "sleepbench: fork failed\n");
+                        return 1;
+                }
+        }
+
+        start = bench_rdtsc();
+        sleep(1);
+        per_sec = bench_rdtsc() - start;
+        printf("%d spinners, sleep(1) took %lu kcycles\n", nspin, bench_kcycles(per_sec));
+
+        for (i = 0; i < sizeof(sleep_usecs) / sizeof(sleep_usecs[0]); ++i) {
+                req.tv_sec = 0;
+                req.tv_nsec = sleep_usecs[i] * 1000;
+                total = max = 0;
+                for (j = 0; j < ROUNDS; ++j) {
+                        start = bench_rdtsc();
+                        if (0 > nanosleep(&req, NULL)) {
+                                fprintf(stderr, "sleepbench: nanosleep failed\n");
+                                *stop = 1;
+                                return 1;
+                        }
+                        took = bench_rdtsc() - start;
+                        total += took;
+                        if (took > max) {
+                                max = took;
+                        }
+                }
+                printf("%6ld us: %6lu us average, %6lu us max\n", sleep_usecs[i],
+                       (unsigned long)(total / ROUNDS * 1000000 / per_sec),
+                       (unsigned long)(max * 1000000 / per_sec));
+        }
+
+        *stop = 1;
+        for (j = 0; j < nspin; ++j) {
+                wait(&status);
+        }
+        munmap((void *)stop, PAGE_SIZE);
+        return 0;
+}
@@ -0,0 +1,73 @@
+/*
+ * Measures how long it takes to launch a command the way sh does,
+ * creating a child which execs a program that exits straight away and
+ * waiting for it, with fork() and with vfork(). The parent's heap is
+ * grown between rounds: fork() has to copy more of the address space
+ * each time, vfork() copies none of it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "page.h"
+#include "bench.h"
+
+#define ROUNDS  32
+#define SELF    "/usr/bin/spawnbench"
+
+static char *child_argv[] = { SELF, "-x", NULL };
+static char *child_envp[] = { NULL };
+
+static int launch(int use_vfork, uint64_t *cycles)
+{
+        uint64_t start;
+        int i, pid, status;
+
+        start = bench_rdtsc();
+        for (i = 0; i < ROUNDS; ++i) {
+                if (0 == (pid = use_vfork ? vfork() : fork())) {
+                        execve(SELF, child_argv, child_envp);
+                        _exit(1);
+                } else if (0 > pid) {
+                        fprintf(stderr, "spawnbench: %s failed\n", use_vfork ? "vfork" : "fork");
+                        return 1;
+                }
+                wait(&status);
+                if (0 != status) {
+                        fprintf(stderr, "spawnbench: could not exec " SELF "\n");
+                        return 1;
+                }
+        }
+        *cycles = (bench_rdtsc() - start) / ROUNDS;
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        uint64_t forked, vforked;
+        size_t heap = 0, grow;
+        char *mem;
+
+        if (argc > 1 && !strcmp("-x", argv[1])) {
+                return 0;
+        }
+        for (grow = 0; grow <= 256 * PAGE_SIZE; grow = grow ? grow * 4 : 16 * PAGE_SIZE) {
+                if (grow > heap) {
+                        if (NULL == (mem = malloc(grow - heap))) {
+                                fprintf(stderr, "spawnbench: out of memory\n");
+                                return 1;
+                        }
+                        memset(mem, 1, grow - heap);
+                        heap = grow;
+                }
+                if (launch(0, &forked) || launch(1, &vforked)) {
+                        return 1;
+                }
+                printf("%4lu heap pages: fork+exec %6lu, vfork+exec %6lu kcycles/launch\n",
+                       (unsigned long)(heap / PAGE_SIZE), bench_kcycles(forked),
+                       bench_kcycles(vforked));
+        }
+        return 0;
+}
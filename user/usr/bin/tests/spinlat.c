@@ -0,0 +1,109 @@
+/*
+ * Tail latency of an interactive process next to spinners.
+ *
+ * usage: spinlat [spinners]
+ *
+ * The spinners are like /usr/bin/spin, they never make a system call
+ * and so only give up the CPU when the clock preempts them (they stop
+ * once a flag in a shared page is set, spin itself cannot be stopped).
+ * The process then repeatedly forks a child which does a little work,
+ * notes the time and exits, and measures how long after that it is
+ * running again on return from wait(), as a shell waiting for a
+ * command to finish would.
+ *
+ * It reports the median, 90th and 99th percentile and the worst of
+ * those latencies. Without preemption it never finishes.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+
+#include "page.h"
+#include "bench.h"
+
+#define ROUNDS          256
+#define NSPIN           1
+#define WORK_KCYCLES    100
+
+typedef struct shared {
+        volatile int            stop;
+        volatile uint64_t       exited;
+} shared_t;
+
+static void burn(unsigned long kcycles)
+{
+        uint64_t start = bench_rdtsc();
+        while (bench_rdtsc() - start < (uint64_t)kcycles * 1000);
+}
+
+static void sort(uint64_t *v, int n)
+{
+        uint64_t x;
+        int i, j;
+
+        for (i = 1; i < n; ++i) {
+                x = v[i];
+                for (j = i; j > 0 && v[j - 1] > x; --j) {
+                        v[j] = v[j - 1];
+                }
+                v[j] = x;
+        }
+}
+
+int main(int argc, char **argv)
+{
+        static uint64_t latency[ROUNDS];
+        int nspin = NSPIN;
+        shared_t *sh;
+        int i, pid, status;
+
+        if (argc > 1) {
+                nspin = atoi(argv[1]);
+        }
+
+        if (MAP_FAILED == (sh = mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE,
+                                     MAP_SHARED | MAP_ANON, -1, 0))) {
+                fprintf(stderr, "spinlat: mmap failed\n");
+                return 1;
+        }
+        sh->stop = 0;
+
+        for (i = 0; i < nspin; ++i) {
+                if (0 == (pid = fork())) {
+                        while (!sh->stop);
+                        exit(0);
+                } else if (0 > pid) {
+                        fprintf(stderr, "spinlat: fork failed\n");
+                        return 1;
+                }
+        }
+
+        for (i = 0; i < ROUNDS; ++i) {
+                if (0 == (pid = fork())) {
+                        burn(WORK_KCYCLES);
+                        sh->exited = bench_rdtsc();
+                        exit(0);
+                } else if (0 > pid) {
+                        fprintf(stderr, "spinlat: fork failed\n");
+                        sh->stop = 1;
+                        return 1;
+                }
+                waitpid(pid, 0, &status);
+                latency[i] = bench_rdtsc() - sh->exited;
+        }
+
+        sh->stop = 1;
+        for (i = 0; i < nspin; ++i) {
+                wait(&status);
+        }
+
+        sort(latency, ROUNDS);
+        printf("%d spinners, %d wakeups\n", nspin, ROUNDS);
+        printf("wakeup latency (kcycles): p50 %lu, p90 %lu, p99 %lu, max %lu\n",
+               bench_kcycles(latency[ROUNDS / 2]), bench_kcycles(latency[ROUNDS * 9 / 10]),
+               bench_kcycles(latency[ROUNDS * 99 / 100]), bench_kcycles(latency[ROUNDS - 1]));
+        munmap(sh, PAGE_SIZE);
+        return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * Maps a growing number of small, separate anonymous areas and reports
+ * the cost per area of mapping them (with a fixed address and with the
+ * kernel choosing one), of the first touch of each (a page fault, which
+ * has to find the area) and of unmapping them. With a linear vmmap all
+ * of these grow with the number of areas, with the tree they should
+ * stay roughly flat.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+
+#include "page.h"
+#include "bench.h"
+
+/* Areas are one page with a one page hole after each, so that none
+ * of them are adjacent */
+#define AREA_BASE    ((char *)0x40000000)
+#define AREA_STRIDE  (2 * PAGE_SIZE)
+#define MAX_AREAS    4096
+
+static char *areas[MAX_AREAS];
+
+static int run(int nareas, int fixed)
+{
+        uint64_t start, map, touch, unmap;
+        int i;
+
+        start = bench_rdtsc();
+        for (i = 0; i < nareas; ++i) {
+                areas[i] = mmap(fixed ? AREA_BASE + i * AREA_STRIDE : NULL, PAGE_SIZE,
+                                PROT_READ | PROT_WRITE,
+                                MAP_PRIVATE | MAP_ANON | (fixed ? MAP_FIXED : 0), -1, 0);
+                if (MAP_FAILED == areas[i]) {
+                        fprintf(stderr, "vmmapbench: mmap %d of %d failed\n", i, nareas);
+                        return 1;
+                }
+        }
+        map = bench_rdtsc() - start;
+
+        /* touch in an order which jumps around the address space */
+        start = bench_rdtsc();
+        for (i = 0; i < nareas; ++i) {
+                areas[(i * 7919) % nareas][0] = (char)i;
+        }
+        touch = bench_rdtsc() - start;
+
+        start = bench_rdtsc();
+        for (i = 0; i < nareas; ++i) {
+                munmap(areas[i], PAGE_SIZE);
+        }
+        unmap = bench_rdtsc() - start;
+
+        printf("%5d areas %5s: mmap %6lu, fault %6lu, munmap %6lu cycles/area\n",
+               nareas, fixed ? "fixed" : "any", (unsigned long)(map / nareas),
+               (unsigned long)(touch / nareas), (unsigned long)(unmap / nareas));
+        return 0;
+}
+
+int main(int argc, char **argv)
+{
+        int n;
+
+        for (n = 256; n <= MAX_AREAS; n *= 4) {
+                if (run(n, 1) || run(n, 0)) {
+                        return 1;
+                }
+        }
+        return 0;
+}